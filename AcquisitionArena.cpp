@@ -0,0 +1,21 @@
+#include "AcquisitionArena.h"
+
+
+AcquisitionArena::AcquisitionArena(size_t initialSize) :
+    m_heap(std::pmr::new_delete_resource()), m_arena(initialSize, &m_heap), m_front(&m_arena)
+{
+}
+
+QString AcquisitionArena::summary() const
+{
+    return "Decode arena: " + QString::number(allocations()) + " allocations (" +
+        QString::number(bytes() / 1024) + " KB) served from " + QString::number(heapBlocks()) +
+        " heap blocks (" + QString::number(heapBytes() / 1024) + " KB)";
+}
+
+void AcquisitionArena::release()
+{
+    m_arena.release();
+    m_front.resetCounts();
+    m_heap.resetCounts();
+}
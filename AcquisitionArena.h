@@ -0,0 +1,86 @@
+#pragma once
+
+#include <qstring.h>
+
+#include "CR35Utils.h"
+
+#include <cstddef>
+#include <memory_resource>
+
+
+/**
+ * @brief Memory resource that forwards to an upstream resource and counts allocations.
+ */
+class CountingResource : public std::pmr::memory_resource {
+public:
+    /**
+     * @brief Construct a counting adaptor.
+     * @param upstream Resource that performs the allocations.
+     */
+    explicit CountingResource(std::pmr::memory_resource* upstream) : m_upstream(upstream) { }
+
+    qint64 allocations() const { return m_allocations; } ///< Number of allocations since the last resetCounts().
+    qint64 bytes() const { return m_bytes; } ///< Bytes allocated since the last resetCounts().
+    void resetCounts() { m_allocations = 0; m_bytes = 0; } ///< Restart counting.
+
+private:
+    void* do_allocate(size_t bytes, size_t alignment) override
+    {
+        m_allocations++;
+        m_bytes += static_cast<qint64>(bytes);
+        return m_upstream->allocate(bytes, alignment);
+    }
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override { m_upstream->deallocate(p, bytes, alignment); }
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+
+    std::pmr::memory_resource* m_upstream; ///< Resource allocations are forwarded to.
+    qint64 m_allocations = 0; ///< Allocation count.
+    qint64 m_bytes = 0; ///< Allocated bytes.
+};
+
+/**
+ * @brief Per-acquisition bump allocator for decode bookkeeping.
+ *
+ * Scan lines and pixel segments of one acquisition are allocated from a
+ * std::pmr::monotonic_buffer_resource: individual deallocations are no-ops
+ * and the whole arena is returned in one step by release() once the frames
+ * have been handed off. Both the allocations served by the arena and the
+ * blocks it took from the heap are counted, so the summary shows how many
+ * heap allocations were saved.
+ *
+ * Not thread-safe; owned by the decoder that uses it.
+ */
+class AcquisitionArena {
+public:
+    /**
+     * @brief Construct an arena.
+     * @param initialSize Size of the first heap block; later blocks grow geometrically.
+     */
+    explicit AcquisitionArena(size_t initialSize = ACQUISITION_ARENA_BLOCK_SIZE);
+
+    AcquisitionArena(const AcquisitionArena&) = delete;
+    AcquisitionArena& operator=(const AcquisitionArena&) = delete;
+
+    std::pmr::memory_resource* resource() { return &m_front; } ///< Resource to allocate from.
+
+    qint64 allocations() const { return m_front.allocations(); } ///< Allocations served since the last release().
+    qint64 bytes() const { return m_front.bytes(); } ///< Bytes served since the last release().
+    qint64 heapBlocks() const { return m_heap.allocations(); } ///< Heap blocks taken since the last release().
+    qint64 heapBytes() const { return m_heap.bytes(); } ///< Heap bytes taken since the last release().
+
+    /**
+     * @brief Describe the counters in one log line.
+     */
+    QString summary() const;
+
+    /**
+     * @brief Return all memory to the heap and reset the counters.
+     * @note Nothing allocated from resource() may be used afterwards.
+     */
+    void release();
+
+private:
+    CountingResource m_heap; ///< Counts blocks the arena takes from the heap.
+    std::pmr::monotonic_buffer_resource m_arena; ///< Bump allocator.
+    CountingResource m_front; ///< Counts allocations served by the arena.
+};
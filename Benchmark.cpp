@@ -0,0 +1,418 @@
+#include "Benchmark.h"
+
+#include <qbuffer.h>
+#include <qdir.h>
+#include <qelapsedtimer.h>
+#include <qendian.h>
+#include <qfile.h>
+#include <qimage.h>
+#include <qthread.h>
+
+#include "CompressedFrame.h"
+#include "DicomWriter.h"
+#include "PackedFrame.h"
+#include "PngWriter.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+
+namespace {
+
+constexpr int BENCHMARK_WIDTH = 4096; ///< Default plate width.
+constexpr int BENCHMARK_HEIGHT = 4096; ///< Default plate height.
+constexpr int BENCHMARK_CODEC_RUNS = 5; ///< Runs per in-memory codec variant; the fastest one is reported.
+
+/**
+ * @brief Format one report line.
+ */
+QString reportLine(const QString& name, qint64 elapsedMs, qint64 pixels, qint64 fileSize)
+{
+    const double seconds = std::max<qint64>(elapsedMs, 1) / 1000.0;
+    return name.leftJustified(28) + QString::number(elapsedMs).rightJustified(7) + " ms " +
+        QString::number(pixels * 2 / seconds / (1024.0 * 1024.0), 'f', 1).rightJustified(8) + " MB/s " +
+        QString::number(fileSize).rightJustified(12) + " bytes";
+}
+
+/**
+ * @brief Format one in-memory codec report line.
+ */
+QString codecLine(const QString& name, qint64 elapsedNs, qint64 pixels, double ratio)
+{
+    const double seconds = std::max<qint64>(elapsedNs, 1) / 1e9;
+    return name.leftJustified(36) + QString::number(elapsedNs / 1e6, 'f', 2).rightJustified(9) + " ms " +
+        QString::number(pixels * 2 / seconds / 1e9, 'f', 2).rightJustified(7) + " GB/s " +
+        QString::number(ratio, 'f', 2).rightJustified(6) + " : 1";
+}
+
+/**
+ * @brief Fastest of BENCHMARK_CODEC_RUNS runs of a function, in nanoseconds.
+ */
+template <typename F>
+qint64 fastestRun(F&& run)
+{
+    qint64 best = std::numeric_limits<qint64>::max();
+    QElapsedTimer timer;
+    for (int i = 0; i < BENCHMARK_CODEC_RUNS; ++i)
+    {
+        timer.start();
+        run();
+        best = std::min(best, timer.nsecsElapsed());
+    }
+    return best;
+}
+
+/**
+ * @brief The export path CR35NDTPlus::saveImage used before PngWriter: copy into a QImage, QImage::save.
+ */
+bool saveWithQImage(const ImageFrame& frame, const QString& path)
+{
+    QImage img(frame.width, frame.height, QImage::Format_Grayscale16);
+    if (img.isNull())
+        return false;
+
+    const size_t srcBytesPerLine = static_cast<size_t>(frame.width) * sizeof(uint16_t);
+    for (int y = 0; y < frame.height; ++y)
+        memcpy(img.scanLine(y), frame.row(y), srcBytesPerLine);
+    return img.save(path, "png");
+}
+
+/**
+ * @brief Decode the lossless JPEG bitstream LosslessJpegEncoder writes; empty on a format error.
+ *
+ * Only what the encoder produces is understood: one component, one
+ * Huffman table, selection value 1 and no restart intervals.
+ */
+std::vector<uint16_t> decodeLosslessJpeg(const QByteArray& jpeg, int width, int height)
+{
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(jpeg.constData());
+    const qsizetype size = jpeg.size();
+    int precision = 0;
+    int counts[17] = {};
+    std::vector<int> values;
+
+    // Marker segments from SOI up to and including SOS.
+    qsizetype pos = 2;
+    for (;;)
+    {
+        if (pos + 4 > size || p[pos] != 0xFF)
+            return {};
+        const uint8_t marker = p[pos + 1];
+        const int length = p[pos + 2] << 8 | p[pos + 3];
+        const uint8_t* segment = p + pos + 4;
+        if (pos + 2 + length > size)
+            return {};
+        if (marker == 0xC3)
+        {
+            precision = segment[0];
+            if ((segment[1] << 8 | segment[2]) != height || (segment[3] << 8 | segment[4]) != width)
+                return {};
+        }
+        else if (marker == 0xC4)
+        {
+            int total = 0;
+            for (int l = 1; l <= 16; ++l)
+                total += counts[l] = segment[l];
+            values.assign(segment + 17, segment + 17 + total);
+        }
+        pos += 2 + length;
+        if (marker == 0xDA)
+            break;
+    }
+    if (precision < 2 || precision > 16 || values.empty())
+        return {};
+
+    // Canonical codes (T.81 Annex C): first code and first value index per length.
+    int firstCode[17] = {};
+    int firstIndex[17] = {};
+    for (int l = 1, code = 0, index = 0; l <= 16; ++l)
+    {
+        firstCode[l] = code;
+        firstIndex[l] = index;
+        code = (code + counts[l]) << 1;
+        index += counts[l];
+    }
+
+    uint32_t byte = 0;
+    int bitCount = 0;
+    auto bit = [&]() -> int {
+        if (bitCount == 0)
+        {
+            byte = pos < size ? p[pos++] : 0;
+            if (byte == 0xFF)
+                ++pos; // stuffed zero
+            bitCount = 8;
+        }
+        return static_cast<int>(byte >> --bitCount) & 1;
+    };
+
+    std::vector<uint16_t> pixels(static_cast<size_t>(width) * height);
+    for (int y = 0; y < height; ++y)
+    {
+        uint16_t* row = pixels.data() + static_cast<size_t>(y) * width;
+        int predictor = y == 0 ? 1 << (precision - 1) : row[-width];
+        for (int x = 0; x < width; ++x)
+        {
+            int code = 0;
+            int s = -1;
+            for (int l = 1; l <= 16 && s < 0; ++l)
+            {
+                code = code << 1 | bit();
+                if (code >= firstCode[l] && code - firstCode[l] < counts[l])
+                    s = values[static_cast<size_t>(firstIndex[l] + code - firstCode[l])];
+            }
+            if (s < 0)
+                return {};
+
+            int diff = s == 16 ? 32768 : 0;
+            if (s > 0 && s < 16)
+            {
+                for (int i = 0; i < s; ++i)
+                    diff = diff << 1 | bit();
+                if (diff < 1 << (s - 1))
+                    diff -= (1 << s) - 1;
+            }
+            row[x] = static_cast<uint16_t>(predictor + diff);
+            predictor = row[x];
+        }
+    }
+    return pixels;
+}
+
+/**
+ * @brief Pixel data of a DICONDE file written by DicomWriter; empty on a format error.
+ */
+std::vector<uint16_t> readDicomPixels(const QByteArray& file, int width, int height, bool jpeg)
+{
+    // (7FE0,0010) is the last element of the data set.
+    const qsizetype at = file.indexOf(QByteArray("\xE0\x7F\x10\x00", 4));
+    if (at < 0)
+        return {};
+    const qsizetype data = at + 12;
+    const size_t count = static_cast<size_t>(width) * height;
+
+    if (!jpeg)
+    {
+        if (file.size() - data != static_cast<qsizetype>(count * UINT16_SIZE))
+            return {};
+        std::vector<uint16_t> pixels(count);
+        qFromLittleEndian<quint16>(file.constData() + data, static_cast<qsizetype>(count), pixels.data());
+        return pixels;
+    }
+
+    // Join the fragments behind the basic offset table.
+    QByteArray stream;
+    bool offsetTable = true;
+    for (qsizetype pos = data; pos + 8 <= file.size();)
+    {
+        const quint16 group = qFromLittleEndian<quint16>(file.constData() + pos);
+        const quint16 element = qFromLittleEndian<quint16>(file.constData() + pos + 2);
+        const quint32 length = qFromLittleEndian<quint32>(file.constData() + pos + 4);
+        pos += 8;
+        if (group != 0xFFFE || element != 0xE000 || static_cast<quint64>(pos) + length > static_cast<quint64>(file.size()))
+            break;
+        if (!offsetTable)
+            stream.append(file.constData() + pos, length);
+        offsetTable = false;
+        pos += length;
+    }
+    return decodeLosslessJpeg(stream, width, height);
+}
+
+} // namespace
+
+
+ImageFramePtr Benchmark::syntheticFrame(int width, int height)
+{
+    QSharedPointer<ImageFrame> frame(new ImageFrame);
+    frame->width = width;
+    frame->height = height;
+    frame->bitsStored = 12;
+    uint16_t* pixels = frame->allocatePixels();
+
+    // Smooth background, a few sharp-edged "weld" bands and LCG noise, roughly like a radiograph.
+    quint32 seed = 12345;
+    for (int y = 0; y < height; ++y)
+    {
+        for (int x = 0; x < width; ++x)
+        {
+            seed = seed * 1664525u + 1013904223u;
+            int value = 1200 + (x * 1500) / std::max(width, 1) + (y * 600) / std::max(height, 1);
+            if ((x / 256) % 4 == 1)
+                value += 900;
+            value += static_cast<int>(seed >> 28) - 8;
+            pixels[static_cast<size_t>(y) * width + x] = static_cast<uint16_t>(std::clamp(value, 0, 4095));
+        }
+    }
+    return frame;
+}
+
+QStringList Benchmark::png(const ImageFrame& frame, int compressionLevel)
+{
+    QStringList report;
+    const qint64 pixels = static_cast<qint64>(frame.width) * frame.height;
+    const QString path = QDir::tempPath() + "/CR35_benchmark.png";
+    QElapsedTimer timer;
+
+    timer.start();
+    const bool saved = saveWithQImage(frame, path);
+    const qint64 qimageMs = timer.elapsed();
+    report << (saved ? reportLine("QImage::save (former path)", qimageMs, pixels, QFile(path).size()) : QString("QImage::save failed"));
+
+    const int ideal = std::max(QThread::idealThreadCount(), 1);
+    QList<int> threadCounts = { 1 };
+    if (ideal >= 4)
+        threadCounts << ideal / 2;
+    if (ideal > 1)
+        threadCounts << ideal;
+
+    for (int threads : threadCounts)
+    {
+        QFile file(path);
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        {
+            report << "Cannot write " + path;
+            break;
+        }
+
+        PngWriter writer(compressionLevel, threads);
+        timer.start();
+        const bool ok = writer.write(frame, file);
+        const qint64 elapsedMs = timer.elapsed();
+        file.close();
+
+        const QString name = "PngWriter level " + QString::number(compressionLevel) + ", " + QString::number(threads) + " thr";
+        report << (ok ? reportLine(name, elapsedMs, pixels, QFile(path).size()) : name + " failed: " + writer.errorString());
+    }
+
+    QFile::remove(path);
+    return report;
+}
+
+QStringList Benchmark::codec(const ImageFrame& frame)
+{
+    QStringList report;
+    const qint64 pixels = static_cast<qint64>(frame.width) * frame.height;
+
+    PackedFrame packed;
+    const qint64 packNs = fastestRun([&] { packed = PackedFrame(frame); });
+    report << codecLine("PackedFrame pack", packNs, pixels, static_cast<double>(pixels) * 2 / std::max<size_t>(packed.byteSize(), 1));
+    const qint64 unpackNs = fastestRun([&] { packed.unpack(); });
+    report << codecLine("PackedFrame unpack", unpackNs, pixels, static_cast<double>(pixels) * 2 / std::max<size_t>(packed.byteSize(), 1));
+
+    const int ideal = std::max(QThread::idealThreadCount(), 1);
+    QList<int> threadCounts = { 1 };
+    if (ideal > 1)
+        threadCounts << ideal;
+
+    for (int threads : threadCounts)
+    {
+        CompressedFrame compressed;
+        const qint64 compressNs = fastestRun([&] { compressed = CompressedFrame(frame, threads); });
+        const qint64 decompressNs = fastestRun([&] { compressed.decompress(threads); });
+
+        const ImageFramePtr restored = compressed.decompress(threads);
+        bool identical = restored && restored->width == frame.width && restored->height == frame.height;
+        for (int y = 0; identical && y < frame.height; ++y)
+            identical = memcmp(restored->row(y), frame.row(y), static_cast<size_t>(frame.width) * sizeof(uint16_t)) == 0;
+        if (!identical)
+        {
+            report << "CompressedFrame round trip mismatch, " + QString::number(threads) + " thr";
+            continue;
+        }
+
+        const QString suffix = ", " + QString::number(threads) + " thr";
+        report << codecLine("CompressedFrame compress" + suffix, compressNs, pixels, compressed.ratio());
+        report << codecLine("CompressedFrame decompress" + suffix, decompressNs, pixels, compressed.ratio());
+    }
+    return report;
+}
+
+QStringList Benchmark::dicom(const ImageFrame& frame)
+{
+    QStringList report;
+    const qint64 pixels = static_cast<qint64>(frame.width) * frame.height;
+
+    // Unscanned areas as the decoder leaves them: a white margin left of the plate and white rows below it.
+    QSharedPointer<ImageFrame> gapped(new ImageFrame);
+    gapped->width = frame.width;
+    gapped->height = frame.height;
+    gapped->bitsStored = frame.bitsStored;
+    uint16_t* dst = gapped->allocatePixels();
+    const int margin = frame.width / 16;
+    const int plateEnd = frame.height - frame.height / 16;
+    for (int y = 0; y < frame.height; ++y)
+    {
+        uint16_t* row = dst + static_cast<size_t>(y) * frame.width;
+        memcpy(row, frame.row(y), static_cast<size_t>(frame.width) * sizeof(uint16_t));
+        std::fill(row, row + (y < plateEnd ? margin : frame.width), uint16_t(0xFFFF));
+    }
+
+    // The white fill is stored as the largest `BitsStored` value, everything else unchanged.
+    const uint16_t white = frame.bitsStored >= 2 && frame.bitsStored < 16 ? static_cast<uint16_t>((1 << frame.bitsStored) - 1) : 0xFFFF;
+    std::vector<uint16_t> expected(gapped->data(), gapped->data() + pixels);
+    for (uint16_t& v : expected)
+        v = std::min(v, white);
+
+    QElapsedTimer timer;
+    for (bool jpeg : { false, true })
+    {
+        QBuffer buffer;
+        buffer.open(QIODevice::WriteOnly);
+        DicomWriter writer(jpeg);
+        timer.start();
+        const bool ok = writer.writeFrame(*gapped, buffer);
+        const qint64 elapsedMs = timer.elapsed();
+
+        const QString name = jpeg ? "DicomWriter lossless JPEG" : "DicomWriter uncompressed";
+        if (!ok)
+            report << name + " failed: " + writer.errorString();
+        else if (readDicomPixels(buffer.data(), frame.width, frame.height, jpeg) != expected)
+            report << name + " round trip mismatch";
+        else
+            report << reportLine(name, elapsedMs, pixels, buffer.size());
+    }
+    return report;
+}
+
+int Benchmark::run(const QStringList& arguments, Logger& logger)
+{
+    const QString name = arguments.value(0);
+    const int width = arguments.size() > 2 ? arguments.value(1).toInt() : BENCHMARK_WIDTH;
+    const int height = arguments.size() > 2 ? arguments.value(2).toInt() : BENCHMARK_HEIGHT;
+    if (width <= 0 || height <= 0)
+    {
+        logger.error("Invalid plate size");
+        return 1;
+    }
+
+    QStringList report;
+    if (name == "png")
+    {
+        const ImageFramePtr frame = syntheticFrame(width, height);
+        report << "PNG export, " + QString::number(width) + "x" + QString::number(height) + " 12-bit plate";
+        report += png(*frame, PNG_COMPRESSION_LEVEL_DEFAULT);
+    }
+    else if (name == "codec")
+    {
+        const ImageFramePtr frame = syntheticFrame(width, height);
+        report << "In-memory codecs, " + QString::number(width) + "x" + QString::number(height) + " 12-bit plate";
+        report += codec(*frame);
+    }
+    else if (name == "dicom")
+    {
+        const ImageFramePtr frame = syntheticFrame(width, height);
+        report << "DICONDE export, " + QString::number(width) + "x" + QString::number(height) + " 12-bit plate with white fill";
+        report += dicom(*frame);
+    }
+    else
+    {
+        logger.error("Usage: --benchmark png|codec|dicom [width height]");
+        return 1;
+    }
+
+    for (const QString& line : report)
+        logger.message(line);
+    return 0;
+}
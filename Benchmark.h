@@ -0,0 +1,56 @@
+#pragma once
+
+#include <qstring.h>
+#include <qstringlist.h>
+
+#include "ImageFrame.h"
+#include "Logger.h"
+
+
+/**
+ * @brief Command line benchmarks of the export paths.
+ *
+ * Started with `CR35NDTPlus --benchmark <name> [width height]` instead of
+ * the GUI; the report goes to the benchmark log. Every benchmark runs on a synthetic plate so results are
+ * comparable between machines and builds.
+ */
+namespace Benchmark {
+
+/**
+ * @brief Create a deterministic 12-bit test plate (gradient, structure and noise).
+ * @param width Width in pixels.
+ * @param height Height in pixels.
+ */
+ImageFramePtr syntheticFrame(int width, int height);
+
+/**
+ * @brief Compare the former QImage::save PNG path with PngWriter at several thread counts.
+ * @param frame Frame to encode.
+ * @param compressionLevel Deflate level passed to PngWriter.
+ * @return One report line per variant (time, throughput, file size).
+ */
+QStringList png(const ImageFrame& frame, int compressionLevel);
+
+/**
+ * @brief Time CompressedFrame compression and decompression, against PackedFrame, at several thread counts.
+ * @param frame Frame to compress.
+ * @return One report line per variant (best time of a few runs, throughput, ratio).
+ */
+QStringList codec(const ImageFrame& frame);
+
+/**
+ * @brief Time DICONDE export, uncompressed and lossless JPEG, of a frame with white fill, and check the round trip.
+ * @param frame Frame to export; a white margin and white bottom rows are added like unscanned areas.
+ * @return One report line per encoding, or a mismatch line when the file does not decode to the frame.
+ */
+QStringList dicom(const ImageFrame& frame);
+
+/**
+ * @brief Run the benchmark named on the command line and log the report.
+ * @param arguments Arguments following `--benchmark`.
+ * @param logger Logger receiving the report lines.
+ * @return Process exit code.
+ */
+int run(const QStringList& arguments, Logger& logger);
+
+} // namespace Benchmark
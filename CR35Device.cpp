@@ -2,16 +2,12 @@
 
 #include <qrandom.h>
 #include <qeventloop.h>
-#include <qjsondocument.h>
-#include <qjsonobject.h>
 
 #include <algorithm>
-#include <limits>
-#include <vector>
 
 
 CR35Device::CR35Device(Logger &logger, QObject* parent) : QObject(parent), 
-    m_logger(logger)
+    m_decoder(logger), m_streamer(logger), m_preview([this](const LineBlockPtr& block) { emit linesDecoded(block); }), m_logger(logger)
 {
 	connect(&m_socket, &QTcpSocket::connected, this, &CR35Device::init);
 	connect(&m_socket, &QTcpSocket::connected, this, &CR35Device::connected);
@@ -115,30 +111,42 @@ void CR35Device::readData()
         if (!getReadDataPayload(m_buffer, header, payload))
 			return; // wait for more data
         
-        if (header.token == getTokenId("ModeList"))
+        if (header.token == getTokenId("Version"))
         {
-            m_modeList = parseModeList(payload);
-			m_logger.message("Received ModeList with " + QString::number(m_modeList.size()) + " modes");
-            m_logger.message("ModeList modes: " + m_modeList.join(", "));
+            const qsizetype nulPos = payload.indexOf('\0');
+            m_firmwareVersion = QString::fromLatin1(nulPos >= 0 ? payload.left(nulPos) : payload).trimmed();
+            m_logger.message("Firmware version: " + m_firmwareVersion);
+
+            // The mode catalogue only changes with the firmware; skip the transfer when it is cached.
+            ModeCatalog cached;
+            if (cached.loadCache(m_firmwareVersion))
+            {
+                m_logger.message("ModeList loaded from cache " + ModeCatalog::cachePath(m_firmwareVersion));
+                setModeCatalog(std::move(cached));
+            }
+            else
+                enqueueCommand(Command("ModeList"));
+        }
+        else if (header.token == getTokenId("ModeList"))
+        {
+            ModeCatalog modes = ModeCatalog::parse(payload);
+            if (!modes.saveCache(m_firmwareVersion))
+                m_logger.message("ModeList not cached (firmware version unknown or cache not writable)");
+            setModeCatalog(std::move(modes));
         }
         else if (header.token == getTokenId("ImageData"))
         {
 			m_logger.message("Received ImageData of size: " + QString::number(payload.size()));
 			m_imageData.append(payload);
+			if (m_previewFeeding)
+				m_preview.append(payload);
 			if (payload.size() > 32) // only for large packets
 			    emit newDataReceived();
 
-			if (m_state == STATE_WAITING && m_wasScanning && m_imageData.size() >= sizeof(uint16_t))
-			{
-				const uint16_t lastWord = qFromLittleEndian<uint16_t>(m_imageData.constData() + m_imageData.size() - sizeof(uint16_t));
-				if (lastWord == DATA_MARKER_IMAGE_END)
-				{
-					processImageData();
-					m_wasScanning = false;
-					m_imageData.clear();
-				}
-			}
-			
+			// Completion is driven by the stream: finalize as soon as the end marker is decoded.
+			if (decodeImageData())
+				m_logger.message("Image completed on end marker (state=" + QString::number(m_state) + ")");
+
 			if (m_started) m_dataTimer.start(); // enqueue next packet
 		}
         else if (header.token == getTokenId("SystemState"))
@@ -151,11 +159,18 @@ void CR35Device::readData()
                 {
                     m_wasScanning = true;
                 }
-                else if (m_state == STATE_STOPPING && m_wasScanning)
+                else if (m_state == STATE_STOPPING && m_wasScanning && !m_decoder.isEmpty())
                 {
+                    // Consistency check only: the stream should already have delivered the end marker.
+                    m_logger.warning("Device stopping without image end marker, finalizing partial image");
+                    m_decoder.finish();
                     processImageData();
                     m_wasScanning = false;
                     m_imageData.clear();
+                    m_decoder.reset();
+                    m_streamer.reset();
+                    m_preview.reset();
+                    m_previewFeeding = m_livePreview;
                 }
             }
 		}
@@ -208,114 +223,6 @@ ServerHeader CR35Device::parseHeader(const QByteArray& data)
     return header;
 }
 
-QStringList CR35Device::parseModeList(const QByteArray& data)
-{
-    // ModeList is INI-like text with sections [Mode-{...}] and key/value pairs.
-    // We extract the preferred display name per section (ModeName_en, then ModeName, then ModeName_de)
-    // and prefix it with the mode id from the section header.
-
-    QString text = QString::fromLatin1(data);
-
-    // Trim at first NUL (device may append binary / padding after textual config)
-    const int nulPos = text.indexOf(QChar(u'\0'));
-    if (nulPos >= 0)
-        text.truncate(nulPos);
-
-    // Normalize newlines
-    text.replace("\r\n", "\n");
-    text.replace('\r', '\n');
-
-    QStringList result;
-
-    QString currentSectionId;
-    QString currentEn;
-    QString current;
-    bool inModeSection = false;
-
-    auto flushSection = [&]() {
-        if (!inModeSection)
-            return;
-
-        QString name = currentEn;
-        if (name.isEmpty())
-            name = current;
-
-        name = name.trimmed();
-        if (!name.isEmpty())
-        {
-            const QString id = currentSectionId.isEmpty() ? QString() : (currentSectionId + " - ");
-            result.push_back(id + name);
-        }
-
-        currentSectionId.clear();
-        currentEn.clear();
-        current.clear();
-    };
-
-    const QStringList lines = text.split('\n');
-    for (QString line : lines)
-    {
-        line = line.trimmed();
-        if (line.isEmpty())
-            continue;
-
-        // INI comment lines
-        if (line.startsWith(';'))
-            continue;
-
-        // If XML-ish payload appears, stop parsing (example shows "<!--<paramDescription")
-        if (line.startsWith("<!--"))
-            break;
-
-        if (line.startsWith('[') && line.endsWith(']'))
-        {
-            flushSection();
-
-            inModeSection = line.startsWith("[Mode-");
-            if (inModeSection)
-            {
-                // Example: [Mode-{00000001}]
-                const int l = line.indexOf("{");
-                const int r = line.indexOf("}");
-                if (l >= 0 && r > l)
-                    currentSectionId = line.sliced(l + 1, r - l - 1).trimmed();
-            }
-            continue;
-        }
-
-        if (!inModeSection)
-            continue;
-
-        const int eq = line.indexOf('=');
-        if (eq <= 0)
-            continue;
-
-        const QString key = line.left(eq).trimmed();
-        const QString value = line.sliced(eq + 1).trimmed();
-
-        if (key.compare("ModeName_en", Qt::CaseInsensitive) == 0)
-            currentEn = value;
-        else if (key.compare("ModeName", Qt::CaseInsensitive) == 0)
-            current = value;
-    }
-
-    flushSection();
-
-    // De-dup while preserving order
-    QStringList unique;
-    QSet<QString> seen;
-    for (const auto& n : result)
-    {
-        const QString k = n.trimmed();
-        if (k.isEmpty() || seen.contains(k))
-            continue;
-        seen.insert(k);
-        unique.push_back(k);
-    }
-
-    return unique;
-}
-
 bool CR35Device::getReadDataPayload(const QByteArray& data, const ServerHeader& header, QByteArray& payload) const
 {
     if (data.size() < HEADER_SIZE + header.size)
@@ -493,7 +400,11 @@ void CR35Device::sendCommand()
 		if (m_lastCommandTime.toMSecsSinceEpoch() + TIMEOUT_MS > QDateTime::currentMSecsSinceEpoch())
             return; // wait for current command to complete
         else
+        {
 			m_logger.warning("Command timeout for: " + QString::fromUtf8(m_currentCommand.name));
+            if (m_currentCommand.name == "Version")
+                enqueueCommand(Command("ModeList")); // no cache key, fetch the list
+        }
     }
 
 	m_currentCommand = m_commands.takeFirst();
@@ -534,9 +445,8 @@ void CR35Device::init()
 	enqueueCommand(Command("UserId", TYPE_STRING, "user@BACKUP"));
 	QString system_date = QDateTime::currentDateTimeUtc().toString("ddd, dd MMM yyyy HH:mm:ss 'GMT'");
 	enqueueCommand(Command("SystemDate", TYPE_STRING, system_date));
-	enqueueCommand(Command("ModeList"));
+	enqueueCommand(Command("Version")); // ModeList follows unless cached for this firmware
     //enqueueCommand(Command("DeviceId"));
-    //enqueueCommand(Command("Version"));
     enqueueCommand(Command("SystemState"));
 
     m_commandQueueTimer.start();
@@ -548,12 +458,24 @@ void CR35Device::start(int mode)
 
 	m_logger.message("Start Acquisition with mode: " + QString::number(mode));
 
+    // Preconfigure the decoder with the mode geometry; the image JSON header still takes precedence.
+    const AcquisitionMode* info = m_modes.find(mode);
+    if (info)
+        m_logger.message("Mode '" + info->name() + "': pixLine=" + QString::number(info->pixLine) +
+            " slotCount=" + QString::number(info->slotCount) + " bitsStored=" + QString::number(info->bitsStored));
+    m_decoder.setModeDefaults(info ? info->defaults() : ImageMetadata());
+    m_preview.setModeDefaults(info ? info->defaults() : ImageMetadata());
+
     // start sequence
 	enqueueCommand(Command("Mode", TYPE_U32, mode));
     enqueueCommand(Command("PollingOnly", TYPE_U32, 1));
     enqueueCommand(Command("Start", TYPE_U16, 1));
 
     m_imageData.clear();
+    m_decoder.reset();
+    m_streamer.reset();
+    m_preview.reset();
+    m_previewFeeding = m_livePreview;
 }
 
 void CR35Device::stop()
@@ -586,214 +508,139 @@ void CR35Device::enqueueCommand(const Command& command)
 	m_commands.push_back(command);
 }
 
-void CR35Device::processImageData()
+void CR35Device::setModeCatalog(ModeCatalog modes)
 {
-    if (m_imageData.isEmpty())
-        return;
-
-    m_logger.message("Processing received image data of size: " + QString::number(m_imageData.size()));
+    m_modes = std::move(modes);
+    m_modeList = m_modes.displayNames();
+	m_logger.message("ModeList with " + QString::number(m_modeList.size()) + " modes");
+    m_logger.message("ModeList modes: " + m_modeList.join(", "));
+    emit modeListReceived();
+}
 
-#ifdef _DEBUG
-    QFile debugFile("CR35_Image.bin");
-    if (debugFile.open(QIODevice::WriteOnly))
+bool CR35Device::decodeImageData()
+{
+    const bool complete = m_decoder.decode(m_imageData);
+    if (m_streamer.isEnabled())
     {
-        debugFile.write(m_imageData);
-        debugFile.close();
-	}
-#endif
+        m_streamer.update(m_decoder, m_imageData);
 
-    const uint8_t* ptr = reinterpret_cast<const uint8_t*>(m_imageData.constData());
-    const uint8_t* end = ptr + m_imageData.size();
-
-	LineAssembler assembler;
-	bool parsingPixels = false;
-	int pixLine = 0; // maximum width of image
+        // Queued lines are not needed again; only the lines still pending stay in memory.
+        m_decoder.release(m_imageData, m_streamer.nextLine(m_decoder));
+    }
 
-    while (ptr + UINT16_SIZE <= end)
+    // Slots that are fully scanned are emitted right away, before the rest of the image ends.
+    if (!complete)
     {
-        uint16_t word = qFromLittleEndian<uint16_t>(ptr);
-        ptr += UINT16_SIZE;
-
-        // Check if the word is a Control Marker
-        if (word >= 0xFFF9u) 
-        {
-            switch (word) 
-            {
-                case DATA_MARKER_START: 
-                {
-                    if (ptr + UINT16_SIZE > end) break;
-				    // New line begins. Flush any previously open line now.
-				    assembler.flushLine();
-				    parsingPixels = false;
-
-				    assembler.currentLine = {};
-				    assembler.currentSeg = {};
-				    assembler.inLine = true;
-				    assembler.x = qFromLittleEndian<uint16_t>(ptr);
-				    ptr += UINT16_SIZE;
-				    parsingPixels = true;
-                    break;
-                }
+        emitFinishedSlots();
+        return false;
+    }
 
-                case DATA_MARKER_GAP:
-                {
-                    if (ptr + UINT16_SIZE > end) break;
-				    const uint16_t gap = qFromLittleEndian<uint16_t>(ptr);
-				    ptr += UINT16_SIZE;
-
-				    if (assembler.inLine)
-				    {
-					    assembler.flushSegment();
-						assembler.x = static_cast<uint16_t>(assembler.x + gap);
-					    parsingPixels = true;
-				    }
-                    break;
-                }
+    // Bytes following the end marker belong to the next image; carry them over.
+    QByteArray carried;
+    const qint64 consumed = m_decoder.position();
+    if (consumed < m_imageData.size())
+    {
+        ImageStream::Reader reader(m_imageData, consumed);
+        carried = reader.readBytes(m_imageData.size() - consumed);
+    }
+    ImageStream next;
+    next.append(carried);
 
-                case DATA_MARKER_CONFIG: 
-                {
-                    if (ptr + UINT16_SIZE > end) break;
-                    uint16_t size = qFromLittleEndian<uint16_t>(ptr);
-                    ptr += UINT16_SIZE;
-
-                    if (ptr + size <= end)
-                    {
-                        QByteArray jsonData(reinterpret_cast<const char*>(ptr), size - 1);
-                        ptr += size; // Read JSON data
-                        m_logger.message("Parsing JSON config of size: " + QString::number(size));
-                        pixLine = parseJsonConfig(jsonData);
-                    }
-                    else
-                    {
-                        ptr = end; // Skip incomplete data
-                    }
-                    break;
-                }
+    // The plate's stream moves to its frames; a streamed image has already released its start.
+    if (m_keepRawStream && m_imageData.released() == 0)
+    {
+        m_imageData.truncate(consumed);
+        m_finishedStream.reset(new ImageStream(std::move(m_imageData)));
+    }
 
-                case DATA_MARKER_NOP:
-                    break;
-                case DATA_MARKER_IMAGE_END:
-					assembler.flushLine();
-					parsingPixels = false;
-                    break;
+    processImageData();
+    m_finishedStream.reset();
+    m_wasScanning = false;
+    m_imageData = std::move(next);
+    m_decoder.reset();
+    m_streamer.reset();
 
-                default:
-					m_logger.warning("Unknown data marker: " + QString::number(word, 16));
-                    break; // Ignore Heartbeats/Padding
-            }
-        }
-        // Process Pixel Data
-        else if (parsingPixels) 
-        {
-			if (!assembler.inLine)
-				continue;
-
-			if (!assembler.currentSeg.pixelDataPtr)
-			{
-				assembler.currentSeg.xStart = assembler.x;
-				assembler.currentSeg.pixelDataPtr = reinterpret_cast<const uint16_t*>(ptr - UINT16_SIZE);
-			}
-			assembler.currentSeg.pixelCount++;
-			assembler.x++;
-        }
+    // A preview switched on during the image starts with the next one, from the bytes carried over.
+    if (m_livePreview && !m_previewFeeding)
+    {
+        m_previewFeeding = true;
+        if (!carried.isEmpty())
+            m_preview.append(carried);
     }
 
-	// If stream ended without explicit IMAGE_END, still flush whatever we parsed.
-	assembler.flushLine();
-	std::vector<ScanLine>& image = assembler.image;
-
-	m_logger.message("Total lines received in image: " + QString::number(image.size()));
+    // The carried-over bytes may already hold a complete image.
+    if (!m_imageData.isEmpty())
+        decodeImageData();
+    return true;
+}
 
-    if (image.empty())
+void CR35Device::processImageData()
+{
+    const ImageStream& stream = imageStream();
+    if (stream.isEmpty())
         return;
 
-    int minLeft = std::numeric_limits<int>::max();
-    int maxRight = 0;
+    m_logger.message("Processing received image data of size: " + QString::number(stream.size()));
 
-    // Calculate bounding box (crop empty space)
-    for (const auto& line : image)
+#ifdef _DEBUG
+    QFile debugFile("CR35_Image.bin");
+    if (debugFile.open(QIODevice::WriteOnly))
     {
-		for (const auto& seg : line.segments)
-		{
-			if (seg.pixelCount <= 0)
-				continue;
-			minLeft = std::min(minLeft, seg.xStart);
-			maxRight = std::max(maxRight, seg.xStart + seg.pixelCount);
-		}
-    }
-
-    if (maxRight == 0) // No pixels found
-        return;
+        stream.writeTo(debugFile);
+        debugFile.close();
+	}
+#endif
 
-    const int width = maxRight - minLeft;
-    const int height = static_cast<int>(image.size());
+	m_decoder.logSummary();
 
-	uint16_t* img = new uint16_t[width * height];
-	memset(img, 0xFFFF, width * height * sizeof(uint16_t)); // initialize to white
+    emitFinishedSlots();
+}
 
-    for (int y = 0; y < height; ++y)
+void CR35Device::emitFinishedSlots()
+{
+    const ImageStream& stream = imageStream();
+    bool rawAttached = false;
+    for (const int slot : m_decoder.takeFinishedSlots())
     {
-        const auto& line = image[y];
-        uint16_t* dst = img + (y * width);
-
-		if (pixLine > 0)
-		{
-			if (line.endX != pixLine)
-			{
-				m_logger.warning("Scanline width mismatch: line=" + QString::number(y) +
-					" endX=" + QString::number(line.endX) +
-					" pixLine=" + QString::number(pixLine) +
-					" segments=" + QString::number(static_cast<int>(line.segments.size())));
-				#ifdef _DEBUG
-				assert(line.endX == pixLine);
-				#endif
-			}
-		}
+        if (m_streamer.isEnabled())
+        {
+            m_streamer.finishSlot(m_decoder, stream, slot);
+            continue;
+        }
+        // Streaming was switched off during the scan; its lines are gone.
+        if (m_decoder.releasedLines() > 0)
+        {
+            m_logger.warning("Slot " + QString::number(slot + 1) + " was partly streamed and is not emitted as a frame");
+            continue;
+        }
 
-		for (const auto& seg : line.segments)
-		{
-			if (!seg.pixelDataPtr || seg.pixelCount <= 0)
-				continue;
+        const ImageFramePtr frame = m_decoder.createFrame(stream, slot);
+        if (!frame)
+            continue;
 
-			const int offset = seg.xStart - minLeft;
-			if (offset < 0)
-				continue;
+        // One frame per plate carries the stream, so it is archived once; the frame is not shared yet.
+        if (m_finishedStream && !rawAttached)
+        {
+            frame.constCast<ImageFrame>()->rawStream = m_finishedStream;
+            rawAttached = true;
+        }
 
-			const int copyCount = std::min(seg.pixelCount, width - offset);
-			if (copyCount > 0)
-				memcpy(dst + offset, seg.pixelDataPtr, copyCount * sizeof(uint16_t));
-		}
+        if (frame->slotCount > 1)
+            m_logger.message("Slot " + QString::number(slot + 1) + "/" + QString::number(frame->slotCount) +
+                " complete: " + QString::number(frame->width) + "x" + QString::number(frame->height));
+        emit imageDataReceived(frame);
     }
-
-    emit imageDataReceived(img, width, height);
 }
 
-int CR35Device::parseJsonConfig(const QByteArray& jsonData) const
+void CR35Device::setLivePreview(bool enabled)
 {
-    // Device JSON strings may contain 8-bit characters
-    // which is invalid UTF-8 for QJsonDocument. Convert from Latin-1 to UTF-8.
-    const QString jsonText = QString::fromLatin1(jsonData);
-    const QByteArray jsonBytes = jsonText.toUtf8();
-    QJsonParseError jerr;
-    const QJsonDocument doc = QJsonDocument::fromJson(jsonBytes, &jerr);
-    if (jerr.error != QJsonParseError::NoError && doc.isNull())
-        m_logger.warning("JSON parse failed: " + jerr.errorString());
-        
-    m_logger.message("Image JSON: " + jsonText);
-    const QJsonObject root = doc.object();
-    // Try to read a few useful fields for logging.
-    const QString deviceModel = root.value("ManufacturerModelName").toString();
-    const int bitsStored = root.value("BitsStored").toInt();
-    int pixLine = -1;
-    int slotCount = -1;
-    if (root.contains("AdditionalScanInfo") && root.value("AdditionalScanInfo").isObject())
+    m_livePreview = enabled;
+    if (!enabled)
     {
-        const QJsonObject asi = root.value("AdditionalScanInfo").toObject();
-        pixLine = asi.value("PixLine").toInt(-1);
-        slotCount = asi.value("SlotCount").toInt(-1);
+        m_previewFeeding = false;
+        m_preview.reset();
     }
-    m_logger.message("Image header parsed: model='" + deviceModel + "' bitsStored=" + QString::number(bitsStored) +
-        " pixLine=" + QString::number(pixLine) + " slotCount=" + QString::number(slotCount));
-
-	return pixLine;
-}
\ No newline at end of file
+    // The preview decoder needs the stream from an image start; between images that is the next packet.
+    else if (!m_previewFeeding && m_imageData.isEmpty())
+        m_previewFeeding = true;
+}
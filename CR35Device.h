@@ -6,9 +6,15 @@
 #include <qdatetime.h>
 
 #include "CR35Utils.h"
+#include "ImageDecoder.h"
+#include "ImageStream.h"
 #include "Logger.h"
+#include "ModeCatalog.h"
+#include "PreviewDecoder.h"
+#include "StreamExporter.h"
 
 #include <cstdint>
+#include <vector>
 
 
 /**
@@ -62,6 +68,22 @@ public:
 	 */
 	const QStringList& getModeList() const { return m_modeList; }
 
+    /**
+     * @brief Get the structured acquisition mode catalogue.
+     *
+     * Filled from the `ModeList` reply, or from the cache entry of the
+     * device firmware version without transferring the list again.
+     *
+     * @return Mode catalogue; empty until modeListReceived() was emitted.
+     */
+    const ModeCatalog& getModeCatalog() const { return m_modes; }
+
+    /**
+     * @brief Get the firmware version reported by the device.
+     * @return Version string; empty until the `Version` reply arrived.
+     */
+    const QString& getFirmwareVersion() const { return m_firmwareVersion; }
+
     /**
      * @brief Initiate TCP connection to the device.
      *
@@ -74,14 +96,73 @@ public:
      */
     void connectToDevice(const QString &ipAddress, quint16 port);
 
+    /**
+     * @brief Set image decoding options used from the next acquisition on.
+     *
+     * The decoder selects its policy-specialized parse loop and frame
+     * assembly from these options once per acquisition.
+     *
+     * @param options Decoder options.
+     */
+    void setDecoderOptions(const DecoderOptions& options) { m_decoder.setOptions(options); m_preview.setOptions(options); }
+    const DecoderOptions& getDecoderOptions() const { return m_decoder.options(); } ///< Current image decoding options.
+
+    /**
+     * @brief Limit the RAM held by raw streams and decoded frames.
+     *
+     * Past the limit, stream chunks and new frames are moved to
+     * memory-mapped temporary files (see MemoryBudget).
+     *
+     * @param bytes Limit in bytes; 0 keeps everything in RAM.
+     */
+    void setMemoryBudget(qint64 bytes) { MemoryBudget::instance().setLimit(bytes); }
+
+    /**
+     * @brief Write images to files while they are decoded instead of emitting frames.
+     *
+     * With ExportOptions::streaming set and a streamable format, rows go
+     * from the decoder straight to one file per slot (see StreamExporter)
+     * and imageDataReceived() is not emitted. No frame buffer is allocated,
+     * and once rows are queued for the writer thread their scan lines and
+     * stream bytes are released, so memory does not depend on the plate
+     * size. Deflate and disk writes run on the writer thread.
+     *
+     * @param options Export format, directory and encoder settings.
+     */
+    void setStreamingExport(const ExportOptions& options) { m_streamer.setOptions(options); }
+
+    /**
+     * @brief Emit linesDecoded() after every decoded chunk, e.g. for a live preview.
+     *
+     * Off by default. The received packets are handed to a PreviewDecoder,
+     * which decodes, assembles and box-averages the lines into preview rows
+     * at most PREVIEW_MAX_WIDTH pixels wide on its own thread, so the
+     * thread the device lives on (the GUI thread in CR35NDTPlus) does no
+     * per-pixel work for the preview. linesDecoded() is emitted from that
+     * thread. Switched on during an image, the preview starts with the next
+     * one.
+     */
+    void setLivePreview(bool enabled);
+
+    /**
+     * @brief Hand the raw stream of every completed image to its first frame (ImageFrame::rawStream).
+     *
+     * The stream is moved, not copied, so that e.g. the scan archive can
+     * store it next to the frame. Images whose stream was released while
+     * streaming are not kept.
+     */
+    void setKeepRawStream(bool enabled) { m_keepRawStream = enabled; }
+
 signals:
     void connected(); ///< Emitted when the internal socket has connected and the device is ready.
 	void disconnected(); ///< Emitted when the internal socket has disconnected.
 	void error(const QString& errorString); ///< Emitted when a socket or protocol error occurs.
 	void started(); ///< Emitted when acquisition has started.
 	void stopped(); ///< Emitted when acquisition has stopped.
-	void imageDataReceived(uint16_t *data, int width, int height); ///< Emitted when a complete image has been received.
+	void imageDataReceived(const ImageFramePtr& frame); ///< Emitted for every completed image or slot frame.
+	void linesDecoded(const LineBlockPtr& block); ///< Emitted, from the preview thread, with the preview rows of every packet while live preview is on.
 	void newDataReceived(); ///< Emitted when new data packets have been received.
+	void modeListReceived(); ///< Emitted when the mode catalogue is available (received or loaded from cache).
 
 public slots:
 
@@ -95,6 +176,10 @@ public slots:
 
     /**
      * @brief Start acquisition using the given mode identifier.
+     *
+     * When the mode is in the catalogue, the decoder is preconfigured with
+     * its geometry before the first image data arrives.
+     *
      * @param mode Mode numeric identifier (device-specific).
      */
     void start(int mode);
@@ -176,13 +261,6 @@ private:
 	 */
 	static ServerHeader parseHeader(const QByteArray& data);
 
-	/**
-	 * @brief Parse a ModeList text payload returned by the device.
-	 * @param data Raw payload bytes (may contain trailing binary data).
-	 * @return Ordered list of human-readable mode names prefixed by their numeric id.
-	 */
-	static QStringList parseModeList(const QByteArray& data);
-
 	/**
 	 * @brief Extract read-data payload from a received buffer using the header.
 	 *
@@ -229,18 +307,31 @@ private:
 	void enqueueCommand(const Command& command); 
 
 	/**
-	 * @brief Parse JSON configuration data from the device.
-     * @param jsonData Raw JSON data received from the device.
-	 * @return number of pixels per line (extracted from JSON) or -1 on error.
+	 * @brief Feed newly appended stream data to the decoder and finalize on end marker.
+	 * @return true when an image was completed by this call.
+	 */
+	bool decodeImageData();
+
+	/**
+	 * @brief Take over a mode catalogue and publish it.
+	 * @param modes Catalogue received from the device or loaded from the cache.
 	 */
-	int parseJsonConfig(const QByteArray& jsonData) const;
+	void setModeCatalog(ModeCatalog modes);
 
 	void processImageData(); ///< Process assembled image data packet when complete.
+	void emitFinishedSlots(); ///< Build and emit frames for slots the decoder has finished.
+	const ImageStream& imageStream() const { return m_finishedStream ? *m_finishedStream : m_imageData; } ///< Stream the decoder has read.
 
 	QTcpSocket m_socket; ///< Internal TCP socket for device communication.
 	QByteArray m_buffer; ///< Buffer for incoming data assembly.
-	QByteArray m_imageData; ///< Buffer for assembling image data packets.
-	QStringList m_modeList; ///< List of available acquisition modes.
+	ImageStream m_imageData; ///< Chunked storage for the raw image data stream.
+	QSharedPointer<ImageStream> m_finishedStream; ///< Stream of the image being emitted, when it is kept for its frames.
+	ImageDecoder m_decoder; ///< Incremental decoder for m_imageData.
+	StreamExporter m_streamer; ///< Writes decoded rows to files when streaming export is on.
+	PreviewDecoder m_preview; ///< Decodes the preview rows on its own thread while live preview is on.
+	QStringList m_modeList; ///< Display names of the available acquisition modes.
+	ModeCatalog m_modes; ///< Structured acquisition mode catalogue.
+	QString m_firmwareVersion; ///< Firmware version reported by the device (cache key of m_modes).
 
 	QByteArray m_clientId; ///< Random client identifier.
 	QHash<QString, int> m_tokens; ///< Map of token names to numeric session IDs.
@@ -252,6 +343,9 @@ private:
 	uint32_t m_state = STATE_UNKNOWN; ///< Current device operational state.
 	bool m_started = false; ///< Whether acquisition has been started.
 	bool m_wasScanning = false; ///< Whether the device was previously in scanning state.
+	bool m_livePreview = false; ///< Whether linesDecoded() is emitted.
+	bool m_previewFeeding = false; ///< Whether received packets go to m_preview; set at an image start.
+	bool m_keepRawStream = false; ///< Whether completed streams are attached to their frames.
 
 	QTimer m_commandQueueTimer; ///< Timer to trigger sending queued commands.
 	QDateTime m_lastCommandTime; ///< Timestamp of the last sent command.
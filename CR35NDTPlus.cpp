@@ -1,7 +1,10 @@
 #include "CR35NDTPlus.h"
 
+#include <qdir.h>
+#include <qfiledialog.h>
+
 CR35NDTPlus::CR35NDTPlus(Logger& logger, QWidget* parent) : QMainWindow(parent),
-m_device(logger)
+m_device(logger), m_exportQueue(logger)
 {
 	ui.setupUi(this);
 
@@ -12,31 +15,127 @@ m_device(logger)
 	connect(ui.pushButtonDisconnect, &QPushButton::clicked, &m_device, &CR35Device::disconnectFromDevice);
 
 	connect(ui.pushButtonStart, &QPushButton::clicked, this, [this]() {
-		m_device.start(5); // hardcoded mode 5 for example
+		// Mode 5 stays the default until the device has announced its modes.
+		const QVariant mode = ui.comboBoxMode->currentData();
+		m_device.start(mode.isValid() ? mode.toInt() : 5);
 		});
 	connect(ui.pushButtonStop, &QPushButton::clicked, &m_device, &CR35Device::stop);
 	connect(&m_device, &CR35Device::imageDataReceived, this, &CR35NDTPlus::saveImage);
+	connect(&m_device, &CR35Device::modeListReceived, this, &CR35NDTPlus::updateModes);
+	connect(&m_device, &CR35Device::linesDecoded, ui.livePreview, &LivePreviewWidget::addLines);
+	// The preview costs one extra pass over every decoded line, so it is opt-in.
+	connect(ui.checkBoxLivePreview, &QCheckBox::toggled, this, [this](bool checked) {
+		m_device.setLivePreview(checked);
+		});
+	connect(ui.livePreview, &LivePreviewWidget::autoWindowReady, this, [&logger](int low, int high) {
+		logger.message(QString("Auto window %1..%2").arg(low).arg(high));
+		});
+	connect(&m_exportQueue, &ExportQueue::exportProgress, this, [this](quint64, int percent) {
+		statusBar()->showMessage(QString("Exporting... %1%").arg(percent));
+		});
+	connect(&m_exportQueue, &ExportQueue::idle, this, [this]() {
+		statusBar()->showMessage("Export finished", 3000);
+		});
+
+	const QString tiledTiff = "TIFF (tiled)";
+	const QString jpegDicom = "DICONDE (lossless JPEG)";
+	ui.comboBoxFormat->addItem("PNG", static_cast<int>(ExportFormat::Png));
+	ui.comboBoxFormat->addItem("TIFF", static_cast<int>(ExportFormat::Tiff));
+	ui.comboBoxFormat->addItem(tiledTiff, static_cast<int>(ExportFormat::Tiff));
+	ui.comboBoxFormat->addItem("PGM", static_cast<int>(ExportFormat::Pgm));
+	ui.comboBoxFormat->addItem("Raw + JSON", static_cast<int>(ExportFormat::Raw));
+	ui.comboBoxFormat->addItem("DICONDE", static_cast<int>(ExportFormat::Dicom));
+	ui.comboBoxFormat->addItem(jpegDicom, static_cast<int>(ExportFormat::Dicom));
+	const auto updateExportOptions = [this, tiledTiff, jpegDicom]() {
+		ExportOptions options = m_exportQueue.options();
+		options.format = static_cast<ExportFormat>(ui.comboBoxFormat->currentData().toInt());
+		options.tiffTiles = ui.comboBoxFormat->currentText() == tiledTiff;
+		options.dicomJpeg = ui.comboBoxFormat->currentText() == jpegDicom;
+		options.streaming = ui.checkBoxStream->isChecked();
+		m_exportQueue.setOptions(options);
+		m_device.setStreamingExport(options);
+		// DICONDE needs the height up front and is always exported from frames.
+		ui.checkBoxStream->setEnabled(ImageExporter::canStream(options.format));
+		};
+	connect(ui.comboBoxFormat, &QComboBox::currentIndexChanged, this, updateExportOptions);
+	connect(ui.checkBoxStream, &QCheckBox::toggled, this, updateExportOptions);
+
+	connect(ui.checkBoxArchive, &QCheckBox::toggled, this, [this](bool checked) {
+		// Archived plates carry their raw stream, so they can be decoded again.
+		m_device.setKeepRawStream(checked);
+		// Opening and closing run behind the queued plates on the archive thread.
+		if (!checked)
+		{
+			m_archiveOpenJob = 0;
+			m_exportQueue.closeArchive(m_archive);
+			return;
+		}
+		const QString directory = m_exportQueue.options().directory.isEmpty() ? QDir::currentPath() : m_exportQueue.options().directory;
+		m_archiveOpenJob = m_exportQueue.openArchive(m_archive, QDir(directory).filePath("CR35_Scans.cr35a"));
+		});
+	connect(&m_exportQueue, &ExportQueue::exportFinished, this, [this](quint64 id, const QString&, bool ok, const QString&) {
+		if (id == m_archiveOpenJob && !ok)
+			ui.checkBoxArchive->setChecked(false);
+		});
+	connect(ui.checkBoxArchiveCompress, &QCheckBox::toggled, this, [this](bool checked) {
+		m_archive.setCompression(checked);
+		});
+	m_archive.setCompression(ui.checkBoxArchiveCompress->isChecked());
+
+	connect(ui.checkBoxCorrection, &QCheckBox::toggled, this, [this, &logger](bool checked) {
+		// The calibration is mapped once and shared by every decoded row until it is switched off.
+		// The decoder applies the change from the next plate on, never in the middle of one.
+		DecoderOptions decoderOptions = m_device.getDecoderOptions();
+		decoderOptions.correction.reset();
+		if (checked)
+		{
+			const QString directory = m_exportQueue.options().directory.isEmpty() ? QDir::currentPath() : m_exportQueue.options().directory;
+			const QString path = QFileDialog::getOpenFileName(this, "Flat-field calibration", directory, "Flat-field calibrations (*.cr35cal);;All files (*)");
+			if (path.isEmpty())
+			{
+				ui.checkBoxCorrection->setChecked(false);
+				return;
+			}
+			QSharedPointer<FlatFieldCorrection> correction(new FlatFieldCorrection);
+			if (!correction->load(path))
+			{
+				logger.error("Cannot load the flat-field calibration: " + correction->errorString());
+				ui.checkBoxCorrection->setChecked(false);
+				return;
+			}
+			logger.message("Correcting with " + correction->path() + " (" + QString::number(correction->width()) + " columns) from the next plate on");
+			decoderOptions.correction = correction;
+		}
+		m_device.setDecoderOptions(decoderOptions);
+		});
 
 }
 
-void CR35NDTPlus::saveImage(const uint16_t* data, int width, int height)
+void CR35NDTPlus::updateModes()
 {
-	if (!data || width <= 0 || height <= 0)
-		return;
-
-	// QImage expects scanlines to be 32-bit aligned for many formats.
-	// The incoming buffer is tightly packed (width * 2 bytes) and may not satisfy that.
-	QImage img(width, height, QImage::Format_Grayscale16);
-	if (img.isNull())
-		return;
+	const int previous = ui.comboBoxMode->currentData().isValid() ? ui.comboBoxMode->currentData().toInt() : 5;
 
-	const int srcBytesPerLine = width * static_cast<int>(sizeof(uint16_t));
-	for (int y = 0; y < height; ++y)
+	ui.comboBoxMode->clear();
+	for (const AcquisitionMode& mode : m_device.getModeCatalog().modes())
 	{
-		const uchar* src = reinterpret_cast<const uchar*>(data) + y * srcBytesPerLine;
-		uchar* dst = img.scanLine(y);
-		memcpy(dst, src, srcBytesPerLine);
+		if (mode.id < 0)
+			continue;
+		ui.comboBoxMode->addItem(mode.displayName(), mode.id);
+		if (mode.id == previous)
+			ui.comboBoxMode->setCurrentIndex(ui.comboBoxMode->count() - 1);
 	}
+}
 
-	img.save("CR35_Image.png");
-}
\ No newline at end of file
+void CR35NDTPlus::saveImage(const ImageFramePtr& frame)
+{
+	// Encoding runs on the export pool; the GUI thread only queues the shared frame.
+	// Multi-slot scans produce one file per slot.
+	if (!frame)
+		return;
+	const QString baseName = ImageExporter::baseName(frame->metadata, frame->slot, frame->slotCount);
+	m_exportQueue.enqueue(frame, baseName);
+	if (ui.checkBoxArchive->isChecked())
+		m_exportQueue.enqueueArchive(frame, m_archive);
+	if (ui.checkBoxPreview->isChecked())
+		m_exportQueue.enqueuePreview(frame, baseName);
+}
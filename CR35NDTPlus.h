@@ -4,6 +4,8 @@
 #include "ui_CR35NDTPlus.h"
 
 #include "CR35Device.h" 
+#include "ExportQueue.h"
+#include "ScanArchive.h"
 
 class CR35NDTPlus : public QMainWindow {
     Q_OBJECT
@@ -13,11 +15,15 @@ public:
 
 private slots:
 
-    void saveImage(const uint16_t* data, int width, int height);
+    void saveImage(const ImageFramePtr& frame);
+    void updateModes(); ///< Fill the mode selector from the device mode catalogue.
 
 private:
     Ui::CR35NDTPlusClass ui;
 
     CR35Device m_device;
+    ScanArchive m_archive; ///< Catalogue of all plates, appended to when enabled (outlives the queue's jobs).
+    ExportQueue m_exportQueue; ///< Writes received frames off the GUI thread.
+    quint64 m_archiveOpenJob = 0; ///< Job opening the scan archive; the checkbox is cleared when it fails.
 };
 
@@ -1,14 +1,42 @@
 #pragma once
 
 #include <vector>
+#include <algorithm>
 #include <cstdint>
+#include <memory_resource>
 
 #include <qbytearray.h>
 #include <qendian.h>
+#include <qstring.h>
+#include <qthread.h>
+#include <qthreadpool.h>
 
 constexpr int IMAGE_DATA_REQUEST_INTERVAL_MS = 300; ///< Interval between image data requests.
 constexpr int TIMEOUT_MS = 2000; ///< Command response timeout in milliseconds.
 constexpr int COMMAND_QUEUE_INTERVAL_MS = 10; ///< Interval between sending queued commands.
+constexpr int SLOT_END_EMPTY_LINES = 8; ///< Consecutive lines without pixels in a slot band that finish the slot.
+constexpr qint64 MEMORY_BUDGET_DEFAULT = 1024LL * 1024 * 1024; ///< Default MemoryBudget limit for raw streams and frames in bytes (0 = unlimited).
+constexpr size_t ACQUISITION_ARENA_BLOCK_SIZE = 1024 * 1024; ///< Initial block size of the per-acquisition AcquisitionArena in bytes.
+constexpr int DECODE_STATS_SAMPLE_LINES = 8; ///< Number of mismatching scan lines kept as a sample for the decode summary.
+constexpr int PNG_COMPRESSION_LEVEL_DEFAULT = 6; ///< Default deflate level of exported PNG files (0 = stored, 9 = smallest).
+constexpr qint64 PNG_BAND_BYTES = 256 * 1024; ///< Raw bytes per independently compressed PngWriter row band.
+constexpr qint64 EXPORT_WRITE_BLOCK_BYTES = 4 * 1024 * 1024; ///< Size of the blocks uncompressed exports are written in (a multiple of EXPORT_WRITE_ALIGNMENT).
+constexpr int STREAM_EXPORT_QUEUE_BLOCKS = 8; ///< Row blocks StreamExporter may queue for its writer thread; further lines wait in the decoder.
+constexpr size_t EXPORT_WRITE_ALIGNMENT = 4096; ///< Alignment of the RasterWriter block buffer in bytes.
+constexpr qint64 TIFF_STRIP_BYTES = 1024 * 1024; ///< Target size of one TIFF strip in bytes.
+constexpr int TIFF_TILE_SIZE = 256; ///< Edge length of TIFF tiles in pixels (a multiple of 16).
+constexpr int DICOM_JPEG_SAMPLE_ROW_STEP = 8; ///< Every n-th row feeds the lossless JPEG Huffman statistics.
+constexpr int COMPRESSED_FRAME_BAND_ROWS = 32; ///< Rows per independently coded CompressedFrame band.
+constexpr int PYRAMID_MIN_SIZE = 256; ///< ImagePyramid stops halving once both sides are at most this many pixels.
+constexpr int PYRAMID_BAND_ROWS = 64; ///< Output rows per ImagePyramid work item.
+constexpr int PREVIEW_MAX_WIDTH = 1024; ///< PreviewDecoder averages live preview lines down to at most this many pixels.
+constexpr int PREVIEW_EXPORT_MAX_SIZE = 1024; ///< Default longest side of exported previews in pixels.
+constexpr int PREVIEW_EXPORT_QUALITY = 85; ///< Default encoder quality of exported previews (0..100).
+constexpr int PREVIEW_EXPORT_BAND_ROWS = 32; ///< Preview rows per PreviewExporter work item.
+constexpr int FLAT_FIELD_GAIN_SHIFT = 14; ///< Fractional bits of FlatFieldCorrection gains (1 << 14 = gain 1.0).
+constexpr int HISTOGRAM_LANES = 4; ///< Sub-histograms a Histogram spreads consecutive pixels over.
+constexpr double AUTO_WINDOW_LOW_PERCENT = 0.5; ///< Percentile shown black by an automatic window.
+constexpr double AUTO_WINDOW_HIGH_PERCENT = 99.5; ///< Percentile shown white by an automatic window.
 
 constexpr size_t UINT16_SIZE = sizeof(uint16_t);
 
@@ -62,33 +90,41 @@ static constexpr int HEADER_SIZE = sizeof(ServerHeader); ///< Size of the server
  */
 struct PixelSegment {
 	int xStart = 0; ///< Starting X coordinate of the segment
-	const uint16_t* pixelDataPtr = nullptr; ///< Pointer to the pixel data
+	qint64 offset = -1; ///< Byte offset of the first pixel in the image stream (-1 = none)
 	int pixelCount = 0; ///< Number of pixels in the segment
 };
 /**
  * @brief A single scan line composed of multiple pixel segments.
  */
 struct ScanLine {
-	std::vector<PixelSegment> segments; ///< List of pixel segments in the scan line
+	std::pmr::vector<PixelSegment> segments; ///< List of pixel segments in the scan line
 	int endX = 0; ///< Logical line end position (includes gaps), measured in pixels from x=0
+	int row = 0; ///< Absolute scan-line number, set by ImageDecoder (lines that carried pixels, counted from the image start)
 };
 
 /**
  * @brief Helper structure for assembling lines and segments from incoming data.
  */
 struct LineAssembler {
-	std::vector<ScanLine> image; ///< Assembled image composed of scan lines
+	/**
+	 * @brief Construct an assembler whose lines and segments allocate from @p resource.
+	 * @param resource Memory resource, typically an AcquisitionArena.
+	 */
+	explicit LineAssembler(std::pmr::memory_resource* resource = std::pmr::get_default_resource()) :
+		image(resource), currentLine{ std::pmr::vector<PixelSegment>(resource) } { }
+
+	std::pmr::vector<ScanLine> image; ///< Assembled image composed of scan lines
 	ScanLine currentLine; ///< Current scan line being assembled
 	PixelSegment currentSeg; ///< Current pixel segment being assembled
 	bool inLine = false; ///< Whether currently inside a scan line
-	uint16_t x = 0; ///< Current x position within the open scan line (includes gaps)
+	int x = 0; ///< Current x position within the open scan line (includes gaps)
 
 	/** 
 	 * @brief Flush the current pixel segment to the current line.
 	 */
 	void flushSegment()
 	{
-		if (currentSeg.pixelDataPtr && currentSeg.pixelCount > 0)
+		if (currentSeg.offset >= 0 && currentSeg.pixelCount > 0)
 			currentLine.segments.push_back(currentSeg);
 		currentSeg = {};
 	}
@@ -101,10 +137,11 @@ struct LineAssembler {
 		if (!inLine)
 			return;
 		flushSegment();
-		currentLine.endX = static_cast<int>(x);
+		currentLine.endX = x;
 		if (!currentLine.segments.empty())
-			image.push_back(currentLine);
-		currentLine = {};
+			image.push_back(std::move(currentLine)); // moving keeps the segments in the assembler's resource
+		currentLine.segments.clear();
+		currentLine.endX = 0;
 		inLine = false;
 		x = 0;
 	}
@@ -131,3 +168,41 @@ inline void appendBE32(QByteArray& out, quint32 v)
 	const quint32 be = qToBigEndian<quint32>(v);
 	out.append(reinterpret_cast<const char*>(&be), sizeof(be));
 }
+
+/**
+ * @brief Append an integer in little-endian byte order to a QByteArray (TIFF and DICOM headers).
+ * @param out QByteArray to append to.
+ * @param v Value to append; sizeof(T) bytes are written.
+ */
+template <typename T>
+inline void appendLE(QByteArray& out, T v)
+{
+	const T le = qToLittleEndian<T>(v);
+	out.append(reinterpret_cast<const char*>(&le), sizeof(le));
+}
+
+/**
+ * @brief Report a failure through an optional error string.
+ * @param error Receives @p text unless it is nullptr.
+ * @return false, so that callers can `return reportError(error, ...)`.
+ */
+inline bool reportError(QString* error, const QString& text)
+{
+	if (error)
+		*error = text;
+	return false;
+}
+
+/**
+ * @brief Size a local pool for data-parallel work on bands of a frame.
+ *
+ * The workers run at the priority of the calling thread, so bands split off
+ * a low-priority export job stay in the background.
+ * @param pool Pool to configure before starting work.
+ * @param threads Worker threads; 0 uses QThread::idealThreadCount().
+ */
+inline void setupBandPool(QThreadPool& pool, int threads)
+{
+	pool.setMaxThreadCount(threads > 0 ? threads : std::max(QThread::idealThreadCount(), 1));
+	pool.setThreadPriority(QThread::currentThread()->priority());
+}
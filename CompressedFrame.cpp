@@ -0,0 +1,501 @@
+#include "CompressedFrame.h"
+#include "CR35Utils.h"
+#include "Simd.h"
+
+#include <qendian.h>
+#include <qthreadpool.h>
+
+#include <algorithm>
+#include <cstring>
+
+
+namespace {
+
+constexpr int BLOCK = 32; ///< Residuals per bit-packed block.
+constexpr size_t BAND_PADDING = 8; ///< Zero bytes after every band, so block unpacking may load 64 bits anywhere.
+constexpr char SERIAL_MAGIC[4] = { 'C', 'R', 'C', 'F' };
+constexpr uint32_t SERIAL_VERSION = 1;
+
+/**
+ * @brief Header of a serialized frame, followed by bands + 1 offsets and the bands.
+ */
+#pragma pack(push, 1)
+struct SerialHeader {
+    char magic[4]; ///< "CRCF"
+    uint32_t version; ///< Format version (1).
+    int32_t width; ///< Width in pixels.
+    int32_t height; ///< Height in pixels.
+    int32_t slot; ///< Slot index.
+    int32_t slotCount; ///< Slot count.
+    int32_t bitsStored; ///< `BitsStored`.
+    uint32_t bands; ///< Number of bands.
+};
+#pragma pack(pop)
+
+inline uint16_t zigzag(int residual)
+{
+    const int16_t r = static_cast<int16_t>(residual);
+    return static_cast<uint16_t>((static_cast<uint16_t>(r) << 1) ^ static_cast<uint16_t>(r >> 15));
+}
+
+inline uint16_t unzigzag(uint16_t z)
+{
+    return static_cast<uint16_t>((z >> 1) ^ (0u - (z & 1u)));
+}
+
+/**
+ * @brief LOCO-I median edge detector.
+ */
+inline uint16_t medianPrediction(uint16_t a, uint16_t b, uint16_t c)
+{
+    const uint16_t lo = std::min(a, b);
+    const uint16_t hi = std::max(a, b);
+    if (c >= hi)
+        return lo;
+    if (c <= lo)
+        return hi;
+    return static_cast<uint16_t>(a + b - c);
+}
+
+/**
+ * @brief Residuals of the first row of a band, predicted from the left (0 for the first pixel).
+ */
+void residualsLeft(const uint16_t* row, uint16_t* dst, int width)
+{
+    dst[0] = zigzag(row[0]);
+    for (int x = 1; x < width; ++x)
+        dst[x] = zigzag(row[x] - row[x - 1]);
+}
+
+/**
+ * @brief Residuals of a row against the row above and against the median predictor.
+ */
+void residualsRow(const uint16_t* row, const uint16_t* above, uint16_t* up, uint16_t* median, int width)
+{
+    up[0] = median[0] = zigzag(row[0] - above[0]);
+    int x = 1;
+#ifdef CR35_SSE2
+    // Unsigned min/max and compares through signed ones on biased values.
+    const __m128i bias = _mm_set1_epi16(static_cast<short>(0x8000));
+    for (; x + 8 <= width; x += 8)
+    {
+        const __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x - 1));
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(above + x));
+        const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(above + x - 1));
+        const __m128i ab = _mm_xor_si128(a, bias);
+        const __m128i bb = _mm_xor_si128(b, bias);
+        const __m128i cb = _mm_xor_si128(c, bias);
+        const __m128i lo = _mm_min_epi16(ab, bb);
+        const __m128i hi = _mm_max_epi16(ab, bb);
+        const __m128i takeLo = _mm_andnot_si128(_mm_cmplt_epi16(cb, hi), _mm_set1_epi16(-1)); // c >= hi
+        const __m128i takeHi = _mm_andnot_si128(_mm_or_si128(takeLo, _mm_cmpgt_epi16(cb, lo)), _mm_set1_epi16(-1)); // c <= lo
+        const __m128i gradient = _mm_sub_epi16(_mm_add_epi16(a, b), c);
+        const __m128i biased = _mm_or_si128(_mm_or_si128(_mm_and_si128(takeLo, lo), _mm_and_si128(takeHi, hi)),
+            _mm_andnot_si128(_mm_or_si128(takeLo, takeHi), _mm_xor_si128(gradient, bias)));
+        const __m128i prediction = _mm_xor_si128(biased, bias);
+
+        const __m128i du = _mm_sub_epi16(p, b);
+        const __m128i dm = _mm_sub_epi16(p, prediction);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(up + x), _mm_xor_si128(_mm_slli_epi16(du, 1), _mm_srai_epi16(du, 15)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(median + x), _mm_xor_si128(_mm_slli_epi16(dm, 1), _mm_srai_epi16(dm, 15)));
+    }
+#endif
+    for (; x < width; ++x)
+    {
+        up[x] = zigzag(row[x] - above[x]);
+        median[x] = zigzag(row[x] - medianPrediction(row[x - 1], above[x], above[x - 1]));
+    }
+}
+
+/**
+ * @brief Bits needed for the largest of up to BLOCK residuals.
+ */
+inline int blockWidth(const uint16_t* values, int count)
+{
+    uint32_t any = 0;
+    for (int i = 0; i < count; ++i)
+        any |= values[i];
+    int bits = 0;
+    for (; any; any >>= 1)
+        ++bits;
+    return bits;
+}
+
+/**
+ * @brief Bit width of every block of residuals and their encoded size (a width byte and 4 bytes per bit).
+ */
+size_t blockWidths(const uint16_t* values, size_t count, std::vector<uint8_t>& widths)
+{
+    widths.clear();
+    size_t size = 0;
+    for (size_t i = 0; i < count; i += BLOCK)
+    {
+        const int bits = blockWidth(values + i, static_cast<int>(std::min<size_t>(BLOCK, count - i)));
+        widths.push_back(static_cast<uint8_t>(bits));
+        size += 1 + 4 * static_cast<size_t>(bits);
+    }
+    return size;
+}
+
+/**
+ * @brief Bit-pack BLOCK values of W bits, least significant first, into 4 * W bytes.
+ */
+template <int W>
+uint8_t* packBlock(const uint16_t* values, uint8_t* out)
+{
+    uint64_t acc = 0;
+    int pending = 0;
+    for (int i = 0; i < BLOCK; ++i)
+    {
+        acc |= static_cast<uint64_t>(values[i]) << pending;
+        pending += W;
+        if (pending >= 32)
+        {
+            qToLittleEndian<quint32>(static_cast<quint32>(acc), out);
+            out += 4;
+            acc >>= 32;
+            pending -= 32;
+        }
+    }
+    return out;
+}
+
+/**
+ * @brief Unpack BLOCK values of W bits; reads up to 8 bytes past the block.
+ */
+template <int W>
+const uint8_t* unpackBlock(const uint8_t* in, uint16_t* values)
+{
+    constexpr uint64_t mask = (uint64_t(1) << W) - 1;
+    for (int i = 0; i < BLOCK; ++i)
+    {
+        const int bit = i * W;
+        values[i] = static_cast<uint16_t>((qFromLittleEndian<quint64>(in + bit / 8) >> (bit % 8)) & mask);
+    }
+    return in + 4 * W;
+}
+
+template <>
+uint8_t* packBlock<0>(const uint16_t*, uint8_t* out)
+{
+    return out;
+}
+
+template <>
+const uint8_t* unpackBlock<0>(const uint8_t* in, uint16_t* values)
+{
+    std::fill(values, values + BLOCK, uint16_t(0));
+    return in;
+}
+
+/**
+ * @brief Block packers and unpackers indexed by bit width.
+ */
+template <int... W>
+struct BlockCodec {
+    using Pack = uint8_t* (*)(const uint16_t*, uint8_t*);
+    using Unpack = const uint8_t* (*)(const uint8_t*, uint16_t*);
+    static constexpr Pack pack[] = { packBlock<W>... };
+    static constexpr Unpack unpack[] = { unpackBlock<W>... };
+};
+
+using Codec = BlockCodec<0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16>;
+
+/**
+ * @brief Undo the vertical prediction of a row in place.
+ */
+void reconstructUp(uint16_t* row, const uint16_t* above, int width)
+{
+    int x = 0;
+#ifdef CR35_SSE2
+    const __m128i one = _mm_set1_epi16(1);
+    for (; x + 8 <= width; x += 8)
+    {
+        const __m128i z = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+        const __m128i residual = _mm_xor_si128(_mm_srli_epi16(z, 1), _mm_sub_epi16(_mm_setzero_si128(), _mm_and_si128(z, one)));
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(above + x));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(row + x), _mm_add_epi16(b, residual));
+    }
+#endif
+    for (; x < width; ++x)
+        row[x] = static_cast<uint16_t>(above[x] + unzigzag(row[x]));
+}
+
+} // namespace
+
+
+CompressedFrame::CompressedFrame(const ImageFrame& frame, int threads) :
+    m_width(frame.width), m_height(frame.height), m_slot(frame.slot), m_slotCount(frame.slotCount),
+    m_bitsStored(frame.bitsStored), m_stats(frame.stats), m_metadata(frame.metadata)
+{
+    if (isNull())
+        return;
+
+    const int bands = (m_height + COMPRESSED_FRAME_BAND_ROWS - 1) / COMPRESSED_FRAME_BAND_ROWS;
+    std::vector<std::vector<uint8_t>> encoded(bands);
+
+    QThreadPool pool;
+    setupBandPool(pool, threads);
+    if (pool.maxThreadCount() == 1 || bands == 1)
+    {
+        for (int band = 0; band < bands; ++band)
+            encoded[band] = encodeBand(frame, band * COMPRESSED_FRAME_BAND_ROWS, bandRows(band));
+    }
+    else
+    {
+        for (int band = 0; band < bands; ++band)
+        {
+            pool.start([this, &frame, &encoded, band] {
+                encoded[band] = encodeBand(frame, band * COMPRESSED_FRAME_BAND_ROWS, bandRows(band));
+            });
+        }
+        pool.waitForDone();
+    }
+
+    size_t total = 0;
+    for (const std::vector<uint8_t>& band : encoded)
+        total += band.size();
+    m_data.reserve(total);
+    m_bandOffsets.reserve(bands + 1);
+    for (std::vector<uint8_t>& band : encoded)
+    {
+        m_bandOffsets.push_back(m_data.size());
+        m_data.insert(m_data.end(), band.begin(), band.end());
+        std::vector<uint8_t>().swap(band);
+    }
+    m_bandOffsets.push_back(m_data.size());
+}
+
+double CompressedFrame::ratio() const
+{
+    if (isNull() || m_data.empty())
+        return 0.0;
+    return static_cast<double>(m_width) * m_height * UINT16_SIZE / static_cast<double>(m_data.size());
+}
+
+int CompressedFrame::bandRows(int band) const
+{
+    return std::min(COMPRESSED_FRAME_BAND_ROWS, m_height - band * COMPRESSED_FRAME_BAND_ROWS);
+}
+
+std::vector<uint8_t> CompressedFrame::encodeBand(const ImageFrame& frame, int firstRow, int rowCount)
+{
+    const int width = frame.width;
+    const size_t count = static_cast<size_t>(rowCount) * width;
+
+    // Both residual sets; the first row is the same in both.
+    std::vector<uint16_t> up(count + BLOCK, 0);
+    std::vector<uint16_t> median(count + BLOCK, 0);
+    residualsLeft(frame.row(firstRow), up.data(), width);
+    std::copy(up.begin(), up.begin() + width, median.begin());
+    for (int r = 1; r < rowCount; ++r)
+    {
+        const size_t offset = static_cast<size_t>(r) * width;
+        residualsRow(frame.row(firstRow + r), frame.row(firstRow + r - 1), up.data() + offset, median.data() + offset, width);
+    }
+
+    // The median predictor decodes serially, so it has to earn its keep.
+    std::vector<uint8_t> upWidths;
+    std::vector<uint8_t> medianWidths;
+    const size_t upSize = blockWidths(up.data(), count, upWidths);
+    const size_t medianSize = blockWidths(median.data(), count, medianWidths);
+    const bool useMedian = medianSize + medianSize / 32 < upSize;
+    const uint16_t* residuals = useMedian ? median.data() : up.data();
+    const std::vector<uint8_t>& widths = useMedian ? medianWidths : upWidths;
+
+    std::vector<uint8_t> out(1 + (useMedian ? medianSize : upSize) + BAND_PADDING, 0);
+    out[0] = useMedian ? PredictMedian : PredictUp;
+    uint8_t* dst = out.data() + 1;
+    // Residuals past the band are zero, so the last block is padded with zeros.
+    for (size_t block = 0; block < widths.size(); ++block)
+    {
+        *dst++ = widths[block];
+        dst = Codec::pack[widths[block]](residuals + block * BLOCK, dst);
+    }
+    return out;
+}
+
+void CompressedFrame::decodeBand(int band, uint16_t* dst) const
+{
+    const int rowCount = bandRows(band);
+    const size_t count = static_cast<size_t>(rowCount) * m_width;
+    const uint8_t* src = m_data.data() + m_bandOffsets[band];
+    const Predictor predictor = static_cast<Predictor>(*src++);
+
+    // Whole blocks straight into the destination, the partial last one through a scratch block.
+    size_t i = 0;
+    for (; i + BLOCK <= count; i += BLOCK)
+    {
+        const int bits = *src++;
+        src = Codec::unpack[bits](src, dst + i);
+    }
+    if (i < count)
+    {
+        uint16_t last[BLOCK];
+        const int bits = *src++;
+        Codec::unpack[bits](src, last);
+        std::copy(last, last + (count - i), dst + i);
+    }
+
+    dst[0] = unzigzag(dst[0]);
+    for (int x = 1; x < m_width; ++x)
+        dst[x] = static_cast<uint16_t>(dst[x - 1] + unzigzag(dst[x]));
+    for (int r = 1; r < rowCount; ++r)
+    {
+        uint16_t* row = dst + static_cast<size_t>(r) * m_width;
+        const uint16_t* above = row - m_width;
+        if (predictor == PredictUp)
+        {
+            reconstructUp(row, above, m_width);
+            continue;
+        }
+        row[0] = static_cast<uint16_t>(above[0] + unzigzag(row[0]));
+        for (int x = 1; x < m_width; ++x)
+            row[x] = static_cast<uint16_t>(medianPrediction(row[x - 1], above[x], above[x - 1]) + unzigzag(row[x]));
+    }
+}
+
+void CompressedFrame::rows(int first, int count, uint16_t* dst) const
+{
+    std::vector<uint16_t> scratch;
+    while (count > 0)
+    {
+        const int band = first / COMPRESSED_FRAME_BAND_ROWS;
+        const int bandFirst = band * COMPRESSED_FRAME_BAND_ROWS;
+        const int rowsInBand = bandRows(band);
+        const int take = std::min(count, bandFirst + rowsInBand - first);
+        if (first == bandFirst && take == rowsInBand)
+            decodeBand(band, dst);
+        else
+        {
+            scratch.resize(static_cast<size_t>(rowsInBand) * m_width);
+            decodeBand(band, scratch.data());
+            std::copy_n(scratch.data() + static_cast<size_t>(first - bandFirst) * m_width, static_cast<size_t>(take) * m_width, dst);
+        }
+        dst += static_cast<size_t>(take) * m_width;
+        first += take;
+        count -= take;
+    }
+}
+
+ImageFramePtr CompressedFrame::decompress(int threads) const
+{
+    if (isNull())
+        return {};
+
+    QSharedPointer<ImageFrame> frame(new ImageFrame);
+    frame->width = m_width;
+    frame->height = m_height;
+    frame->slot = m_slot;
+    frame->slotCount = m_slotCount;
+    frame->bitsStored = m_bitsStored;
+    frame->stats = m_stats;
+    frame->metadata = m_metadata;
+    uint16_t* pixels = frame->allocatePixels();
+
+    QThreadPool pool;
+    setupBandPool(pool, threads);
+    if (pool.maxThreadCount() == 1 || bandCount() == 1)
+    {
+        for (int band = 0; band < bandCount(); ++band)
+            decodeBand(band, pixels + static_cast<size_t>(band) * COMPRESSED_FRAME_BAND_ROWS * m_width);
+        return frame;
+    }
+
+    for (int band = 0; band < bandCount(); ++band)
+    {
+        pool.start([this, pixels, band] {
+            decodeBand(band, pixels + static_cast<size_t>(band) * COMPRESSED_FRAME_BAND_ROWS * m_width);
+        });
+    }
+    pool.waitForDone();
+    return frame;
+}
+
+QByteArray CompressedFrame::serialize() const
+{
+    if (isNull())
+        return {};
+
+    SerialHeader header = {};
+    memcpy(header.magic, SERIAL_MAGIC, sizeof(header.magic));
+    header.version = SERIAL_VERSION;
+    header.width = m_width;
+    header.height = m_height;
+    header.slot = m_slot;
+    header.slotCount = m_slotCount;
+    header.bitsStored = m_bitsStored;
+    header.bands = static_cast<uint32_t>(bandCount());
+
+    QByteArray out;
+    out.reserve(static_cast<qsizetype>(sizeof(header) + m_bandOffsets.size() * sizeof(uint64_t) + m_data.size()));
+    out.append(reinterpret_cast<const char*>(&header), sizeof(header));
+    for (const size_t offset : m_bandOffsets)
+    {
+        const uint64_t value = offset;
+        out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+    out.append(reinterpret_cast<const char*>(m_data.data()), static_cast<qsizetype>(m_data.size()));
+    return out;
+}
+
+CompressedFrame CompressedFrame::deserialize(const char* data, qint64 size, const ImageMetadata& metadata)
+{
+    SerialHeader header = {};
+    if (size < static_cast<qint64>(sizeof(header)))
+        return {};
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, SERIAL_MAGIC, sizeof(header.magic)) != 0 || header.version != SERIAL_VERSION ||
+        header.width <= 0 || header.height <= 0 ||
+        header.bands != static_cast<uint32_t>((header.height + COMPRESSED_FRAME_BAND_ROWS - 1) / COMPRESSED_FRAME_BAND_ROWS))
+        return {};
+
+    const qint64 offsetBytes = (static_cast<qint64>(header.bands) + 1) * static_cast<qint64>(sizeof(uint64_t));
+    if (size < static_cast<qint64>(sizeof(header)) + offsetBytes)
+        return {};
+
+    CompressedFrame frame;
+    const char* offsets = data + sizeof(header);
+    const qint64 dataBytes = size - static_cast<qint64>(sizeof(header)) - offsetBytes;
+    frame.m_bandOffsets.resize(header.bands + 1);
+    for (size_t i = 0; i < frame.m_bandOffsets.size(); ++i)
+    {
+        uint64_t value = 0;
+        memcpy(&value, offsets + i * sizeof(value), sizeof(value));
+        // Every band holds at least its predictor byte and the padding.
+        const uint64_t minimum = i == 0 ? 0 : frame.m_bandOffsets[i - 1] + 1 + BAND_PADDING;
+        if (value < minimum || value > static_cast<uint64_t>(dataBytes))
+            return {};
+        frame.m_bandOffsets[i] = static_cast<size_t>(value);
+    }
+    if (frame.m_bandOffsets.front() != 0 || frame.m_bandOffsets.back() != static_cast<size_t>(dataBytes))
+        return {};
+
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(offsets + offsetBytes);
+    frame.m_data.assign(bytes, bytes + dataBytes);
+    frame.m_width = header.width;
+    frame.m_height = header.height;
+    frame.m_slot = header.slot;
+    frame.m_slotCount = header.slotCount;
+    frame.m_bitsStored = header.bitsStored;
+    frame.m_metadata = metadata;
+
+    // Walk the block widths once, so decoding never indexes past Codec::unpack or the band.
+    for (uint32_t band = 0; band < header.bands; ++band)
+    {
+        const uint8_t* src = frame.m_data.data() + frame.m_bandOffsets[band];
+        const uint8_t* end = frame.m_data.data() + frame.m_bandOffsets[band + 1] - BAND_PADDING;
+        if (*src != PredictUp && *src != PredictMedian)
+            return {};
+        ++src;
+        const size_t count = static_cast<size_t>(frame.bandRows(static_cast<int>(band))) * frame.m_width;
+        for (size_t i = 0; i < count; i += BLOCK)
+        {
+            if (src >= end || *src > 16 || static_cast<size_t>(end - src) < 1 + 4 * static_cast<size_t>(*src))
+                return {};
+            src += 1 + 4 * static_cast<size_t>(*src);
+        }
+    }
+    return frame;
+}
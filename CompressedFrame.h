@@ -0,0 +1,121 @@
+#pragma once
+
+#include <qbytearray.h>
+
+#include "ImageFrame.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+/**
+ * @brief Losslessly compressed in-memory copy of an ImageFrame.
+ *
+ * Frames are split into bands of COMPRESSED_FRAME_BAND_ROWS rows that are
+ * compressed and decompressed independently, in parallel, and on demand:
+ * reading a few rows only decodes the bands that contain them.
+ *
+ * Each band predicts its first row from the left neighbour. The other rows
+ * are predicted either from the pixel above (vertical delta) or with the
+ * LOCO-I median edge detector (MED). The encoder chooses per band, and
+ * takes MED only when it saves more than 1/32 of the size, because the
+ * vertical delta decodes with SIMD while MED decodes pixel by pixel.
+ * Residuals are zigzag mapped and bit-packed in blocks of 32, at the bit
+ * width of the largest residual of the block (one width byte per block).
+ * Blocks of smooth 12-bit plate content typically need 3 to 6 bits per
+ * pixel.
+ *
+ * Residuals and predictions are computed with SSE2 where available and by
+ * portable scalar code otherwise. The format does not depend on the path taken.
+ */
+class CompressedFrame {
+public:
+    CompressedFrame() = default;
+
+    /**
+     * @brief Compress a decoded frame.
+     * @param frame Frame to compress.
+     * @param threads Worker threads; 0 uses QThread::idealThreadCount().
+     */
+    explicit CompressedFrame(const ImageFrame& frame, int threads = 0);
+
+    int width() const { return m_width; } ///< Width in pixels.
+    int height() const { return m_height; } ///< Height in pixels.
+    size_t byteSize() const { return m_data.size(); } ///< Compressed size in bytes.
+    bool isNull() const { return m_width <= 0 || m_height <= 0; } ///< Whether the frame is empty.
+    int bandCount() const { return static_cast<int>(m_bandOffsets.size()) - 1; } ///< Number of independently coded bands.
+
+    /**
+     * @brief Uncompressed size divided by the compressed size (0 for an empty frame).
+     */
+    double ratio() const;
+
+    /**
+     * @brief Decompress a range of rows.
+     * @param first First row.
+     * @param count Number of rows; first + count must not exceed height().
+     * @param dst Destination with room for count * width() pixels.
+     */
+    void rows(int first, int count, uint16_t* dst) const;
+
+    /**
+     * @brief Decompress the whole frame.
+     * @param threads Worker threads; 0 uses QThread::idealThreadCount().
+     * @return Frame with the original pixels, slot, statistics and metadata.
+     */
+    ImageFramePtr decompress(int threads = 0) const;
+
+    /**
+     * @brief Geometry, band offsets and bands as one byte block, e.g. for a ScanArchive record.
+     *
+     * Decode statistics and metadata are not included.
+     */
+    QByteArray serialize() const;
+
+    /**
+     * @brief Restore a frame written by serialize().
+     * @param data Serialized bytes.
+     * @param size Number of bytes.
+     * @param metadata JSON header to attach to decompressed frames.
+     * @return Null frame when the bytes are truncated or inconsistent, including unknown
+     *         predictors, block widths above 16 bits and blocks overrunning their band.
+     */
+    static CompressedFrame deserialize(const char* data, qint64 size, const ImageMetadata& metadata = {});
+
+private:
+    /**
+     * @brief Prediction used for the rows after the first one of a band.
+     */
+    enum Predictor : uint8_t {
+        PredictUp = 0, ///< Pixel above.
+        PredictMedian = 1, ///< LOCO-I median edge detector of left, above and upper-left.
+    };
+
+    /**
+     * @brief Compress one band into a self-contained byte stream.
+     */
+    static std::vector<uint8_t> encodeBand(const ImageFrame& frame, int firstRow, int rowCount);
+
+    /**
+     * @brief Decompress one band.
+     * @param band Index of the band.
+     * @param dst Destination for all rows of the band.
+     */
+    void decodeBand(int band, uint16_t* dst) const;
+
+    /**
+     * @brief Rows in a band (the last band may be shorter).
+     */
+    int bandRows(int band) const;
+
+    std::vector<uint8_t> m_data; ///< Bands, back to back.
+    std::vector<size_t> m_bandOffsets; ///< Start of each band in m_data, plus the end.
+    int m_width = 0; ///< Width in pixels.
+    int m_height = 0; ///< Height in pixels.
+    int m_slot = 0; ///< Slot index of the source frame.
+    int m_slotCount = 1; ///< Slot count of the source frame.
+    int m_bitsStored = 0; ///< `BitsStored` of the source frame.
+    DecodeStats m_stats; ///< Decode statistics of the source frame.
+    ImageMetadata m_metadata; ///< JSON header of the source frame.
+};
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+
+/**
+ * @brief Compile-time policies for ImageDecoder.
+ *
+ * ImageDecoder instantiates its parse loop and frame assembly once per
+ * policy combination and selects the instantiation when an acquisition
+ * starts and when the JSON header arrives. Policies are plain structs with
+ * static members, so every decision below is resolved with `if constexpr`
+ * and the selected loop contains no runtime configuration branches.
+ */
+namespace DecodePolicy {
+
+/**
+ * @brief Strict validation: pixels beyond `PixLine` (or the 16-bit
+ * coordinate range when `PixLine` is unknown) are dropped and counted.
+ */
+struct Strict {
+	static constexpr bool validate = true;
+};
+
+/**
+ * @brief Trusting fast path: line coordinates are taken from the stream as-is.
+ */
+struct Trusted {
+	static constexpr bool validate = false;
+};
+
+/**
+ * @brief Maintain DecodeStats counters while decoding.
+ */
+struct StatsOn {
+	static constexpr bool enabled = true;
+};
+
+/**
+ * @brief Skip all DecodeStats bookkeeping.
+ */
+struct StatsOff {
+	static constexpr bool enabled = false;
+};
+
+/**
+ * @brief Output pixels exactly as stored in the stream.
+ */
+struct RawPixels {
+	static void convert(uint16_t*, size_t, int) { }
+};
+
+/**
+ * @brief Scale `BitsStored`-bit values to the full 16-bit output range.
+ */
+struct ScaledPixels {
+	/**
+	 * @brief Shift pixels in place, saturating at 0xFFFF.
+	 * @param pixels Pixels to convert.
+	 * @param count Number of pixels.
+	 * @param shift Left shift (16 - BitsStored).
+	 */
+	static void convert(uint16_t* pixels, size_t count, int shift)
+	{
+		for (size_t i = 0; i < count; ++i)
+			pixels[i] = static_cast<uint16_t>(std::min<uint32_t>(static_cast<uint32_t>(pixels[i]) << shift, 0xFFFFu));
+	}
+};
+
+/**
+ * @brief Crop frames to the bounding box of decoded pixels.
+ */
+struct CropToContent {
+	static constexpr bool crop = true;
+};
+
+/**
+ * @brief Keep the full slot band (or `PixLine`) width so frame geometry is stable.
+ */
+struct FullLine {
+	static constexpr bool crop = false;
+};
+
+} // namespace DecodePolicy
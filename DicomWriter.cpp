@@ -0,0 +1,254 @@
+#include "DicomWriter.h"
+
+#include <qdatetime.h>
+#include <qendian.h>
+#include <quuid.h>
+
+#include <algorithm>
+#include <cstring>
+
+
+namespace {
+
+constexpr char CR_IMAGE_STORAGE[] = "1.2.840.10008.5.1.4.1.1.1"; ///< Computed Radiography Image Storage SOP class.
+constexpr char EXPLICIT_VR_LITTLE_ENDIAN[] = "1.2.840.10008.1.2.1";
+constexpr char JPEG_LOSSLESS_SV1[] = "1.2.840.10008.1.2.4.70"; ///< Lossless JPEG, process 14, selection value 1.
+constexpr char IMPLEMENTATION_CLASS_UID[] = "2.25.31553604819451755573130662436485359194";
+constexpr char IMPLEMENTATION_VERSION[] = "CR35NDTPLUS";
+constexpr quint32 UNDEFINED_LENGTH = 0xFFFFFFFFu;
+
+/**
+ * @brief Append an element header in explicit VR little endian.
+ */
+void appendHeader(QByteArray& out, quint16 group, quint16 element, const char* vr, quint32 length)
+{
+    appendLE<quint16>(out, group);
+    appendLE<quint16>(out, element);
+    out.append(vr, 2);
+    // VRs with a 32-bit length field (PS3.5 7.1.2).
+    if (!strcmp(vr, "OB") || !strcmp(vr, "OW") || !strcmp(vr, "SQ") || !strcmp(vr, "UN") || !strcmp(vr, "UT"))
+    {
+        appendLE<quint16>(out, 0);
+        appendLE<quint32>(out, length);
+    }
+    else
+        appendLE<quint16>(out, static_cast<quint16>(length));
+}
+
+/**
+ * @brief Append a text element, padded to even length (UIDs with NUL, all else with a space).
+ */
+void appendText(QByteArray& out, quint16 group, quint16 element, const char* vr, QByteArray value)
+{
+    if (value.size() % 2)
+        value.append(strcmp(vr, "UI") ? ' ' : '\0');
+    appendHeader(out, group, element, vr, static_cast<quint32>(value.size()));
+    out.append(value);
+}
+
+void appendUS(QByteArray& out, quint16 group, quint16 element, quint16 value)
+{
+    appendHeader(out, group, element, "US", 2);
+    appendLE<quint16>(out, value);
+}
+
+/**
+ * @brief Decimal string of a spacing value as DS (at most 16 characters).
+ */
+QByteArray decimal(double value)
+{
+    return QByteArray::number(value, 'g', 10);
+}
+
+/**
+ * @brief LO (long string) value, cut to its 64-character limit.
+ */
+QByteArray longString(const QString& value)
+{
+    return value.left(64).toLatin1();
+}
+
+/**
+ * @brief Append an encapsulated pixel data item (or the sequence delimiter).
+ */
+void appendItem(QByteArray& out, quint16 element, quint32 length)
+{
+    appendLE<quint16>(out, 0xFFFE);
+    appendLE<quint16>(out, element);
+    appendLE<quint32>(out, length);
+}
+
+} // namespace
+
+
+QByteArray DicomWriter::uid(const QUuid& uuid)
+{
+    // 2.25 followed by the UUID as one decimal number.
+    const QByteArray bytes = uuid.toRfc4122();
+    std::vector<uint8_t> number(bytes.begin(), bytes.end());
+    QByteArray digits;
+    while (std::any_of(number.begin(), number.end(), [](uint8_t b) { return b != 0; }))
+    {
+        int remainder = 0;
+        for (uint8_t& byte : number)
+        {
+            const int value = remainder * 256 + byte;
+            byte = static_cast<uint8_t>(value / 10);
+            remainder = value % 10;
+        }
+        digits.prepend(static_cast<char>('0' + remainder));
+    }
+    return "2.25." + (digits.isEmpty() ? QByteArray("0") : digits);
+}
+
+bool DicomWriter::writeHeader()
+{
+    if (m_info.width > 0xFFFF || m_info.height > 0xFFFF)
+        return fail("DICOM images are limited to 65535 rows and columns");
+    const quint64 pixelBytes = static_cast<quint64>(m_info.width) * m_info.height * UINT16_SIZE;
+    if (!m_jpeg && pixelBytes >= UNDEFINED_LENGTH)
+        return fail("Uncompressed DICOM pixel data is limited to 4 GB");
+
+    const int bitsStored = m_info.bitsStored >= 2 && m_info.bitsStored <= 16 ? m_info.bitsStored : 16;
+    const ImageMetadata& metadata = m_info.metadata;
+    const QByteArray instanceUid = createUid();
+    // Study and series are the plate; every slot is an instance of it.
+    const bool plate = !metadata.plateId.isNull();
+    const QByteArray studyUid = plate ? uid(metadata.plateId) : createUid();
+    const QByteArray seriesUid = plate ? uid(QUuid::createUuidV5(metadata.plateId, QByteArrayLiteral("series"))) : createUid();
+    const QDateTime now = QDateTime::currentDateTime();
+    const QByteArray date = now.toString("yyyyMMdd").toLatin1();
+    const QByteArray time = now.toString("HHmmss").toLatin1();
+    const bool spacing = metadata.pixelSpacingX > 0.0 && metadata.pixelSpacingY > 0.0;
+    const QByteArray spacingValue = spacing ? decimal(metadata.pixelSpacingY) + "\\" + decimal(metadata.pixelSpacingX) : QByteArray();
+
+    // File meta information (group 0002), preceded by its group length.
+    QByteArray meta;
+    appendHeader(meta, 0x0002, 0x0001, "OB", 2);
+    meta.append('\0');
+    meta.append('\1');
+    appendText(meta, 0x0002, 0x0002, "UI", CR_IMAGE_STORAGE);
+    appendText(meta, 0x0002, 0x0003, "UI", instanceUid);
+    appendText(meta, 0x0002, 0x0010, "UI", m_jpeg ? JPEG_LOSSLESS_SV1 : EXPLICIT_VR_LITTLE_ENDIAN);
+    appendText(meta, 0x0002, 0x0012, "UI", IMPLEMENTATION_CLASS_UID);
+    appendText(meta, 0x0002, 0x0013, "SH", IMPLEMENTATION_VERSION);
+
+    QByteArray header(128, '\0'); // preamble
+    header.append("DICM", 4);
+    appendHeader(header, 0x0002, 0x0000, "UL", 4);
+    appendLE<quint32>(header, static_cast<quint32>(meta.size()));
+    header.append(meta);
+
+    // Data set, in ascending tag order. Empty type 2 attributes are left for the archive.
+    appendText(header, 0x0008, 0x0008, "CS", "ORIGINAL\\PRIMARY");
+    appendText(header, 0x0008, 0x0016, "UI", CR_IMAGE_STORAGE);
+    appendText(header, 0x0008, 0x0018, "UI", instanceUid);
+    appendText(header, 0x0008, 0x0020, "DA", date);
+    appendText(header, 0x0008, 0x0023, "DA", date);
+    appendText(header, 0x0008, 0x0030, "TM", time);
+    appendText(header, 0x0008, 0x0033, "TM", time);
+    appendText(header, 0x0008, 0x0050, "SH", QByteArray());
+    appendText(header, 0x0008, 0x0060, "CS", "CR");
+    appendText(header, 0x0008, 0x0070, "LO", longString(metadata.field("Manufacturer")));
+    appendText(header, 0x0008, 0x0090, "PN", QByteArray());
+    appendText(header, 0x0008, 0x1090, "LO", longString(metadata.model));
+    appendText(header, 0x0010, 0x0010, "PN", QByteArray()); // DICONDE: component name
+    appendText(header, 0x0010, 0x0020, "LO", QByteArray()); // DICONDE: component ID
+    appendText(header, 0x0010, 0x0030, "DA", QByteArray());
+    appendText(header, 0x0010, 0x0040, "CS", QByteArray());
+    appendText(header, 0x0018, 0x0015, "CS", QByteArray());
+    if (!metadata.mode.isEmpty())
+        appendText(header, 0x0018, 0x1030, "LO", longString(metadata.mode)); // protocol name
+    if (spacing)
+        appendText(header, 0x0018, 0x1164, "DS", spacingValue); // imager pixel spacing
+    appendText(header, 0x0018, 0x5101, "CS", QByteArray());
+    appendText(header, 0x0020, 0x000D, "UI", studyUid);
+    appendText(header, 0x0020, 0x000E, "UI", seriesUid);
+    appendText(header, 0x0020, 0x0010, "SH", QByteArray());
+    appendText(header, 0x0020, 0x0011, "IS", "1");
+    appendText(header, 0x0020, 0x0013, "IS", QByteArray::number(m_info.slot + 1));
+    appendText(header, 0x0020, 0x0020, "CS", QByteArray());
+    appendUS(header, 0x0028, 0x0002, 1); // samples per pixel
+    appendText(header, 0x0028, 0x0004, "CS", "MONOCHROME2");
+    appendUS(header, 0x0028, 0x0010, static_cast<quint16>(m_info.height));
+    appendUS(header, 0x0028, 0x0011, static_cast<quint16>(m_info.width));
+    if (spacing)
+        appendText(header, 0x0028, 0x0030, "DS", spacingValue);
+    appendUS(header, 0x0028, 0x0100, 16); // bits allocated
+    appendUS(header, 0x0028, 0x0101, static_cast<quint16>(bitsStored));
+    appendUS(header, 0x0028, 0x0102, static_cast<quint16>(bitsStored - 1)); // high bit
+    appendUS(header, 0x0028, 0x0103, 0); // unsigned
+    appendText(header, 0x0028, 0x2110, "CS", "00"); // no lossy compression
+
+    if (m_jpeg)
+    {
+        // Encapsulated: undefined length, an empty basic offset table, then the fragments.
+        appendHeader(header, 0x7FE0, 0x0010, "OB", UNDEFINED_LENGTH);
+        appendItem(header, 0xE000, 0);
+        m_encoder.begin(m_info.width, m_info.height, bitsStored);
+        m_encoded.clear();
+        m_sampled = false;
+        m_jpegStarted = false;
+    }
+    else
+        appendHeader(header, 0x7FE0, 0x0010, "OW", static_cast<quint32>(pixelBytes));
+
+    return put(header.constData(), header.size());
+}
+
+void DicomWriter::prepareFrame(const ImageFrame& frame)
+{
+    if (!m_jpeg)
+        return;
+
+    for (int y = 0; y < frame.height; y += DICOM_JPEG_SAMPLE_ROW_STEP)
+        m_encoder.addStatistics(frame.row(y), 1, y > 0 ? frame.row(y - 1) : nullptr);
+    m_sampled = true;
+}
+
+bool DicomWriter::consumeRows(const uint16_t* pixels, int count)
+{
+    if (!m_jpeg)
+        return RasterWriter::consumeRows(pixels, count);
+
+    if (!m_jpegStarted)
+    {
+        if (!m_sampled)
+            m_encoder.addStatistics(pixels, count, nullptr);
+        m_encoder.writeHeader(m_encoded);
+        m_jpegStarted = true;
+    }
+    m_encoder.encodeRows(pixels, count, m_encoded);
+    return m_encoded.size() < static_cast<size_t>(EXPORT_WRITE_BLOCK_BYTES) || writeFragments(false);
+}
+
+bool DicomWriter::writeTrailer()
+{
+    if (!m_jpeg)
+        return true;
+
+    m_encoder.finish(m_encoded);
+    if (!writeFragments(true))
+        return false;
+
+    QByteArray delimiter;
+    appendItem(delimiter, 0xE0DD, 0);
+    return put(delimiter.constData(), delimiter.size());
+}
+
+bool DicomWriter::writeFragments(bool last)
+{
+    // Fragments have even lengths; the last one is padded with a NUL after EOI.
+    if (last && m_encoded.size() % 2)
+        m_encoded.push_back(0);
+    const size_t length = m_encoded.size() & ~size_t(1);
+    if (length == 0)
+        return true;
+
+    QByteArray item;
+    appendItem(item, 0xE000, static_cast<quint32>(length));
+    if (!put(item.constData(), item.size()) || !put(m_encoded.data(), static_cast<qint64>(length)))
+        return false;
+    m_encoded.erase(m_encoded.begin(), m_encoded.begin() + static_cast<std::ptrdiff_t>(length));
+    return true;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <quuid.h>
+
+#include "LosslessJpeg.h"
+#include "RasterWriter.h"
+
+#include <vector>
+
+
+/**
+ * @brief DICONDE (DICOM for NDT, ASTM E2339/E2445) computed radiography file writer.
+ *
+ * Writes a Part 10 file with the CR Image Storage SOP class in explicit VR
+ * little endian. The component module of DICONDE reuses the patient
+ * attributes, which are left empty for the archive to fill. Model,
+ * `BitsStored`, scan mode and pixel spacing come from the frame metadata,
+ * LO values cut to their 64-character limit. The Study and Series
+ * Instance UIDs are derived from ImageMetadata::plateId, so the slots of
+ * one plate form one series; frames without a plate ID get fresh ones.
+ *
+ * Uncompressed pixel data is a single OW element whose bytes are the frame
+ * buffer itself, so blocks without white fill are written straight from
+ * memory. With lossless JPEG
+ * (transfer syntax 1.2.840.10008.1.2.4.70) the rows are encoded as they
+ * arrive and the bitstream is written as encapsulated fragments of about
+ * EXPORT_WRITE_BLOCK_BYTES. The Huffman table is built from every
+ * DICOM_JPEG_SAMPLE_ROW_STEP-th row of the frame, or from the first row
+ * block when rows are streamed.
+ *
+ * Both encodings write the white fill of unscanned areas as 2^BitsStored - 1
+ * (see RasterWriter::sampleLimit()), so every sample fits `HighBit` and the
+ * JPEG precision; all other samples are stored exactly.
+ *
+ * DICOM limits rows and columns to 65535 and uncompressed pixel data to
+ * 4 GB.
+ */
+class DicomWriter : public RasterWriter {
+public:
+    /**
+     * @brief Create a writer.
+     * @param losslessJpeg Encode the pixel data as lossless JPEG instead of storing it uncompressed.
+     */
+    explicit DicomWriter(bool losslessJpeg = false) : m_jpeg(losslessJpeg) { }
+
+    /**
+     * @brief Create a globally unique UID in the UUID-derived 2.25 root.
+     */
+    static QByteArray createUid() { return uid(QUuid::createUuid()); }
+
+    /**
+     * @brief UID of a UUID in the 2.25 root (PS3.5 B.2).
+     */
+    static QByteArray uid(const QUuid& uuid);
+
+protected:
+    bool writeHeader() override;
+    void prepareFrame(const ImageFrame& frame) override;
+    bool consumeRows(const uint16_t* pixels, int count) override;
+    bool writeTrailer() override;
+
+private:
+    /**
+     * @brief Write the encoded bytes as fragment items, keeping an odd byte for the next one.
+     * @param last Write everything, padded to even length.
+     */
+    bool writeFragments(bool last);
+
+    bool m_jpeg; ///< Lossless JPEG instead of native pixel data.
+    LosslessJpegEncoder m_encoder; ///< Encoder of the current file.
+    bool m_sampled = false; ///< Whether prepareFrame() collected the Huffman statistics.
+    bool m_jpegStarted = false; ///< Whether the JPEG header has been encoded.
+    std::vector<uint8_t> m_encoded; ///< Encoded bytes not yet written as a fragment.
+};
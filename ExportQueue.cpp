@@ -0,0 +1,209 @@
+#include "ExportQueue.h"
+
+#include <qdir.h>
+#include <qelapsedtimer.h>
+#include <qrunnable.h>
+#include <qthread.h>
+
+#include <algorithm>
+
+
+/**
+ * @brief One queued export, run by a worker of the ExportQueue pool.
+ */
+class ExportJob : public QRunnable {
+public:
+    /**
+     * @brief What the job writes.
+     */
+    enum class Kind {
+        File, ///< The frame in ExportOptions::format.
+        Archive, ///< A record appended to m_archive.
+        Preview, ///< An 8-bit preview (ExportOptions::preview).
+        OpenArchive, ///< Open m_archive at m_path for appending.
+        CloseArchive, ///< Close m_archive.
+    };
+
+    ExportJob(ExportQueue& queue, quint64 id, const ImageFramePtr& frame, const QString& path, const ExportOptions& options,
+        Kind kind = Kind::File, ScanArchive* archive = nullptr) :
+        m_queue(queue), m_id(id), m_frame(frame), m_path(path), m_options(options), m_kind(kind), m_archive(archive) { }
+
+    void run() override
+    {
+        // Exports are background work; the socket and GUI threads always come first.
+        QThread::currentThread()->setPriority(QThread::LowPriority);
+
+        emit m_queue.exportStarted(m_id, m_path);
+
+        if (m_options.threads <= 0)
+            m_options.threads = m_queue.threadBudget();
+
+        QString error;
+        bool ok = false;
+        if (m_kind == Kind::OpenArchive || m_kind == Kind::CloseArchive)
+        {
+            ok = m_kind == Kind::OpenArchive ? openArchive(error) : closeArchive();
+            m_queue.jobFinished(m_id, m_path, ok, error, true);
+            return;
+        }
+        if (m_kind == Kind::Archive)
+        {
+            // Records carry a pyramid for browsing; it is built here rather than on the decoding thread.
+            const QSharedPointer<const ImagePyramid> pyramid = m_frame->pyramid ? m_frame->pyramid : ImagePyramid::build(*m_frame, m_options.threads);
+            const quint64 scanId = m_archive->append(*m_frame, m_frame->rawStream.data(), pyramid.data(), m_options.threads);
+            ok = scanId != 0;
+            error = ok ? QString() : m_archive->errorString();
+            if (ok)
+                m_path += QString(" (scan %1)").arg(scanId);
+        }
+        else if (m_kind == Kind::Preview)
+        {
+            ok = PreviewExporter::write(*m_frame, m_path, m_options.preview, m_options.threads, &error);
+        }
+        else
+        {
+            ok = ImageExporter::write(*m_frame, m_path, m_options,
+                [this](int percent) { emit m_queue.exportProgress(m_id, percent); }, &error);
+        }
+
+        m_frame.reset(); // release the pixels before reporting, the receiver may enqueue more
+        m_queue.jobFinished(m_id, m_path, ok, error);
+    }
+
+private:
+    bool openArchive(QString& error)
+    {
+        if (!m_archive->open(m_path, true))
+        {
+            error = m_archive->errorString();
+            m_queue.m_logger.error("Cannot open the scan archive: " + error);
+            return false;
+        }
+        if (m_archive->wasRepaired())
+            m_queue.m_logger.warning("The scan archive was not closed properly, its index has been rebuilt");
+        m_queue.m_logger.message("Archiving to " + m_path + " (" + QString::number(m_archive->count()) + " plates)");
+        return true;
+    }
+
+    bool closeArchive()
+    {
+        if (m_archive->isOpen())
+            m_queue.m_logger.message("Closed the scan archive " + m_path + " (" + QString::number(m_archive->count()) + " plates)");
+        m_archive->close();
+        return true;
+    }
+
+    ExportQueue& m_queue; ///< Queue the job belongs to (outlives the job).
+    quint64 m_id; ///< Job id.
+    ImageFramePtr m_frame; ///< Frame to write.
+    QString m_path; ///< Target file.
+    ExportOptions m_options; ///< Format and encoder settings at the time the frame was enqueued.
+    Kind m_kind; ///< What the job writes.
+    ScanArchive* m_archive; ///< Archive to append to (Kind::Archive), or nullptr.
+};
+
+
+ExportQueue::ExportQueue(Logger& logger, QObject* parent) : QObject(parent), m_logger(logger)
+{
+    // Leave one core to the GUI thread and the device socket.
+    setMaxThreads(QThread::idealThreadCount() - 1);
+    m_archivePool.setMaxThreadCount(1);
+}
+
+ExportQueue::~ExportQueue()
+{
+    m_pool.clear();
+    m_pool.waitForDone();
+    // Queued appends and the final close still run, so the archive keeps its index.
+    m_archivePool.waitForDone();
+}
+
+bool ExportQueue::waitForDone(int msecs)
+{
+    QElapsedTimer timer;
+    timer.start();
+    if (!m_pool.waitForDone(msecs))
+        return false;
+    return m_archivePool.waitForDone(msecs < 0 ? -1 : std::max(0, msecs - static_cast<int>(timer.elapsed())));
+}
+
+void ExportQueue::setMaxThreads(int count)
+{
+    m_pool.setMaxThreadCount(std::max(count, 1));
+}
+
+int ExportQueue::threadBudget() const
+{
+    // The calling job is already counted as active.
+    const int active = m_pool.activeThreadCount() + m_archivePool.activeThreadCount();
+    return std::max(1, m_pool.maxThreadCount() / std::max(1, active));
+}
+
+quint64 ExportQueue::enqueue(const ImageFramePtr& frame, const QString& baseName)
+{
+    if (!frame || frame->width <= 0 || frame->height <= 0)
+        return 0;
+
+    const QString directory = m_options.directory.isEmpty() ? QDir::currentPath() : m_options.directory;
+    const QString path = QDir(directory).filePath(baseName + "." + ImageExporter::suffix(m_options.format));
+
+    const quint64 id = m_nextId++;
+    ++m_pending;
+    m_pool.start(new ExportJob(*this, id, frame, path, m_options));
+    return id;
+}
+
+quint64 ExportQueue::openArchive(ScanArchive& archive, const QString& path)
+{
+    m_archivePath = path;
+    const quint64 id = m_nextId++;
+    ++m_pending;
+    m_archivePool.start(new ExportJob(*this, id, {}, path, m_options, ExportJob::Kind::OpenArchive, &archive));
+    return id;
+}
+
+quint64 ExportQueue::enqueueArchive(const ImageFramePtr& frame, ScanArchive& archive)
+{
+    if (!frame || frame->width <= 0 || frame->height <= 0)
+        return 0;
+
+    // The archive may still be opening; its path is the one of the open job.
+    const quint64 id = m_nextId++;
+    ++m_pending;
+    m_archivePool.start(new ExportJob(*this, id, frame, m_archivePath, m_options, ExportJob::Kind::Archive, &archive));
+    return id;
+}
+
+quint64 ExportQueue::closeArchive(ScanArchive& archive)
+{
+    const quint64 id = m_nextId++;
+    ++m_pending;
+    m_archivePool.start(new ExportJob(*this, id, {}, m_archivePath, m_options, ExportJob::Kind::CloseArchive, &archive));
+    return id;
+}
+
+quint64 ExportQueue::enqueuePreview(const ImageFramePtr& frame, const QString& baseName)
+{
+    if (!frame || frame->width <= 0 || frame->height <= 0)
+        return 0;
+
+    const QString directory = m_options.directory.isEmpty() ? QDir::currentPath() : m_options.directory;
+    const QString path = QDir(directory).filePath(baseName + "_preview." + QString::fromLatin1(m_options.preview.format));
+
+    const quint64 id = m_nextId++;
+    ++m_pending;
+    m_pool.start(new ExportJob(*this, id, frame, path, m_options, ExportJob::Kind::Preview));
+    return id;
+}
+
+void ExportQueue::jobFinished(quint64 id, const QString& path, bool ok, const QString& error, bool logged)
+{
+    if (!logged && ok)
+        m_logger.message("Exported " + path);
+    else if (!logged)
+        m_logger.error("Export of " + path + " failed: " + error);
+
+    emit exportFinished(id, path, ok, error);
+    if (--m_pending == 0)
+        emit idle();
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <qobject.h>
+#include <qstring.h>
+#include <qthreadpool.h>
+
+#include "ImageExporter.h"
+#include "Logger.h"
+#include "ScanArchive.h"
+
+#include <atomic>
+
+
+/**
+ * @brief Queue that exports frames on a pool of worker threads.
+ *
+ * Encoding a large 16-bit plate takes seconds. Doing it on the GUI thread
+ * freezes the event loop, and with it the device socket. enqueue() only
+ * records the job and returns. The frame is shared, not copied, and is
+ * written by one of the queue's own worker threads. Progress and completion
+ * are reported through signals, which are delivered queued to receivers in
+ * other threads.
+ *
+ * The pool leaves one core to the GUI thread, and its workers run at low
+ * priority, so socket handling and decoding are never starved by an export.
+ * Jobs whose ExportOptions::threads is 0 split their encoders' band work
+ * over an even share of the pool's threads (threadBudget()), and the band
+ * workers inherit the low priority.
+ *
+ * Scan archive jobs (open, append, close) run on a thread of their own, in
+ * the order they were queued. Closing the archive therefore waits for the
+ * plates queued before it without blocking the caller.
+ */
+class ExportQueue : public QObject {
+    Q_OBJECT
+
+public:
+    /**
+     * @brief Create the queue and its worker pool.
+     * @param logger Logger for export results (thread-safe).
+     * @param parent Optional QObject parent.
+     */
+    explicit ExportQueue(Logger& logger, QObject* parent = nullptr);
+
+    /**
+     * @brief Destructor. Drops jobs that have not started and waits for running ones.
+     */
+    ~ExportQueue();
+
+    /**
+     * @brief Set the export options for frames enqueued from now on.
+     */
+    void setOptions(const ExportOptions& options) { m_options = options; }
+    const ExportOptions& options() const { return m_options; } ///< Current export options.
+
+    /**
+     * @brief Set the number of worker threads.
+     * @param count Threads; values below 1 are raised to 1.
+     */
+    void setMaxThreads(int count);
+    int maxThreads() const { return m_pool.maxThreadCount(); } ///< Number of worker threads.
+
+    /**
+     * @brief Encoder threads for a job that is starting: the worker threads shared by the running jobs.
+     */
+    int threadBudget() const;
+
+    /**
+     * @brief Queue a frame for export.
+     * @param frame Frame to write; kept alive until the job has finished.
+     * @param baseName File name without directory and suffix.
+     * @return Job id passed to the signals, or 0 when the frame is empty.
+     */
+    quint64 enqueue(const ImageFramePtr& frame, const QString& baseName);
+
+    /**
+     * @brief Queue opening a scan archive for appending.
+     * @param archive Archive to open; must outlive the job.
+     * @param path Archive file.
+     * @return Job id passed to the signals; exportFinished() reports whether the archive could be opened.
+     */
+    quint64 openArchive(ScanArchive& archive, const QString& path);
+
+    /**
+     * @brief Queue a frame to be appended to a scan archive.
+     *
+     * The raw stream of the frame (ImageFrame::rawStream) is stored with it.
+     * @param frame Frame to archive; kept alive until the job has finished.
+     * @param archive Archive opened by openArchive(); must outlive the job.
+     * @return Job id passed to the signals (the path is the archive file), or 0 when the frame is empty.
+     */
+    quint64 enqueueArchive(const ImageFramePtr& frame, ScanArchive& archive);
+
+    /**
+     * @brief Queue closing a scan archive once the frames queued for it are appended.
+     * @param archive Archive to close; must outlive the job.
+     * @return Job id passed to the signals.
+     */
+    quint64 closeArchive(ScanArchive& archive);
+
+    /**
+     * @brief Queue an 8-bit preview of a frame (ExportOptions::preview).
+     *
+     * The preview is a job of its own, so it is written in parallel with the
+     * frame's master export instead of after it.
+     * @param frame Frame to preview; kept alive until the job has finished.
+     * @param baseName File name without directory and suffix; "_preview" is appended.
+     * @return Job id passed to the signals, or 0 when the frame is empty.
+     */
+    quint64 enqueuePreview(const ImageFramePtr& frame, const QString& baseName);
+
+    int pending() const { return m_pending; } ///< Jobs queued or running.
+
+    /**
+     * @brief Block until all jobs have finished.
+     * @param msecs Timeout in milliseconds; -1 waits forever.
+     * @return false on timeout.
+     */
+    bool waitForDone(int msecs = -1);
+
+signals:
+    void exportStarted(quint64 id, const QString& path); ///< A worker picked up a job.
+    void exportProgress(quint64 id, int percent); ///< Progress of a running job (0..100).
+    void exportFinished(quint64 id, const QString& path, bool ok, const QString& error); ///< A job has ended.
+    void idle(); ///< The last pending job has finished.
+
+private:
+    friend class ExportJob;
+
+    /**
+     * @brief Called by a worker thread once its job has ended.
+     * @param logged Whether the job has logged its result itself.
+     */
+    void jobFinished(quint64 id, const QString& path, bool ok, const QString& error, bool logged = false);
+
+    QThreadPool m_pool; ///< Worker threads owned by this queue (not the global pool).
+    QThreadPool m_archivePool; ///< Single thread for scan archive jobs, so they run in order.
+    ExportOptions m_options; ///< Options for newly enqueued frames.
+    QString m_archivePath; ///< File passed to the last openArchive().
+    std::atomic<quint64> m_nextId { 1 }; ///< Next job id.
+    std::atomic<int> m_pending { 0 }; ///< Jobs queued or running.
+    Logger& m_logger; ///< Logger instance for logging messages.
+};
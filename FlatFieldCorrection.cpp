@@ -0,0 +1,197 @@
+#include "FlatFieldCorrection.h"
+#include "Simd.h"
+
+#include <algorithm>
+#include <cstring>
+
+
+namespace {
+
+constexpr char FLAT_FIELD_MAGIC[8] = { 'C', 'R', '3', '5', 'F', 'L', 'A', 'T' };
+constexpr uint32_t FLAT_FIELD_VERSION = 1;
+
+/**
+ * @brief Header of a calibration file.
+ */
+#pragma pack(push, 1)
+struct Header {
+    char magic[8]; ///< FLAT_FIELD_MAGIC.
+    uint32_t version; ///< FLAT_FIELD_VERSION.
+    uint32_t width; ///< Calibrated columns.
+    uint32_t badPixels; ///< Entries of the bad pixel list.
+    uint32_t badLines; ///< Entries of the bad line list.
+    uint8_t reserved[8]; ///< Zero.
+};
+#pragma pack(pop)
+static_assert(sizeof(Header) == 32, "calibration header layout");
+
+/**
+ * @brief Offset of the bad pixel list: the header and both tables, padded to 4 bytes.
+ */
+qint64 listOffset(qint64 width)
+{
+    return (sizeof(Header) + 2 * width * qint64(UINT16_SIZE) + 3) & ~qint64(3);
+}
+
+} // namespace
+
+
+bool FlatFieldCorrection::load(const QString& path)
+{
+    close();
+    m_error.clear();
+
+    m_file.setFileName(path);
+    if (!m_file.open(QIODevice::ReadOnly))
+        return fail(m_file.errorString());
+    const qint64 size = m_file.size();
+    if (size < static_cast<qint64>(sizeof(Header)))
+        return fail("Not a flat-field calibration file");
+    const uchar* data = m_file.map(0, size);
+    if (!data)
+        return fail(m_file.errorString());
+
+    Header header;
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, FLAT_FIELD_MAGIC, sizeof(FLAT_FIELD_MAGIC)) != 0)
+        return fail("Not a flat-field calibration file");
+    if (header.version != FLAT_FIELD_VERSION)
+        return fail(QString("Unsupported calibration version %1").arg(header.version));
+    const qint64 pixelsOffset = listOffset(header.width);
+    const qint64 linesOffset = pixelsOffset + static_cast<qint64>(header.badPixels) * sizeof(BadPixel);
+    if (header.width == 0 || header.width > 65536 || linesOffset + static_cast<qint64>(header.badLines) * 4 > size)
+        return fail("Truncated or inconsistent calibration file");
+
+    const uint16_t* dark = reinterpret_cast<const uint16_t*>(data + sizeof(Header));
+    const uint16_t* gain = dark + header.width;
+    const BadPixel* badPixels = reinterpret_cast<const BadPixel*>(data + pixelsOffset);
+    const uint32_t* badLines = reinterpret_cast<const uint32_t*>(data + linesOffset);
+
+    // Lookups binary-search both lists, so their order is checked once here.
+    const auto pixelLess = [](const BadPixel& a, const BadPixel& b) {
+        return a.line != b.line ? a.line < b.line : a.column < b.column;
+    };
+    if (!std::is_sorted(badPixels, badPixels + header.badPixels, pixelLess) || !std::is_sorted(badLines, badLines + header.badLines))
+        return fail("Calibration defect lists are not sorted");
+
+    m_dark = dark;
+    m_gain = gain;
+    m_badPixels = badPixels;
+    m_badLines = badLines;
+    m_width = static_cast<int>(header.width);
+    m_badPixelCount = static_cast<int>(header.badPixels);
+    m_badLineCount = static_cast<int>(header.badLines);
+    for (int x = 0; x < m_width; ++x)
+        if (m_gain[x] == 0)
+            m_deadColumns.push_back(x);
+    return true;
+}
+
+void FlatFieldCorrection::apply(uint16_t* pixels, int column, int count, uint16_t limit) const
+{
+    if (!m_dark)
+        return;
+
+    // Only the calibrated part of the run is corrected.
+    const int first = std::max(column, 0);
+    const int last = std::min(column + count, m_width);
+    if (last <= first)
+        return;
+    uint16_t* dst = pixels + (first - column);
+    const uint16_t* dark = m_dark + first;
+    const uint16_t* gain = m_gain + first;
+    const int n = last - first;
+    constexpr uint32_t round = 1u << (FLAT_FIELD_GAIN_SHIFT - 1);
+
+    int i = 0;
+#ifdef CR35_SSE2
+    static_assert(FLAT_FIELD_GAIN_SHIFT > 0 && FLAT_FIELD_GAIN_SHIFT < 16, "the SSE2 kernel splits the product at 16 bits");
+    const __m128i bias = _mm_set1_epi16(static_cast<short>(0x8000));
+    const __m128i roundV = _mm_set1_epi16(static_cast<short>(round));
+    const __m128i limitV = _mm_set1_epi16(static_cast<short>(limit));
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 8 <= n; i += 8)
+    {
+        const __m128i v = _mm_subs_epu16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i)),
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(dark + i)));
+        const __m128i g = _mm_loadu_si128(reinterpret_cast<const __m128i*>(gain + i));
+        // 32-bit products as 16-bit halves; adding the rounding term may carry into the high half.
+        const __m128i lo = _mm_mullo_epi16(v, g);
+        __m128i hi = _mm_mulhi_epu16(v, g);
+        const __m128i rounded = _mm_add_epi16(lo, roundV);
+        const __m128i carry = _mm_cmpgt_epi16(_mm_xor_si128(lo, bias), _mm_xor_si128(rounded, bias));
+        hi = _mm_sub_epi16(hi, carry);
+        __m128i result = _mm_or_si128(_mm_slli_epi16(hi, 16 - FLAT_FIELD_GAIN_SHIFT), _mm_srli_epi16(rounded, FLAT_FIELD_GAIN_SHIFT));
+        // Products past 16 bits after the shift saturate.
+        const __m128i fits = _mm_cmpeq_epi16(_mm_srli_epi16(hi, FLAT_FIELD_GAIN_SHIFT), zero);
+        result = _mm_or_si128(_mm_and_si128(fits, result), _mm_andnot_si128(fits, _mm_set1_epi16(-1)));
+        // Unsigned minimum: a - max(a - limit, 0).
+        result = _mm_sub_epi16(result, _mm_subs_epu16(result, limitV));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), result);
+    }
+#endif
+    for (; i < n; ++i)
+    {
+        const uint32_t v = dst[i] > dark[i] ? dst[i] - dark[i] : 0;
+        const uint32_t corrected = (v * gain[i] + round) >> FLAT_FIELD_GAIN_SHIFT;
+        dst[i] = static_cast<uint16_t>(std::min<uint32_t>(corrected, limit));
+    }
+}
+
+void FlatFieldCorrection::repair(uint16_t* row, int left, int right, int line) const
+{
+    if (!m_dark)
+        return;
+
+    for (auto it = std::lower_bound(m_deadColumns.begin(), m_deadColumns.end(), left); it != m_deadColumns.end() && *it < right; ++it)
+        repairPixel(row, left, right, *it);
+
+    if (line < 0 || m_badPixelCount == 0)
+        return;
+    const BadPixel* end = m_badPixels + m_badPixelCount;
+    const BadPixel key = { static_cast<uint32_t>(line), static_cast<uint32_t>(std::max(left, 0)) };
+    const BadPixel* it = std::lower_bound(m_badPixels, end, key, [](const BadPixel& a, const BadPixel& b) {
+        return a.line != b.line ? a.line < b.line : a.column < b.column;
+        });
+    for (; it != end && it->line == key.line && static_cast<int>(it->column) < right; ++it)
+        repairPixel(row, left, right, static_cast<int>(it->column));
+}
+
+bool FlatFieldCorrection::isBadLine(int line) const
+{
+    return line >= 0 && std::binary_search(m_badLines, m_badLines + m_badLineCount, static_cast<uint32_t>(line));
+}
+
+void FlatFieldCorrection::repairPixel(uint16_t* row, int left, int right, int column) const
+{
+    // Columns are repaired left to right, so the left neighbour of a cluster is already repaired.
+    const bool hasLeft = column > left;
+    const bool hasRight = column + 1 < right;
+    uint16_t& pixel = row[column - left];
+    if (hasLeft && hasRight)
+        pixel = static_cast<uint16_t>((row[column - left - 1] + row[column - left + 1] + 1) / 2);
+    else if (hasLeft)
+        pixel = row[column - left - 1];
+    else if (hasRight)
+        pixel = row[column - left + 1];
+}
+
+void FlatFieldCorrection::close()
+{
+    m_file.close(); // unmaps the tables
+    m_dark = nullptr;
+    m_gain = nullptr;
+    m_badPixels = nullptr;
+    m_badLines = nullptr;
+    m_width = 0;
+    m_badPixelCount = 0;
+    m_badLineCount = 0;
+    m_deadColumns.clear();
+}
+
+bool FlatFieldCorrection::fail(const QString& text)
+{
+    m_error = text;
+    close();
+    return false;
+}
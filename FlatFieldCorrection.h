@@ -0,0 +1,102 @@
+#pragma once
+
+#include <qfile.h>
+#include <qstring.h>
+
+#include "CR35Utils.h"
+
+#include <cstdint>
+#include <vector>
+
+
+/**
+ * @brief Dark, flat-field and defect correction of scan lines.
+ *
+ * A calibration holds, per column of the scan line (0 .. `PixLine`), a dark
+ * offset and a gain in FLAT_FIELD_GAIN_SHIFT fixed point, plus lists of bad
+ * pixels and bad lines. apply() corrects a run of pixels as
+ * `min((max(v - dark, 0) * gain + round) >> FLAT_FIELD_GAIN_SHIFT, limit)`,
+ * eight pixels at a time with SSE2. repair() replaces bad pixels, and
+ * columns whose gain is 0, by the mean of their left and right neighbours.
+ * Bad lines are replaced by the decoder from the neighbouring lines.
+ *
+ * The calibration file is mapped, not read: the tables are used in place
+ * and only the list of dead columns is built on load. Load it once and
+ * share it through DecoderOptions::correction.
+ *
+ * File layout (little endian): a 32-byte header ("CR35FLAT", version,
+ * width, bad pixel count, bad line count, 8 reserved bytes), width dark
+ * offsets (uint16), width gains (uint16), padding to 4 bytes, bad pixels as
+ * (line, column) uint32 pairs sorted by line and column, and bad line
+ * indices (uint32, ascending). Lines are absolute scan-line numbers
+ * (ScanLine::row): every line of the image that carried pixels counts,
+ * from the first line of the stream, including lines above the region
+ * of interest and lines whose pixels were all dropped. Calibration files are produced by the
+ * calibration tools of the scanner; this class only reads them.
+ */
+class FlatFieldCorrection {
+public:
+    /**
+     * @brief A defective pixel.
+     */
+    struct BadPixel {
+        uint32_t line; ///< Absolute scan-line number.
+        uint32_t column; ///< Column in line coordinates.
+    };
+
+    FlatFieldCorrection() = default;
+    FlatFieldCorrection(const FlatFieldCorrection&) = delete;
+    FlatFieldCorrection& operator=(const FlatFieldCorrection&) = delete;
+
+    /**
+     * @brief Map and validate a calibration file.
+     * @return false when the file cannot be mapped or is not a valid calibration (see errorString()).
+     */
+    bool load(const QString& path);
+
+    /**
+     * @brief Unmap the calibration; apply() and repair() do nothing afterwards.
+     */
+    void close();
+
+    bool isLoaded() const { return m_dark != nullptr; } ///< Whether a calibration is mapped.
+    int width() const { return m_width; } ///< Calibrated columns.
+    QString path() const { return m_file.fileName(); } ///< Calibration file.
+    QString errorString() const { return m_error; } ///< Description of the last failure.
+
+    /**
+     * @brief Subtract the dark offset and apply the gain to a run of pixels.
+     * @param pixels Pixels of the run, corrected in place.
+     * @param column Line column of the first pixel; columns outside the calibration are left alone.
+     * @param count Number of pixels.
+     * @param limit Largest corrected value (the `BitsStored` maximum).
+     */
+    void apply(uint16_t* pixels, int column, int count, uint16_t limit) const;
+
+    /**
+     * @brief Replace the bad pixels and dead columns of an assembled row.
+     * @param row Pixels of columns [left, right).
+     * @param line Absolute scan-line number of the row (ScanLine::row).
+     */
+    void repair(uint16_t* row, int left, int right, int line) const;
+
+    /**
+     * @brief Whether an absolute scan-line number is listed as bad.
+     */
+    bool isBadLine(int line) const;
+
+private:
+    bool fail(const QString& text); ///< Record an error, close() and return false.
+    void repairPixel(uint16_t* row, int left, int right, int column) const; ///< Replace one pixel by its neighbours' mean.
+
+    QFile m_file; ///< Mapped calibration file.
+    const uint16_t* m_dark = nullptr; ///< Dark offset per column (mapped).
+    const uint16_t* m_gain = nullptr; ///< Gain per column (mapped).
+    const BadPixel* m_badPixels = nullptr; ///< Bad pixels (mapped).
+    const uint32_t* m_badLines = nullptr; ///< Bad lines (mapped).
+    int m_width = 0; ///< Calibrated columns.
+    int m_badPixelCount = 0; ///< Entries of m_badPixels.
+    int m_badLineCount = 0; ///< Entries of m_badLines.
+    std::vector<int> m_deadColumns; ///< Columns with gain 0, ascending.
+    QString m_error; ///< Description of the last failure.
+};
@@ -0,0 +1,212 @@
+#include "Histogram.h"
+#include "Simd.h"
+
+#include <qthreadpool.h>
+
+#include <algorithm>
+#include <cmath>
+
+
+namespace {
+
+/**
+ * @brief Minimum and maximum of a run of pixels.
+ *
+ * SSE2 only compares signed 16-bit words, so values are biased by 0x8000.
+ */
+void minMax(const uint16_t* pixels, size_t count, int& minimum, int& maximum)
+{
+    int lo = 65535;
+    int hi = 0;
+    size_t i = 0;
+#ifdef CR35_SSE2
+    if (count >= 8)
+    {
+        const __m128i bias = _mm_set1_epi16(static_cast<short>(0x8000));
+        __m128i vmin = _mm_set1_epi16(0x7FFF);
+        __m128i vmax = _mm_set1_epi16(static_cast<short>(0x8000));
+        for (; i + 8 <= count; i += 8)
+        {
+            const __m128i v = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + i)), bias);
+            vmin = _mm_min_epi16(vmin, v);
+            vmax = _mm_max_epi16(vmax, v);
+        }
+        alignas(16) int16_t mins[8];
+        alignas(16) int16_t maxs[8];
+        _mm_store_si128(reinterpret_cast<__m128i*>(mins), vmin);
+        _mm_store_si128(reinterpret_cast<__m128i*>(maxs), vmax);
+        for (int k = 0; k < 8; ++k)
+        {
+            lo = std::min(lo, mins[k] + 0x8000);
+            hi = std::max(hi, maxs[k] + 0x8000);
+        }
+    }
+#endif
+    for (; i < count; ++i)
+    {
+        lo = std::min(lo, static_cast<int>(pixels[i]));
+        hi = std::max(hi, static_cast<int>(pixels[i]));
+    }
+    minimum = std::min(minimum, lo);
+    maximum = std::max(maximum, hi);
+}
+
+} // namespace
+
+
+Histogram::Histogram() : m_lanes(static_cast<size_t>(HISTOGRAM_LANES) * BINS, 0)
+{
+}
+
+Histogram Histogram::of(const ImageFrame& frame, int threads)
+{
+    Histogram result;
+    if (frame.width <= 0 || frame.height <= 0)
+        return result;
+
+    QThreadPool pool;
+    setupBandPool(pool, threads);
+    const int parts = std::min(pool.maxThreadCount(), frame.height);
+    if (parts == 1)
+    {
+        result.add(frame.data(), static_cast<size_t>(frame.width) * frame.height);
+        return result;
+    }
+
+    // One histogram per band of rows, so no counter is shared between threads.
+    std::vector<Histogram> partials(static_cast<size_t>(parts));
+    for (int part = 0; part < parts; ++part)
+    {
+        const int first = static_cast<int>(static_cast<qint64>(frame.height) * part / parts);
+        const int last = static_cast<int>(static_cast<qint64>(frame.height) * (part + 1) / parts);
+        Histogram* partial = &partials[part];
+        pool.start([&frame, partial, first, last] {
+            partial->add(frame.row(first), static_cast<size_t>(last - first) * frame.width);
+            });
+    }
+    pool.waitForDone();
+
+    // Reduce by bin range: every worker sums all lanes of all partials for its bins into lane 0.
+    uint32_t* total = result.lane(0);
+    for (int part = 0; part < parts; ++part)
+    {
+        const int first = static_cast<int>(static_cast<qint64>(BINS) * part / parts);
+        const int last = static_cast<int>(static_cast<qint64>(BINS) * (part + 1) / parts);
+        pool.start([&partials, total, first, last] {
+            for (const Histogram& partial : partials)
+                for (int l = 0; l < HISTOGRAM_LANES; ++l)
+                {
+                    const uint32_t* counts = partial.lane(l);
+                    for (int v = first; v < last; ++v)
+                        total[v] += counts[v];
+                }
+            });
+    }
+    pool.waitForDone();
+
+    for (const Histogram& partial : partials)
+    {
+        result.m_count += partial.m_count;
+        result.m_min = std::min(result.m_min, partial.m_min);
+        result.m_max = std::max(result.m_max, partial.m_max);
+    }
+    return result;
+}
+
+void Histogram::add(const uint16_t* pixels, size_t count)
+{
+    if (count == 0)
+        return;
+
+    static_assert(HISTOGRAM_LANES == 4, "add() is unrolled for four lanes");
+    uint32_t* lane0 = lane(0);
+    uint32_t* lane1 = lane(1);
+    uint32_t* lane2 = lane(2);
+    uint32_t* lane3 = lane(3);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        ++lane0[pixels[i]];
+        ++lane1[pixels[i + 1]];
+        ++lane2[pixels[i + 2]];
+        ++lane3[pixels[i + 3]];
+    }
+    for (; i < count; ++i)
+        ++lane0[pixels[i]];
+
+    minMax(pixels, count, m_min, m_max);
+    m_count += count;
+}
+
+void Histogram::merge(const Histogram& other)
+{
+    for (size_t i = 0; i < m_lanes.size(); ++i)
+        m_lanes[i] += other.m_lanes[i];
+    m_count += other.m_count;
+    m_min = std::min(m_min, other.m_min);
+    m_max = std::max(m_max, other.m_max);
+}
+
+void Histogram::clear()
+{
+    std::fill(m_lanes.begin(), m_lanes.end(), 0u);
+    m_count = 0;
+    m_min = 65535;
+    m_max = 0;
+}
+
+quint64 Histogram::bin(int value) const
+{
+    if (value < 0 || value >= BINS)
+        return 0;
+    quint64 sum = 0;
+    for (int l = 0; l < HISTOGRAM_LANES; ++l)
+        sum += lane(l)[value];
+    return sum;
+}
+
+std::vector<quint64> Histogram::bins() const
+{
+    std::vector<quint64> sums(BINS, 0);
+    for (int l = 0; l < HISTOGRAM_LANES; ++l)
+    {
+        const uint32_t* counts = lane(l);
+        for (int v = 0; v < BINS; ++v)
+            sums[v] += counts[v];
+    }
+    return sums;
+}
+
+int Histogram::percentile(double percent) const
+{
+    if (m_count == 0)
+        return -1;
+
+    const double fraction = std::clamp(percent, 0.0, 100.0) / 100.0;
+    const quint64 rank = std::max<quint64>(1, static_cast<quint64>(std::ceil(fraction * static_cast<double>(m_count))));
+    // Only [min, max] can hold counts.
+    quint64 seen = 0;
+    for (int v = m_min; v < m_max; ++v)
+    {
+        seen += bin(v);
+        if (seen >= rank)
+            return v;
+    }
+    return m_max;
+}
+
+Histogram::Window Histogram::autoWindow(double lowPercent, double highPercent) const
+{
+    Window window;
+    if (m_count == 0)
+        return window;
+    window.low = percentile(lowPercent);
+    window.high = percentile(highPercent);
+    // A flat plate still needs a window ToneMap can use.
+    if (window.high <= window.low)
+    {
+        window.low = std::min(window.low, 65534);
+        window.high = window.low + 1;
+    }
+    return window;
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <qglobal.h>
+
+#include "CR35Utils.h"
+#include "ImageFrame.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+/**
+ * @brief Full 16-bit histogram of a plate, with percentiles and min/max.
+ *
+ * Counts are spread over HISTOGRAM_LANES sub-histograms: consecutive pixels
+ * land in different lanes, so runs of equal values (flat background) do not
+ * serialize on one counter. Minimum and maximum are taken eight pixels at a
+ * time with SSE2. Lanes are only summed when the histogram is queried.
+ *
+ * A histogram can be fed incrementally with add() as line blocks are
+ * decoded, or built from a whole frame with of(), which counts bands of rows
+ * on a thread pool and reduces the partial histograms in parallel by bin
+ * range.
+ */
+class Histogram {
+public:
+    static constexpr int BINS = 65536; ///< One bin per 16-bit value.
+
+    /**
+     * @brief A display window derived from the histogram.
+     */
+    struct Window {
+        int low = 0; ///< Value shown black.
+        int high = 0; ///< Value shown white.
+    };
+
+    Histogram();
+
+    /**
+     * @brief Histogram of all pixels of a frame.
+     * @param frame Source frame.
+     * @param threads Worker threads; 0 uses QThread::idealThreadCount().
+     */
+    static Histogram of(const ImageFrame& frame, int threads = 0);
+
+    /**
+     * @brief Count a run of pixels.
+     */
+    void add(const uint16_t* pixels, size_t count);
+
+    /**
+     * @brief Count the pixels of a decoded line block.
+     */
+    void add(const LineBlock& block) { add(block.pixels.data(), block.pixels.size()); }
+
+    /**
+     * @brief Add the counts of another histogram.
+     */
+    void merge(const Histogram& other);
+
+    /**
+     * @brief Remove all counts.
+     */
+    void clear();
+
+    quint64 count() const { return m_count; } ///< Number of pixels counted.
+    int min() const { return m_count ? m_min : -1; } ///< Smallest value counted, -1 when empty.
+    int max() const { return m_count ? m_max : -1; } ///< Largest value counted, -1 when empty.
+
+    /**
+     * @brief Number of pixels with a value.
+     */
+    quint64 bin(int value) const;
+
+    /**
+     * @brief All bins, summed over the lanes.
+     */
+    std::vector<quint64> bins() const;
+
+    /**
+     * @brief Smallest value that at least @p percent of the pixels do not exceed.
+     * @param percent Percentage in [0, 100].
+     * @return Value, or -1 when the histogram is empty.
+     */
+    int percentile(double percent) const;
+
+    /**
+     * @brief Window spanning the given percentiles, for display of a plate without manual leveling.
+     * @return Window with high above low; {0, 0} when the histogram is empty.
+     */
+    Window autoWindow(double lowPercent = AUTO_WINDOW_LOW_PERCENT, double highPercent = AUTO_WINDOW_HIGH_PERCENT) const;
+
+private:
+    uint32_t* lane(int index) { return m_lanes.data() + static_cast<size_t>(index) * BINS; } ///< Counters of one sub-histogram.
+    const uint32_t* lane(int index) const { return m_lanes.data() + static_cast<size_t>(index) * BINS; } ///< Counters of one sub-histogram.
+
+    std::vector<uint32_t> m_lanes; ///< HISTOGRAM_LANES sub-histograms of BINS counters each.
+    quint64 m_count = 0; ///< Pixels counted.
+    int m_min = 65535; ///< Smallest value counted.
+    int m_max = 0; ///< Largest value counted.
+};
@@ -0,0 +1,715 @@
+#include "ImageDecoder.h"
+
+#include <algorithm>
+#include <limits>
+
+
+ImageDecoder::ImageDecoder(Logger& logger) : m_assembler(m_arena.resource()), m_logger(logger)
+{
+    reset();
+}
+
+void ImageDecoder::reset()
+{
+    m_options = m_nextOptions;
+
+    // Drop every line before the arena memory backing them is returned.
+    m_assembler = LineAssembler(m_arena.resource());
+    m_lineBase = 0;
+    if (m_arena.allocations() > 0)
+        m_logger.message(m_arena.summary());
+    m_arena.release();
+
+    m_position = 0;
+    m_parsingPixels = false;
+    m_complete = false;
+    m_pendingConfig = false;
+    m_lineHasPixels = false;
+    m_rowIndex = 0;
+    m_roiDone = false;
+    m_metadata = m_modeDefaults;
+    m_metadata.plateId = QUuid::createUuid();
+    m_pixLine = std::max(m_modeDefaults.pixLine, 0);
+    m_slotCount = std::max(m_modeDefaults.slotCount, 1);
+    m_bitsStored = m_modeDefaults.bitsStored;
+    m_stats = {};
+    configureSlots();
+    selectPolicies();
+}
+
+void ImageDecoder::setOptions(const DecoderOptions& options)
+{
+    // Rows of one image are all assembled with the same options.
+    m_nextOptions = options;
+    if (m_position > 0)
+        return;
+    m_options = options;
+    selectPolicies();
+}
+
+void ImageDecoder::setModeDefaults(const ImageMetadata& defaults)
+{
+    m_modeDefaults = defaults;
+}
+
+bool ImageDecoder::decode(const ImageStream& stream)
+{
+    if (m_complete)
+        return true;
+
+    // The acquisition starts with its first bytes, not with reset() after the previous plate.
+    if (m_position == 0 && !stream.isEmpty() && !m_metadata.scanTime.isValid())
+        m_metadata.scanTime = QDateTime::currentDateTime();
+    return (this->*m_decodeFn)(stream);
+}
+
+void ImageDecoder::selectPolicies()
+{
+    using namespace DecodePolicy;
+
+    if (m_options.strict)
+        m_decodeFn = m_options.collectStats ? &ImageDecoder::decodeWords<Strict, StatsOn> : &ImageDecoder::decodeWords<Strict, StatsOff>;
+    else
+        m_decodeFn = m_options.collectStats ? &ImageDecoder::decodeWords<Trusted, StatsOn> : &ImageDecoder::decodeWords<Trusted, StatsOff>;
+
+    m_roiActive = !m_options.roi.isFull();
+
+    m_flushFn = m_options.collectStats ? &ImageDecoder::flushLine<StatsOn> : &ImageDecoder::flushLine<StatsOff>;
+
+    // Scaling only applies once the JSON header has reported a bit depth below 16.
+    const bool scale = m_options.scaleToBitsStored && m_bitsStored > 0 && m_bitsStored < 16;
+    m_pixelShift = scale ? 16 - m_bitsStored : 0;
+    if (scale)
+    {
+        m_frameFn = m_options.crop ? &ImageDecoder::assembleFrame<ScaledPixels, CropToContent> : &ImageDecoder::assembleFrame<ScaledPixels, FullLine>;
+        m_rowFn = &ImageDecoder::assembleRow<ScaledPixels>;
+    }
+    else
+    {
+        m_frameFn = m_options.crop ? &ImageDecoder::assembleFrame<RawPixels, CropToContent> : &ImageDecoder::assembleFrame<RawPixels, FullLine>;
+        m_rowFn = &ImageDecoder::assembleRow<RawPixels>;
+    }
+}
+
+template <class Validation, class Stats>
+bool ImageDecoder::decodeWords(const ImageStream& stream)
+{
+    ImageStream::Reader reader(stream, m_position);
+    LineAssembler& assembler = m_assembler;
+
+    while (reader.canRead(UINT16_SIZE))
+    {
+        // Fast path: consume a whole run of pixel words inside the current chunk at once.
+        if ((m_parsingPixels && assembler.inLine) || m_roiDone)
+        {
+            const qint64 runStart = reader.pos();
+            const qint64 run = reader.skipPixelRun();
+            if (run > 0)
+            {
+                if (!m_roiDone)
+                    appendPixels<Validation, Stats>(runStart, run);
+                continue;
+            }
+        }
+
+        const qint64 markerPos = reader.pos();
+        const uint16_t word = reader.readWord();
+
+        // Check if the word is a Control Marker
+        if (word >= 0xFFF9u)
+        {
+            switch (word)
+            {
+                case DATA_MARKER_START:
+                {
+                    if (!reader.canRead(UINT16_SIZE))
+                    {
+                        m_position = markerPos; // argument not received yet
+                        return false;
+                    }
+				    // New line begins. Flush any previously open line now.
+				    flushLine<Stats>();
+				    if (m_roiDone)
+				    {
+					    reader.readWord(); // past the region of interest, only look for the end marker
+					    break;
+				    }
+
+				    assembler.currentLine.segments.clear();
+				    assembler.currentLine.endX = 0;
+				    assembler.currentSeg = {};
+				    assembler.inLine = true;
+				    assembler.x = reader.readWord();
+				    m_parsingPixels = true;
+                    break;
+                }
+
+                case DATA_MARKER_GAP:
+                {
+                    if (!reader.canRead(UINT16_SIZE))
+                    {
+                        m_position = markerPos; // argument not received yet
+                        return false;
+                    }
+				    const uint16_t gap = reader.readWord();
+
+				    if (assembler.inLine)
+				    {
+					    if constexpr (Stats::enabled)
+						    m_stats.gapPixels += gap;
+					    assembler.flushSegment();
+						assembler.x += gap;
+					    m_parsingPixels = true;
+				    }
+                    break;
+                }
+
+                case DATA_MARKER_CONFIG:
+                {
+                    if (!reader.canRead(UINT16_SIZE))
+                    {
+                        m_position = markerPos; // size not received yet
+                        return false;
+                    }
+                    const uint16_t size = reader.readWord();
+
+                    if (!reader.canRead(size))
+                    {
+                        m_position = markerPos; // JSON not fully received yet
+                        m_pendingConfig = true;
+                        return false;
+                    }
+                    m_pendingConfig = false;
+
+                    // JSON may straddle storage chunks; readBytes reassembles it. The trailing NUL is dropped by the extractor.
+                    const QByteArray jsonData = reader.readBytes(size);
+                    m_logger.message("Parsing JSON config of size: " + QString::number(size));
+                    parseJsonConfig(jsonData);
+                    break;
+                }
+
+                case DATA_MARKER_NOP:
+                    break;
+                case DATA_MARKER_IMAGE_END:
+					flushLine<Stats>();
+					finishSlots();
+					m_parsingPixels = false;
+                    m_complete = true;
+                    m_position = reader.pos();
+                    return true;
+
+                default:
+					if constexpr (Stats::enabled)
+						m_stats.unknownMarkers++;
+                    break; // Ignore Heartbeats/Padding
+            }
+        }
+        // Process Pixel Data (single word straddling a chunk boundary)
+        else if (m_parsingPixels && assembler.inLine)
+        {
+			appendPixels<Validation, Stats>(markerPos, 1);
+        }
+    }
+
+    m_position = reader.pos();
+    return false;
+}
+
+template <class Validation, class Stats>
+void ImageDecoder::appendPixels(qint64 offset, qint64 count)
+{
+    LineAssembler& assembler = m_assembler;
+
+    // Range [first, last) of the run that is kept.
+    qint64 first = 0;
+    qint64 last = count;
+    if constexpr (Validation::validate)
+    {
+        // Drop pixels beyond the declared line width instead of widening the frame.
+        const int limit = m_pixLine > 0 ? m_pixLine : 0x10000;
+        last = std::clamp<qint64>(limit - assembler.x, 0, count);
+        if constexpr (Stats::enabled)
+            m_stats.clippedPixels += count - last;
+    }
+
+    m_lineHasPixels = true;
+    if (m_roiActive)
+    {
+        // Rows and columns outside the region of interest are skipped, not stored.
+        const DecodeRoi& roi = m_options.roi;
+        if (m_rowIndex < roi.firstRow)
+            last = 0;
+        first = std::clamp<qint64>(static_cast<qint64>(roi.left) - assembler.x, 0, last);
+        last = std::clamp<qint64>(static_cast<qint64>(roi.right) - assembler.x, first, last);
+    }
+
+    if (last > first)
+    {
+        const qint64 keepOffset = offset + first * static_cast<qint64>(UINT16_SIZE);
+
+        // A NOP or unknown marker between two runs breaks stream contiguity.
+        if (assembler.currentSeg.offset >= 0 && keepOffset != assembler.currentSeg.offset + 2 * static_cast<qint64>(assembler.currentSeg.pixelCount))
+            assembler.flushSegment();
+        if (assembler.currentSeg.offset < 0)
+        {
+            assembler.currentSeg.xStart = assembler.x + static_cast<int>(first);
+            assembler.currentSeg.offset = keepOffset;
+        }
+        assembler.currentSeg.pixelCount += static_cast<int>(last - first);
+    }
+    assembler.x += static_cast<int>(count);
+}
+
+void ImageDecoder::finish()
+{
+	// If stream ended without explicit IMAGE_END, still flush whatever we parsed.
+    (this->*m_flushFn)();
+    finishSlots();
+    m_parsingPixels = false;
+
+    if (m_pendingConfig)
+    {
+        if (m_options.collectStats)
+            m_stats.truncatedJson++;
+        m_pendingConfig = false;
+    }
+}
+
+std::vector<int> ImageDecoder::takeFinishedSlots()
+{
+    std::vector<int> finished;
+    for (int i = 0; i < static_cast<int>(m_slots.size()); ++i)
+    {
+        Slot& slot = m_slots[i];
+        if (slot.finished && !slot.reported)
+        {
+            slot.reported = true;
+            finished.push_back(i);
+        }
+    }
+    return finished;
+}
+
+ImageFramePtr ImageDecoder::createFrame(const ImageStream& stream, int slot) const
+{
+    if (slot < 0 || slot >= static_cast<int>(m_slots.size()))
+        return {};
+
+    return (this->*m_frameFn)(stream, slot);
+}
+
+bool ImageDecoder::streamBounds(int slotIndex, int& left, int& right) const
+{
+    if (slotIndex < 0 || slotIndex >= static_cast<int>(m_slots.size()))
+        return false;
+
+    const Slot& slot = m_slots[slotIndex];
+    left = slot.left;
+    right = slot.right != std::numeric_limits<int>::max() ? slot.right : m_pixLine > 0 ? m_pixLine : slot.right;
+    if (m_roiActive)
+    {
+        left = std::max(left, m_options.roi.left);
+        right = std::min(right, m_options.roi.right);
+    }
+    return right != std::numeric_limits<int>::max() && right > left;
+}
+
+bool ImageDecoder::slotLines(int slotIndex, int& firstLine, int& lastLine) const
+{
+    if (slotIndex < 0 || slotIndex >= static_cast<int>(m_slots.size()) || m_slots[slotIndex].firstLine < 0)
+        return false;
+
+    firstLine = m_slots[slotIndex].firstLine;
+    lastLine = m_slots[slotIndex].lastLine;
+    return true;
+}
+
+int ImageDecoder::finalLineCount() const
+{
+    int count = lineCount();
+    const FlatFieldCorrection* correction = m_options.correction.data();
+    if (m_complete || !correction)
+        return count;
+    while (count > m_lineBase && correction->isBadLine(scanLine(count - 1).row))
+        --count;
+    return count;
+}
+
+void ImageDecoder::assembleLine(const ImageStream& stream, int line, int left, int right, uint16_t* dst) const
+{
+    (this->*m_rowFn)(stream, scanLine(line), left, right, dst);
+}
+
+void ImageDecoder::release(ImageStream& stream, int line)
+{
+    line = std::min(line, lineCount());
+    // A bad line is rebuilt from the nearest good line above it.
+    if (const FlatFieldCorrection* correction = m_options.correction.data())
+    {
+        --line;
+        while (line > m_lineBase && correction->isBadLine(scanLine(line).row))
+            --line;
+    }
+    if (line <= m_lineBase)
+        return;
+
+    // The remaining lines move to the front; later lines reuse the capacity.
+    std::pmr::vector<ScanLine>& image = m_assembler.image;
+    image.erase(image.begin(), image.begin() + (line - m_lineBase));
+    m_lineBase = line;
+
+    // Lines and segments are in stream order: the first one still stored holds the lowest offset.
+    qint64 keep = m_position;
+    for (const ScanLine& stored : image)
+    {
+        if (!stored.segments.empty())
+        {
+            keep = std::min(keep, stored.segments.front().offset);
+            break;
+        }
+    }
+    if (!m_assembler.currentLine.segments.empty())
+        keep = std::min(keep, m_assembler.currentLine.segments.front().offset);
+    if (m_assembler.currentSeg.offset >= 0)
+        keep = std::min(keep, m_assembler.currentSeg.offset);
+    stream.release(keep);
+}
+
+template <class Crop>
+bool ImageDecoder::frameBounds(const Slot& slot, int& minLeft, int& maxRight) const
+{
+    if (slot.firstLine < 0)
+        return false;
+
+    minLeft = std::numeric_limits<int>::max();
+    maxRight = 0;
+
+    // Calculate bounding box (crop empty space) inside the slot band
+    for (int y = slot.firstLine; y <= slot.lastLine; ++y)
+    {
+		for (const auto& seg : scanLine(y).segments)
+		{
+			const int left = std::max(seg.xStart, slot.left);
+			const int right = std::min(seg.xStart + seg.pixelCount, slot.right);
+			if (right <= left)
+				continue;
+			minLeft = std::min(minLeft, left);
+			maxRight = std::max(maxRight, right);
+		}
+    }
+
+    if (maxRight == 0) // No pixels found
+        return false;
+
+    if constexpr (!Crop::crop)
+    {
+        // Keep the slot band, or the declared line width for an unsplit image.
+        minLeft = slot.left;
+        if (slot.right != std::numeric_limits<int>::max())
+            maxRight = slot.right;
+        else if (m_pixLine > 0)
+            maxRight = std::max(maxRight, m_pixLine);
+
+        if (m_roiActive)
+        {
+            minLeft = std::max(minLeft, m_options.roi.left);
+            maxRight = std::min(maxRight, m_options.roi.right);
+        }
+    }
+    return true;
+}
+
+template <class Pixel>
+void ImageDecoder::assembleRow(const ImageStream& stream, const ScanLine& line, int minLeft, int maxRight, uint16_t* dst) const
+{
+    const int index = m_lineBase + static_cast<int>(&line - m_assembler.image.data());
+    if (m_options.correction && m_options.correction->isBadLine(line.row))
+        repairLine<Pixel>(stream, index, minLeft, maxRight, dst);
+    else
+        readRow<Pixel>(stream, index, minLeft, maxRight, dst);
+}
+
+template <class Pixel>
+void ImageDecoder::readRow(const ImageStream& stream, int index, int minLeft, int maxRight, uint16_t* dst) const
+{
+	std::fill(dst, dst + (maxRight - minLeft), 0xFFFF); // initialize to white
+
+	// The calibration is in detector units, so it applies before scaling.
+	const FlatFieldCorrection* correction = m_options.correction.data();
+	const uint16_t limit = m_bitsStored > 0 && m_bitsStored < 16 ? static_cast<uint16_t>((1 << m_bitsStored) - 1) : 0xFFFF;
+
+	const ScanLine& line = scanLine(index);
+	for (const auto& seg : line.segments)
+	{
+		if (seg.offset < 0 || seg.pixelCount <= 0)
+			continue;
+
+		// Clip the segment to the slot band and the bounding box.
+		const int left = std::max(seg.xStart, minLeft);
+		const int right = std::min(seg.xStart + seg.pixelCount, maxRight);
+		if (right <= left)
+			continue;
+
+		const qint64 srcOffset = seg.offset + static_cast<qint64>(left - seg.xStart) * UINT16_SIZE;
+		stream.read(srcOffset, dst + (left - minLeft), static_cast<qint64>(right - left) * UINT16_SIZE);
+		if (correction)
+			correction->apply(dst + (left - minLeft), left, right - left, limit);
+		Pixel::convert(dst + (left - minLeft), static_cast<size_t>(right - left), m_pixelShift);
+	}
+
+	if (correction)
+		correction->repair(dst, minLeft, maxRight, line.row);
+}
+
+template <class Pixel>
+void ImageDecoder::repairLine(const ImageStream& stream, int index, int minLeft, int maxRight, uint16_t* dst) const
+{
+    const FlatFieldCorrection& correction = *m_options.correction;
+    const int lineCount = this->lineCount();
+    int above = index - 1;
+    while (above >= m_lineBase && correction.isBadLine(scanLine(above).row))
+        --above;
+    int below = index + 1;
+    while (below < lineCount && correction.isBadLine(scanLine(below).row))
+        ++below;
+
+    // Callers wait for the good line below (finalLineCount()); only at the ends of the plate is one side missing.
+    if (above < m_lineBase && below >= lineCount)
+    {
+        readRow<Pixel>(stream, index, minLeft, maxRight, dst);
+        return;
+    }
+    if (above < m_lineBase || below >= lineCount)
+    {
+        readRow<Pixel>(stream, above >= m_lineBase ? above : below, minLeft, maxRight, dst);
+        return;
+    }
+
+    std::vector<uint16_t> other(static_cast<size_t>(maxRight - minLeft));
+    readRow<Pixel>(stream, above, minLeft, maxRight, dst);
+    readRow<Pixel>(stream, below, minLeft, maxRight, other.data());
+    for (size_t x = 0; x < other.size(); ++x)
+        dst[x] = static_cast<uint16_t>((dst[x] + other[x] + 1) / 2);
+}
+
+template <class Pixel, class Crop>
+ImageFramePtr ImageDecoder::assembleFrame(const ImageStream& stream, int slotIndex) const
+{
+    const Slot& slot = m_slots[slotIndex];
+    int minLeft = 0;
+    int maxRight = 0;
+    if (!frameBounds<Crop>(slot, minLeft, maxRight))
+        return {};
+
+    QSharedPointer<ImageFrame> frame(new ImageFrame);
+    frame->width = maxRight - minLeft;
+    frame->height = slot.lastLine - slot.firstLine + 1;
+    frame->slot = slotIndex;
+    frame->slotCount = static_cast<int>(m_slots.size());
+    frame->bitsStored = frameBitsStored();
+    frame->stats = m_stats;
+    frame->metadata = m_metadata;
+	uint16_t* pixels = frame->allocatePixels();
+
+    for (int y = 0; y < frame->height; ++y)
+        assembleRow<Pixel>(stream, scanLine(slot.firstLine + y), minLeft, maxRight, pixels + static_cast<size_t>(y) * frame->width);
+    return frame;
+}
+
+void ImageDecoder::logSummary() const
+{
+    if (!m_options.collectStats)
+        return;
+
+    QString widths;
+    for (const auto& [endX, count] : m_stats.widthHistogram)
+        widths += (widths.isEmpty() ? "" : " ") + QString::number(endX) + ":" + QString::number(count);
+
+    const QString summary = "Decode summary: lines=" + QString::number(m_stats.lineCount) +
+        " widths={" + widths + "}" +
+        " pixLine=" + QString::number(m_pixLine) +
+        " mismatches=" + QString::number(m_stats.widthMismatches) +
+        " unknownMarkers=" + QString::number(m_stats.unknownMarkers) +
+        " gapPixels=" + QString::number(m_stats.gapPixels) +
+        " clippedPixels=" + QString::number(m_stats.clippedPixels) +
+        " truncatedJson=" + QString::number(m_stats.truncatedJson);
+
+    if (m_stats.widthMismatches == 0 && m_stats.unknownMarkers == 0 && m_stats.truncatedJson == 0 && m_stats.clippedPixels == 0)
+    {
+        m_logger.message(summary);
+        return;
+    }
+    m_logger.warning(summary);
+
+    if (m_stats.mismatchSamples.empty())
+        return;
+
+    QString sample;
+    for (const auto& line : m_stats.mismatchSamples)
+        sample += " [line=" + QString::number(line.line) + " endX=" + QString::number(line.endX) +
+            " segments=" + QString::number(line.segments) + "]";
+    m_logger.warning("Scanline width mismatch sample:" + sample);
+}
+
+void ImageDecoder::configureSlots()
+{
+    if (!isEmpty())
+    {
+        m_logger.warning("Slot layout received after image lines, keeping current layout");
+        return;
+    }
+
+    if (m_slotCount <= 1)
+    {
+        m_slots.assign(1, Slot());
+        return;
+    }
+
+    if (m_pixLine <= 0)
+    {
+        m_logger.warning("SlotCount=" + QString::number(m_slotCount) + " without PixLine, slots are not split");
+        m_slots.assign(1, Slot());
+        return;
+    }
+
+    // Slots share the scan line in equally wide bands.
+    m_slots.assign(m_slotCount, Slot());
+    for (int i = 0; i < m_slotCount; ++i)
+    {
+        m_slots[i].left = i * m_pixLine / m_slotCount;
+        m_slots[i].right = (i + 1) * m_pixLine / m_slotCount;
+    }
+    m_logger.message("Splitting image into " + QString::number(m_slotCount) + " slots of " +
+        QString::number(m_pixLine / m_slotCount) + " pixels");
+}
+
+template <class Stats>
+void ImageDecoder::flushLine()
+{
+    if (!m_assembler.inLine)
+        return;
+
+    const size_t lineCount = m_assembler.image.size();
+    const int endX = m_assembler.x;
+    // A row of the region keeps its place as a white row when none of its pixels fell inside the ROI columns.
+    const DecodeRoi& roi = m_options.roi;
+    const bool roiRow = m_roiActive && m_lineHasPixels && m_rowIndex >= roi.firstRow && m_rowIndex < roi.lastRow;
+    m_assembler.flushLine();
+    if (roiRow && m_assembler.image.size() == lineCount)
+        m_assembler.image.push_back(ScanLine{ std::pmr::vector<PixelSegment>(m_arena.resource()), endX });
+    if (m_assembler.image.size() > lineCount)
+        m_assembler.image.back().row = m_rowIndex;
+
+    if (m_lineHasPixels)
+        m_rowIndex++;
+    m_lineHasPixels = false;
+
+    // Lines without pixels (outside the region) are not stored but still count towards ending a slot.
+    const ScanLine* line = m_assembler.image.size() > lineCount ? &m_assembler.image.back() : nullptr;
+    const int lineIndex = m_lineBase + static_cast<int>(m_assembler.image.size()) - 1;
+
+    if constexpr (Stats::enabled)
+    {
+        if (line)
+            recordLine(*line, lineIndex);
+    }
+    const bool split = m_slots.size() > 1;
+
+
+    for (Slot& slot : m_slots)
+    {
+        if (slot.finished)
+            continue;
+
+        // Every row of the region belongs to the slots overlapping its columns, with or without pixels.
+        bool hit = roiRow && slot.left < roi.right && slot.right > roi.left;
+        if (line && !hit)
+        {
+            for (const auto& seg : line->segments)
+            {
+                if (seg.xStart < slot.right && seg.xStart + seg.pixelCount > slot.left)
+                {
+                    hit = true;
+                    break;
+                }
+            }
+        }
+
+        if (hit)
+        {
+            if (slot.firstLine < 0)
+                slot.firstLine = lineIndex;
+            slot.lastLine = lineIndex;
+            slot.emptyLines = 0;
+        }
+        else if (split && slot.firstLine >= 0 && ++slot.emptyLines >= SLOT_END_EMPTY_LINES)
+        {
+            slot.finished = true;
+        }
+    }
+
+    if (m_roiActive && !m_roiDone && m_rowIndex >= m_options.roi.lastRow)
+    {
+        // Nothing below the region is needed: emit the frames now.
+        m_roiDone = true;
+        finishSlots();
+    }
+}
+
+void ImageDecoder::recordLine(const ScanLine& line, int lineIndex)
+{
+    m_stats.lineCount++;
+    m_stats.widthHistogram[line.endX]++;
+    if (m_pixLine > 0 && line.endX != m_pixLine)
+    {
+        m_stats.widthMismatches++;
+        if (static_cast<int>(m_stats.mismatchSamples.size()) < DECODE_STATS_SAMPLE_LINES)
+            m_stats.mismatchSamples.push_back({ lineIndex, line.endX, static_cast<int>(line.segments.size()) });
+    }
+}
+
+void ImageDecoder::finishSlots()
+{
+    for (Slot& slot : m_slots)
+    {
+        if (slot.firstLine >= 0)
+            slot.finished = true;
+    }
+}
+
+void ImageDecoder::parseJsonConfig(const QByteArray& jsonData)
+{
+    // Device JSON strings may contain 8-bit characters; the extractor reads them as Latin-1 in place.
+    const QUuid plateId = m_metadata.plateId;
+    const QDateTime scanTime = m_metadata.scanTime;
+    m_metadata = ImageMetadata::fromJson(jsonData);
+    m_metadata.plateId = plateId;
+    m_metadata.scanTime = scanTime;
+    if (!m_metadata.valid)
+        m_logger.warning("JSON parse failed, using the fields read before the error");
+#ifdef _DEBUG
+    m_logger.message("Image JSON: " + QString::fromLatin1(m_metadata.json));
+#endif
+
+    // Fields the header does not announce keep the geometry of the acquisition mode.
+    if (m_metadata.pixLine < 0)
+        m_metadata.pixLine = m_modeDefaults.pixLine;
+    if (m_metadata.slotCount < 0)
+        m_metadata.slotCount = m_modeDefaults.slotCount;
+    if (m_metadata.bitsStored <= 0)
+        m_metadata.bitsStored = m_modeDefaults.bitsStored;
+    if (m_metadata.pixelSpacingX <= 0.0 && m_metadata.pixelSpacingY <= 0.0)
+    {
+        m_metadata.pixelSpacingX = m_modeDefaults.pixelSpacingX;
+        m_metadata.pixelSpacingY = m_modeDefaults.pixelSpacingY;
+    }
+    if (m_metadata.mode.isEmpty())
+        m_metadata.mode = m_modeDefaults.mode;
+    m_logger.message(m_metadata.summary());
+
+	m_pixLine = m_metadata.pixLine;
+	m_slotCount = m_metadata.slotCount;
+	m_bitsStored = m_metadata.bitsStored;
+	configureSlots();
+	selectPolicies();
+}
@@ -0,0 +1,351 @@
+#pragma once
+
+#include "AcquisitionArena.h"
+#include "CR35Utils.h"
+#include "DecodePolicy.h"
+#include "FlatFieldCorrection.h"
+#include "ImageFrame.h"
+#include "ImageMetadata.h"
+#include "ImageStream.h"
+#include "Logger.h"
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+
+/**
+ * @brief Region of interest restricting which pixels the decoder keeps.
+ *
+ * Rows count the scan lines that carry pixels, i.e. the rows of the
+ * unrestricted frame; columns are line coordinates (0 .. `PixLine`).
+ * Every row of the range is kept, as a white row when none of its pixels
+ * falls inside the columns, so rows never shift.
+ */
+struct DecodeRoi {
+	int firstRow = 0; ///< First row to keep.
+	int lastRow = std::numeric_limits<int>::max(); ///< One past the last row to keep.
+	int left = 0; ///< First column to keep.
+	int right = std::numeric_limits<int>::max(); ///< One past the last column to keep.
+
+	/**
+	 * @brief Whether the region covers the whole image.
+	 */
+	bool isFull() const
+	{
+		return firstRow <= 0 && lastRow == std::numeric_limits<int>::max() && left <= 0 && right == std::numeric_limits<int>::max();
+	}
+};
+
+/**
+ * @brief Per-acquisition decoder configuration.
+ */
+struct DecoderOptions {
+	bool strict = false; ///< Drop pixels beyond `PixLine` (DecodePolicy::Strict) instead of keeping them as before; clipped pixels are counted and logged.
+	bool collectStats = true; ///< Maintain DecodeStats counters.
+	bool crop = true; ///< Crop frames to the pixel bounding box instead of the full slot or line width.
+	bool scaleToBitsStored = false; ///< Scale `BitsStored`-bit values to the full 16-bit range.
+	DecodeRoi roi; ///< Region kept in the output frames.
+	QSharedPointer<const FlatFieldCorrection> correction; ///< Calibration applied to every assembled row, or null.
+};
+
+/**
+ * @brief Incremental decoder for the marker-based `ImageData` stream.
+ *
+ * The decoder is fed the growing ImageStream after every `ImageData`
+ * reply and resumes parsing where the previous call stopped. Markers whose
+ * arguments have not fully arrived yet are left unconsumed until more data
+ * is available. Decoding completes the moment DATA_MARKER_IMAGE_END is
+ * parsed, independently of the polled device state.
+ *
+ * When the JSON header reports `AdditionalScanInfo.SlotCount` > 1, the
+ * scan line (`PixLine` wide) is divided into equally wide slot bands and
+ * every slot is cut into its own frame. A slot is finished as soon as
+ * SLOT_END_EMPTY_LINES consecutive lines carry no pixels in its band, so
+ * its frame can be emitted while other slots are still being scanned.
+ *
+ * The parse loop and the frame assembly are templates over DecodePolicy
+ * types. The instantiation matching DecoderOptions and the JSON header is
+ * selected once per acquisition (on reset(), setOptions() and when the
+ * header arrives) and called through a member function pointer.
+ *
+ * With a DecodeRoi set, pixels outside the region are never added to a
+ * segment, and once the last row of interest has been flushed all slots
+ * are finished and the rest of the stream is only scanned for the end
+ * marker.
+ *
+ * With a FlatFieldCorrection set, every row is corrected while it is
+ * assembled, whether for a frame, a streamed export or a line block, so
+ * corrected pixels never need a second pass.
+ */
+class ImageDecoder {
+public:
+    /**
+     * @brief Construct a decoder.
+     * @param logger Logger used for protocol warnings and JSON diagnostics.
+     */
+    explicit ImageDecoder(Logger& logger);
+
+    /**
+     * @brief Discard all decoded lines and start a new image.
+     *
+     * Options passed to setOptions() during the previous image take effect
+     * here. The scan line arena is released in one step and its allocation
+     * counts are logged.
+     */
+    void reset();
+
+    /**
+     * @brief Set decoding options and reselect the policy instantiation.
+     *
+     * While an image is being decoded, the options are kept until the next
+     * reset(), so a flat-field correction or ROI never changes mid-image.
+     * @param options Options for the following acquisitions.
+     */
+    void setOptions(const DecoderOptions& options);
+
+    /**
+     * @brief Preconfigure the geometry of the following images.
+     *
+     * Applied from the next reset() on, so the slot layout and bit depth are known
+     * before the first pixel arrives. Fields present in the image JSON
+     * header override the defaults; missing ones keep them.
+     *
+     * @param defaults Geometry of the acquisition mode (see AcquisitionMode::defaults()).
+     */
+    void setModeDefaults(const ImageMetadata& defaults);
+    const DecoderOptions& options() const { return m_nextOptions; } ///< Decoding options last set (those of the next image while one is decoded).
+
+    /**
+     * @brief Decode all complete tokens appended to the stream since the last call.
+     * @param stream Stream holding the raw image data. Must be the same stream
+     *               (grown by appends only) until reset() is called.
+     * @return true once the image end marker has been decoded.
+     */
+    bool decode(const ImageStream& stream);
+
+    /**
+     * @brief Close the image when the stream ended without an end marker.
+     *
+     * Flushes any open scan line and finishes all slots so that partially
+     * received images can still be assembled.
+     */
+    void finish();
+
+    bool isComplete() const { return m_complete; } ///< Whether the image end marker was decoded.
+    bool isEmpty() const { return lineCount() == 0 && !m_assembler.inLine; } ///< Whether no scan line has been started yet.
+    qint64 position() const { return m_position; } ///< Stream offset up to which data has been consumed.
+    int pixLine() const { return m_pixLine; } ///< Expected line width from the JSON header, or <= 0 when unknown.
+    int lineCount() const { return m_lineBase + static_cast<int>(m_assembler.image.size()); } ///< Scan lines stored so far, released ones included.
+    const ScanLine& scanLine(int index) const { return m_assembler.image[index - m_lineBase]; } ///< Stored scan line; @p index must not be released.
+    int releasedLines() const { return m_lineBase; } ///< Lines freed by release(); they can no longer be assembled.
+
+    /**
+     * @brief Stored lines whose rows are final.
+     *
+     * A bad line of the flat-field correction is rebuilt from the good lines
+     * above and below it, so trailing bad lines are held back until the next
+     * good line is stored or the image ends. Consumers that read lines while
+     * they are decoded (streaming export, live preview) stop here, so they
+     * get the same rows as the frame.
+     */
+    int finalLineCount() const;
+    const AcquisitionArena& arena() const { return m_arena; } ///< Allocation counters of the current image.
+    int slotCount() const { return static_cast<int>(m_slots.size()); } ///< Number of slot bands the stream is split into.
+    const DecodeStats& stats() const { return m_stats; } ///< Counters collected since reset().
+    const ImageMetadata& metadata() const { return m_metadata; } ///< JSON header of the current image (empty until it arrives).
+
+    /**
+     * @brief Log a single summary of the decode statistics.
+     *
+     * Emits one line with all counters and, when scan lines did not match
+     * `PixLine`, one more line with a sample of the offending lines.
+     */
+    void logSummary() const;
+
+    /**
+     * @brief Return slots that finished since the last call.
+     *
+     * Each slot is reported exactly once, either while the stream is still
+     * being decoded or when the image is completed.
+     *
+     * @return Zero-based indices of newly finished slots.
+     */
+    std::vector<int> takeFinishedSlots();
+
+    /**
+     * @brief Assemble the decoded lines of one slot into a bounding-boxed 16-bit frame.
+     * @param stream Stream the lines were decoded from.
+     * @param slot Zero-based slot index.
+     * @return Shared frame, or a null pointer when the slot contains no pixels.
+     */
+    ImageFramePtr createFrame(const ImageStream& stream, int slot = 0) const;
+
+    /**
+     * @brief Column range of a slot for rows streamed while decoding.
+     *
+     * Unlike the frame bounding box it does not depend on decoded pixels:
+     * it is the slot band, or [0, `PixLine`) for an unsplit image, limited
+     * to the DecodeRoi columns. DecoderOptions::crop does not apply.
+     *
+     * @return false while the width is unknown (no `PixLine` and no ROI right edge).
+     */
+    bool streamBounds(int slot, int& left, int& right) const;
+
+    /**
+     * @brief Stored lines that belong to a slot so far.
+     *
+     * Lines in the range are final and map to frame rows one to one. The
+     * range only grows while the slot is unfinished; lines after lastLine
+     * without pixels in the slot band may still be added to it later.
+     *
+     * @return false while the slot has no pixels.
+     */
+    bool slotLines(int slot, int& firstLine, int& lastLine) const;
+
+    /**
+     * @brief Assemble one stored line clipped to [left, right) into a white-filled row.
+     * @param stream Stream the lines were decoded from.
+     * @param line Index of a stored line (see scanLine()).
+     * @param left First column.
+     * @param right One past the last column.
+     * @param dst Destination for right - left pixels.
+     */
+    void assembleLine(const ImageStream& stream, int line, int left, int right, uint16_t* dst) const;
+
+    /**
+     * @brief Drop the stored lines before a line and the stream chunks only they referenced.
+     *
+     * For callers that consume lines while they are decoded (streaming
+     * export, live preview), so memory does not grow with the plate. Line
+     * indices stay absolute; the lines a bad-line repair may still read are
+     * kept. Released lines can no longer be assembled, so createFrame() must
+     * not be called for the current image afterwards.
+     *
+     * @param stream Stream the lines were decoded from.
+     * @param line First line that will still be assembled.
+     */
+    void release(ImageStream& stream, int line);
+
+    int frameBitsStored() const { return m_pixelShift > 0 ? 16 : m_bitsStored; } ///< `BitsStored` of the frames of the current image.
+
+private:
+    /**
+     * @brief Column band and line range of one slot.
+     */
+    struct Slot {
+        int left = 0; ///< First column of the slot band.
+        int right = std::numeric_limits<int>::max(); ///< One past the last column of the slot band.
+        int firstLine = -1; ///< Index of the first line with pixels in the band (-1 = none yet).
+        int lastLine = -1; ///< Index of the last line with pixels in the band.
+        int emptyLines = 0; ///< Consecutive lines without pixels in the band since lastLine.
+        bool finished = false; ///< Whether no further lines can belong to the slot.
+        bool reported = false; ///< Whether the slot was returned by takeFinishedSlots().
+    };
+
+	/**
+	 * @brief Parse JSON configuration data from the device.
+	 *
+	 * Extracts the ImageMetadata and updates the expected line width and
+	 * the slot layout.
+	 *
+     * @param jsonData Raw JSON data received from the device.
+	 */
+	void parseJsonConfig(const QByteArray& jsonData);
+
+    using DecodeFn = bool (ImageDecoder::*)(const ImageStream&); ///< Selected parse loop.
+    using FlushFn = void (ImageDecoder::*)(); ///< Selected line flush.
+    using FrameFn = ImageFramePtr (ImageDecoder::*)(const ImageStream&, int) const; ///< Selected frame assembly.
+    using RowFn = void (ImageDecoder::*)(const ImageStream&, const ScanLine&, int, int, uint16_t*) const; ///< Selected row assembly.
+
+    void selectPolicies(); ///< Pick the template instantiations for the current options and JSON header.
+
+    /**
+     * @brief Parse loop specialized for a validation and a statistics policy.
+     * @return true once the image end marker has been decoded.
+     */
+    template <class Validation, class Stats>
+    bool decodeWords(const ImageStream& stream);
+
+    /**
+     * @brief Append a run of pixel words to the open segment.
+     * @param offset Stream offset of the first pixel word.
+     * @param count Number of pixel words in the run.
+     */
+    template <class Validation, class Stats>
+    void appendPixels(qint64 offset, qint64 count);
+
+    /**
+     * @brief Flush the open scan line and update slot progress.
+     */
+    template <class Stats>
+    void flushLine();
+
+    /**
+     * @brief Compute the column range of a slot's frame.
+     * @return false when the slot contains no pixels.
+     */
+    template <class Crop>
+    bool frameBounds(const Slot& slot, int& minLeft, int& maxRight) const;
+
+    /**
+     * @brief Assemble one scan line clipped to [minLeft, maxRight) into a white-filled row.
+     *
+     * Lines listed as bad by the correction are rebuilt from their neighbours.
+     */
+    template <class Pixel>
+    void assembleRow(const ImageStream& stream, const ScanLine& line, int minLeft, int maxRight, uint16_t* dst) const;
+
+    /**
+     * @brief Read and correct the segments of one scan line into a white-filled row.
+     * @param index Index of a stored line.
+     */
+    template <class Pixel>
+    void readRow(const ImageStream& stream, int index, int minLeft, int maxRight, uint16_t* dst) const;
+
+    /**
+     * @brief Replace a bad line by the mean of the nearest good stored lines above and below.
+     * @param index Index of the bad line.
+     */
+    template <class Pixel>
+    void repairLine(const ImageStream& stream, int index, int minLeft, int maxRight, uint16_t* dst) const;
+
+    /**
+     * @brief Frame assembly specialized for an output pixel and a crop policy.
+     */
+    template <class Pixel, class Crop>
+    ImageFramePtr assembleFrame(const ImageStream& stream, int slot) const;
+
+    void configureSlots(); ///< Split the line into slot bands based on m_pixLine and m_slotCount.
+    void recordLine(const ScanLine& line, int lineIndex); ///< Update line statistics for a flushed line.
+    void finishSlots(); ///< Mark every slot that received pixels as finished.
+
+    AcquisitionArena m_arena; ///< Backs the scan lines and segments of the current image.
+    LineAssembler m_assembler; ///< Line/segment assembly state carried across decode calls.
+    int m_lineBase = 0; ///< Index of m_assembler.image.front(); lines before it were released.
+    qint64 m_position = 0; ///< Stream offset of the next unparsed word.
+    bool m_parsingPixels = false; ///< Whether pixel words are currently expected.
+    bool m_complete = false; ///< Whether DATA_MARKER_IMAGE_END has been decoded.
+    bool m_pendingConfig = false; ///< Whether decoding stopped inside an incomplete JSON block.
+    bool m_lineHasPixels = false; ///< Whether the open line carried any pixel, kept or not.
+    int m_rowIndex = 0; ///< Number of flushed lines that carried pixels (row coordinate of the open line).
+    bool m_roiActive = false; ///< Whether m_options.roi restricts the output.
+    bool m_roiDone = false; ///< Whether the last row of interest has been flushed.
+    int m_pixLine = 0; ///< Expected line width from the JSON header.
+    int m_slotCount = 1; ///< Slot count from the JSON header.
+    int m_bitsStored = 0; ///< Bits per pixel from the JSON header (0 = unknown).
+    int m_pixelShift = 0; ///< Left shift applied by DecodePolicy::ScaledPixels.
+    ImageMetadata m_metadata; ///< Typed JSON header; copied into every frame.
+    ImageMetadata m_modeDefaults; ///< Geometry of the acquisition mode, applied on reset().
+    std::vector<Slot> m_slots; ///< Slot bands; a single unbounded band when not split.
+    DecodeStats m_stats; ///< Counters for the current image.
+
+    DecoderOptions m_options; ///< Options the policies are selected from.
+    DecoderOptions m_nextOptions; ///< Options set with setOptions(), applied on the next reset().
+    DecodeFn m_decodeFn = nullptr; ///< Parse loop instantiation.
+    FlushFn m_flushFn = nullptr; ///< Line flush instantiation.
+    FrameFn m_frameFn = nullptr; ///< Frame assembly instantiation.
+    RowFn m_rowFn = nullptr; ///< Row assembly instantiation.
+
+    Logger& m_logger; ///< Logger instance for logging messages.
+};
@@ -0,0 +1,113 @@
+#include "ImageExporter.h"
+
+#include <qsavefile.h>
+
+#include "DicomWriter.h"
+#include "PngWriter.h"
+#include "RasterWriter.h"
+#include "TiffWriter.h"
+
+
+bool ImageExporter::write(const ImageFrame& frame, const QString& path, const ExportOptions& options,
+    const ExportProgress& progress, QString* error)
+{
+    if (frame.width <= 0 || frame.height <= 0)
+        return reportError(error, "Empty frame");
+
+    switch (options.format)
+    {
+        case ExportFormat::Tiff:
+        {
+            TiffWriter writer(options.tiffTiles);
+            return writeRaster(frame, path, writer, progress, error);
+        }
+        case ExportFormat::Pgm:
+        {
+            PgmWriter writer;
+            return writeRaster(frame, path, writer, progress, error);
+        }
+        case ExportFormat::Dicom:
+        {
+            DicomWriter writer(options.dicomJpeg);
+            return writeRaster(frame, path, writer, progress, error);
+        }
+        case ExportFormat::Raw:
+        {
+            RawWriter writer;
+            if (!writeRaster(frame, path, writer, progress, error))
+                return false;
+
+            QSaveFile sidecar(RawWriter::sidecarPath(path));
+            if (!sidecar.open(QIODevice::WriteOnly))
+                return reportError(error, sidecar.errorString());
+            const QByteArray json = RawWriter::sidecar(RasterInfo::of(frame));
+            if (sidecar.write(json) != json.size() || !sidecar.commit())
+                return reportError(error, sidecar.errorString());
+            return true;
+        }
+        case ExportFormat::Png:
+        default:
+            return writePng(frame, path, options, progress, error);
+    }
+}
+
+QString ImageExporter::suffix(ExportFormat format)
+{
+    switch (format)
+    {
+        case ExportFormat::Tiff:
+            return "tif";
+        case ExportFormat::Pgm:
+            return "pgm";
+        case ExportFormat::Raw:
+            return "raw";
+        case ExportFormat::Dicom:
+            return "dcm";
+        case ExportFormat::Png:
+        default:
+            return "png";
+    }
+}
+
+QString ImageExporter::baseName(const ImageMetadata& metadata, int slot, int slotCount)
+{
+    const QDateTime time = metadata.scanTime.isValid() ? metadata.scanTime : QDateTime::currentDateTime();
+    const QString name = "CR35_Image_" + time.toString("yyyyMMdd_HHmmss");
+    return slotCount > 1 ? name + QString("_Slot%1").arg(slot + 1) : name;
+}
+
+bool ImageExporter::writePng(const ImageFrame& frame, const QString& path, const ExportOptions& options,
+    const ExportProgress& progress, QString* error)
+{
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly))
+        return reportError(error, file.errorString());
+
+    PngWriter writer(options.compressionLevel, options.threads);
+    if (!writer.write(frame, file, progress))
+    {
+        file.cancelWriting();
+        return reportError(error, writer.errorString());
+    }
+    if (!file.commit())
+        return reportError(error, file.errorString());
+    return true;
+}
+
+bool ImageExporter::writeRaster(const ImageFrame& frame, const QString& path, RasterWriter& writer,
+    const ExportProgress& progress, QString* error)
+{
+    // Unbuffered: the writer already hands over large blocks, another copy would only cost time.
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Unbuffered))
+        return reportError(error, file.errorString());
+
+    if (!writer.writeFrame(frame, file, progress))
+    {
+        file.cancelWriting();
+        return reportError(error, writer.errorString());
+    }
+    if (!file.commit())
+        return reportError(error, file.errorString());
+    return true;
+}
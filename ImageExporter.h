@@ -0,0 +1,88 @@
+#pragma once
+
+#include <qstring.h>
+
+#include "CR35Utils.h"
+#include "ImageFrame.h"
+#include "PreviewExporter.h"
+#include "RasterWriter.h"
+
+#include <functional>
+
+
+/**
+ * @brief File formats frames can be exported to.
+ */
+enum class ExportFormat {
+    Png, ///< 16-bit grayscale PNG, deflated in parallel by PngWriter.
+    Tiff, ///< Uncompressed 16-bit TIFF (BigTIFF past 4 GB), strips or tiles.
+    Pgm, ///< Binary 16-bit PGM.
+    Raw, ///< Headerless little-endian 16-bit pixels with a JSON sidecar.
+    Dicom, ///< DICONDE computed radiography file, uncompressed or lossless JPEG.
+};
+
+/**
+ * @brief Export settings.
+ */
+struct ExportOptions {
+    QString directory; ///< Output directory; the working directory when empty.
+    ExportFormat format = ExportFormat::Png; ///< File format.
+    int compressionLevel = PNG_COMPRESSION_LEVEL_DEFAULT; ///< Deflate level 0..9 (-1 = zlib default) for compressed formats.
+    int threads = 0; ///< Encoder threads per file (0 = QThread::idealThreadCount(), or ExportQueue::threadBudget() in the queue).
+    bool tiffTiles = false; ///< Write TIFF in TIFF_TILE_SIZE tiles instead of strips.
+    bool dicomJpeg = false; ///< Encode DICONDE pixel data as lossless JPEG.
+    bool streaming = false; ///< Write rows while the image is decoded instead of exporting frames (see StreamExporter).
+    PreviewOptions preview; ///< Settings of previews queued with ExportQueue::enqueuePreview().
+};
+
+/**
+ * @brief Progress callback of an export, called with 0..100.
+ */
+using ExportProgress = std::function<void(int percent)>;
+
+/**
+ * @brief Writes ImageFrame pixels to image files.
+ *
+ * All functions are reentrant and only read the frame, so several frames
+ * (or the same frame) can be exported from worker threads at once. Files
+ * are written through QSaveFile: a failed or interrupted export never
+ * leaves a truncated file behind.
+ */
+class ImageExporter {
+public:
+    /**
+     * @brief Write a frame to a file.
+     * @param frame Frame to export.
+     * @param path Target file.
+     * @param options Format and encoder settings (the directory is not used).
+     * @param progress Optional progress callback.
+     * @param error Receives the failure description.
+     * @return false when the file could not be written.
+     */
+    static bool write(const ImageFrame& frame, const QString& path, const ExportOptions& options,
+        const ExportProgress& progress = {}, QString* error = nullptr);
+
+    /**
+     * @brief File name suffix of a format, without the dot.
+     */
+    static QString suffix(ExportFormat format);
+
+    /**
+     * @brief File name of a frame without directory and suffix: one file per scan and slot.
+     *
+     * Named after ImageMetadata::scanTime (the current time when it is not
+     * set), so concurrent exports of consecutive plates never share a file.
+     */
+    static QString baseName(const ImageMetadata& metadata, int slot, int slotCount);
+
+    /**
+     * @brief Whether a format can be written row by row without knowing the height in advance.
+     */
+    static bool canStream(ExportFormat format) { return format != ExportFormat::Dicom; }
+
+private:
+    static bool writePng(const ImageFrame& frame, const QString& path, const ExportOptions& options,
+        const ExportProgress& progress, QString* error);
+    static bool writeRaster(const ImageFrame& frame, const QString& path, RasterWriter& writer,
+        const ExportProgress& progress, QString* error);
+};
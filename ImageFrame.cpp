@@ -0,0 +1,28 @@
+#include "ImageFrame.h"
+
+
+uint16_t* ImageFrame::allocatePixels()
+{
+    const size_t count = static_cast<size_t>(width) * height;
+    const qint64 bytes = static_cast<qint64>(count * sizeof(uint16_t));
+
+    if (!MemoryBudget::instance().fits(bytes))
+    {
+        QSharedPointer<SpillFile> file(new SpillFile(bytes));
+        if (char* region = file->allocate(bytes))
+        {
+            pixels = {};
+            charge.reset();
+            spillFile = file;
+            spilledPixels = reinterpret_cast<uint16_t*>(region);
+            return spilledPixels;
+        }
+        // Spilling failed (e.g. disk full); fall back to the heap.
+    }
+
+    spilledPixels = nullptr;
+    spillFile.reset();
+    pixels.resize(count);
+    charge = MemoryCharge(bytes);
+    return pixels.data();
+}
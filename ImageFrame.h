@@ -0,0 +1,109 @@
+#pragma once
+
+#include <qsharedpointer.h>
+#include <qmetatype.h>
+
+#include "ImageMetadata.h"
+#include "MemoryBudget.h"
+#include "SpillFile.h"
+
+#include <cstdint>
+#include <map>
+#include <vector>
+
+class ImagePyramid;
+class ImageStream;
+
+
+/**
+ * @brief Counters collected while decoding one image stream.
+ *
+ * Replaces per-line logging: the decoder only increments counters on the
+ * hot path and the summary is logged once per image.
+ */
+struct DecodeStats {
+	/**
+	 * @brief A scan line whose width did not match `PixLine`.
+	 */
+	struct LineSample {
+		int line = 0; ///< Line index within the image.
+		int endX = 0; ///< Logical line end position.
+		int segments = 0; ///< Number of pixel segments in the line.
+	};
+
+	int lineCount = 0; ///< Number of scan lines that carried pixels.
+	std::map<int, int> widthHistogram; ///< Line end position -> number of lines.
+	int widthMismatches = 0; ///< Lines whose end position differs from `PixLine`.
+	int unknownMarkers = 0; ///< Control words in 0xFFF9..0xFFFF not handled by the decoder.
+	qint64 gapPixels = 0; ///< Pixels skipped by DATA_MARKER_GAP inside lines.
+	int truncatedJson = 0; ///< JSON blocks cut off by the end of the stream.
+	qint64 clippedPixels = 0; ///< Pixels beyond `PixLine` dropped by strict validation (DecoderOptions::strict).
+	std::vector<LineSample> mismatchSamples; ///< First DECODE_STATS_SAMPLE_LINES mismatching lines.
+};
+
+/**
+ * @brief A decoded, bounding-boxed 16-bit image.
+ *
+ * Frames are immutable once emitted and are shared between the device and
+ * its consumers through ImageFramePtr, so no consumer has to free or copy
+ * the pixel buffer.
+ *
+ * Pixels live on the heap while the MemoryBudget allows it and in a
+ * memory-mapped SpillFile otherwise; consumers read them through data() and
+ * row() either way.
+ */
+struct ImageFrame {
+	std::vector<uint16_t> pixels; ///< Heap pixels, tightly packed row-major (empty when spilled).
+	uint16_t* spilledPixels = nullptr; ///< Pixels mapped from spillFile, or nullptr when on the heap.
+	QSharedPointer<SpillFile> spillFile; ///< Backing file of spilledPixels.
+	MemoryCharge charge; ///< Budget charge of the heap pixels.
+	int width = 0; ///< Width in pixels.
+	int height = 0; ///< Height in pixels.
+	int slot = 0; ///< Zero-based slot index the frame was cut from.
+	int slotCount = 1; ///< Number of slots the stream was split into.
+	int bitsStored = 0; ///< Significant bits per pixel (`BitsStored`, 16 once scaled, 0 = unknown).
+	DecodeStats stats; ///< Stream decode statistics up to the point the frame was cut.
+	ImageMetadata metadata; ///< JSON header of the stream the frame was cut from.
+	QSharedPointer<const ImagePyramid> pyramid; ///< Downsampled levels, when read from a ScanArchive record.
+	QSharedPointer<const ImageStream> rawStream; ///< Raw `ImageData` stream of the plate, on the first frame of a completed image (CR35Device::setKeepRawStream).
+
+	/**
+	 * @brief Allocate width * height pixels on the heap or, past the memory budget, in a spill file.
+	 * @return Writable pixel buffer; its contents are unspecified.
+	 */
+	uint16_t* allocatePixels();
+
+	const uint16_t* data() const { return spilledPixels ? spilledPixels : pixels.data(); } ///< First pixel of the frame.
+	bool isSpilled() const { return spilledPixels != nullptr; } ///< Whether the pixels live in a spill file.
+
+	/**
+	 * @brief Pointer to the first pixel of a row.
+	 * @param y Row index in [0, height).
+	 */
+	const uint16_t* row(int y) const { return data() + static_cast<size_t>(y) * width; }
+};
+
+using ImageFramePtr = QSharedPointer<const ImageFrame>; ///< Shared handle to an emitted frame.
+
+/**
+ * @brief Preview rows of the scan lines decoded since the previous block.
+ *
+ * Lines are box-averaged by @c factor in both directions while they are
+ * assembled, so a block holds at most PREVIEW_MAX_WIDTH pixels per row.
+ * Emitted while an image is being decoded, for consumers that show the
+ * plate as it arrives (see LivePreviewWidget).
+ */
+struct LineBlock {
+	int firstLine = 0; ///< Index of the first preview row within the image (0 starts a new image).
+	int width = 0; ///< Preview row width in pixels.
+	int count = 0; ///< Number of preview rows.
+	int factor = 1; ///< Scan lines and columns averaged per preview pixel.
+	int bitsStored = 0; ///< Significant bits per pixel (16 once scaled, 0 = unknown).
+	bool last = false; ///< Whether the image ended with this block.
+	std::vector<uint16_t> pixels; ///< count * width pixels, tightly packed.
+};
+
+using LineBlockPtr = QSharedPointer<const LineBlock>; ///< Shared handle to an emitted line block.
+
+Q_DECLARE_METATYPE(ImageFramePtr)
+Q_DECLARE_METATYPE(LineBlockPtr)
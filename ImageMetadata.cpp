@@ -0,0 +1,283 @@
+#include "ImageMetadata.h"
+
+#include <qstringlist.h>
+
+
+namespace {
+
+constexpr int MAX_JSON_DEPTH = 32; ///< Nesting limit of the extractor.
+
+/**
+ * @brief Single-pass JSON walker that reports every scalar with its dotted path.
+ */
+class JsonExtractor {
+public:
+    JsonExtractor(const char* data, qsizetype size, ImageMetadata& metadata) :
+        m_p(data), m_end(data + size), m_metadata(metadata) { }
+
+    bool run()
+    {
+        if (!value(QString(), 0))
+            return false;
+        skipSpace();
+        return m_p == m_end;
+    }
+
+private:
+    void skipSpace()
+    {
+        while (m_p < m_end && (*m_p == ' ' || *m_p == '\t' || *m_p == '\r' || *m_p == '\n'))
+            ++m_p;
+    }
+
+    bool value(const QString& path, int depth)
+    {
+        skipSpace();
+        if (m_p >= m_end || depth > MAX_JSON_DEPTH)
+            return false;
+
+        switch (*m_p)
+        {
+            case '{':
+                return object(path, depth);
+            case '[':
+                return array(path, depth);
+            case '"':
+            {
+                QByteArray text;
+                if (!string(text))
+                    return false;
+                scalar(path, QString::fromLatin1(text));
+                return true;
+            }
+            default:
+            {
+                // Number or literal: take the token verbatim.
+                const char* start = m_p;
+                while (m_p < m_end && *m_p != ',' && *m_p != '}' && *m_p != ']' && *m_p != ' ' &&
+                    *m_p != '\t' && *m_p != '\r' && *m_p != '\n')
+                    ++m_p;
+                if (m_p == start)
+                    return false;
+                scalar(path, QString::fromLatin1(start, m_p - start));
+                return true;
+            }
+        }
+    }
+
+    bool object(const QString& path, int depth)
+    {
+        ++m_p; // '{'
+        skipSpace();
+        if (m_p < m_end && *m_p == '}')
+        {
+            ++m_p;
+            return true;
+        }
+        for (;;)
+        {
+            skipSpace();
+            QByteArray key;
+            if (m_p >= m_end || *m_p != '"' || !string(key))
+                return false;
+            skipSpace();
+            if (m_p >= m_end || *m_p++ != ':')
+                return false;
+
+            const QString keyText = QString::fromLatin1(key);
+            if (!value(path.isEmpty() ? keyText : path + "." + keyText, depth + 1))
+                return false;
+
+            skipSpace();
+            if (m_p >= m_end)
+                return false;
+            if (*m_p == ',')
+            {
+                ++m_p;
+                continue;
+            }
+            return *m_p++ == '}';
+        }
+    }
+
+    bool array(const QString& path, int depth)
+    {
+        ++m_p; // '['
+        skipSpace();
+        if (m_p < m_end && *m_p == ']')
+        {
+            ++m_p;
+            return true;
+        }
+        for (int index = 0;; ++index)
+        {
+            if (!value(path + "[" + QString::number(index) + "]", depth + 1))
+                return false;
+
+            skipSpace();
+            if (m_p >= m_end)
+                return false;
+            if (*m_p == ',')
+            {
+                ++m_p;
+                continue;
+            }
+            return *m_p++ == ']';
+        }
+    }
+
+    /**
+     * @brief Read a string literal; escapes are resolved, \\u above 0xFF becomes '?'.
+     */
+    bool string(QByteArray& out)
+    {
+        ++m_p; // opening quote
+        const char* start = m_p;
+        while (m_p < m_end && *m_p != '"' && *m_p != '\\')
+            ++m_p;
+        out = QByteArray(start, m_p - start); // common case: no escapes
+
+        while (m_p < m_end && *m_p != '"')
+        {
+            if (*m_p != '\\')
+            {
+                out.append(*m_p++);
+                continue;
+            }
+            if (++m_p >= m_end)
+                return false;
+            switch (*m_p++)
+            {
+                case 'n': out.append('\n'); break;
+                case 't': out.append('\t'); break;
+                case 'r': out.append('\r'); break;
+                case 'b': out.append('\b'); break;
+                case 'f': out.append('\f'); break;
+                case 'u':
+                {
+                    if (m_end - m_p < 4)
+                        return false;
+                    bool ok = false;
+                    const uint code = QByteArray(m_p, 4).toUInt(&ok, 16);
+                    if (!ok)
+                        return false;
+                    out.append(code <= 0xFF ? static_cast<char>(code) : '?');
+                    m_p += 4;
+                    break;
+                }
+                default: out.append(m_p[-1]); break; // \" \\ \/
+            }
+        }
+        if (m_p >= m_end)
+            return false;
+        ++m_p; // closing quote
+        return true;
+    }
+
+    void scalar(const QString& path, const QString& text)
+    {
+        m_metadata.fields.emplace_back(path, text);
+
+        if (path == "ManufacturerModelName")
+            m_metadata.model = text;
+        else if (path == "BitsStored")
+            m_metadata.bitsStored = text.toInt();
+        else if (path == "AdditionalScanInfo.PixLine")
+            m_metadata.pixLine = text.toInt();
+        else if (path == "AdditionalScanInfo.SlotCount")
+            m_metadata.slotCount = text.toInt();
+        else if (isSpacingField(path, "PixelSpacing") || isSpacingField(path, "ImagerPixelSpacing"))
+            spacing(path, text);
+        else if (isModeField(path))
+            m_metadata.mode = text;
+    }
+
+    /**
+     * @brief Whether a path is the spacing field @p name or one of its array elements.
+     */
+    static bool isSpacingField(const QString& path, const QString& name)
+    {
+        return path == name || path.startsWith(name + "[");
+    }
+
+    /**
+     * @brief Whether a path names the scan mode at the top level or one object deep.
+     */
+    static bool isModeField(const QString& path)
+    {
+        const qsizetype dot = path.lastIndexOf('.');
+        if (dot >= 0 && path.indexOf('.') != dot)
+            return false;
+        const QString name = path.mid(dot + 1);
+        return name == "Mode" || name == "ScanMode" || name == "AcquisitionMode";
+    }
+
+    /**
+     * @brief Take the spacing from a number, an array element or a DICOM "row\\col" string.
+     *
+     * `PixelSpacing` wins over `ImagerPixelSpacing` regardless of order.
+     */
+    void spacing(const QString& path, const QString& text)
+    {
+        const bool imager = path.startsWith("Imager");
+        if (imager && m_pixelSpacingSeen)
+            return;
+        if (!imager && !m_pixelSpacingSeen)
+        {
+            m_pixelSpacingSeen = true;
+            m_metadata.pixelSpacingX = m_metadata.pixelSpacingY = 0.0;
+        }
+
+        const QStringList parts = text.split('\\');
+        const double first = parts.value(0).toDouble();
+        if (path.endsWith("[1]"))
+            m_metadata.pixelSpacingX = first;
+        else
+        {
+            m_metadata.pixelSpacingY = first;
+            // A single value (or the first of a pair) applies to both axes until the column spacing arrives.
+            m_metadata.pixelSpacingX = parts.size() > 1 ? parts.value(1).toDouble() : first;
+        }
+    }
+
+    const char* m_p; ///< Read position.
+    const char* m_end; ///< End of the header.
+    ImageMetadata& m_metadata; ///< Metadata being filled.
+    bool m_pixelSpacingSeen = false; ///< Whether `PixelSpacing` (not the imager variant) was found.
+};
+
+} // namespace
+
+
+ImageMetadata ImageMetadata::fromJson(const char* data, qsizetype size)
+{
+    if (size > 0 && data[size - 1] == '\0')
+        --size;
+
+    ImageMetadata metadata;
+    metadata.json = QByteArray(data, size);
+    metadata.valid = size > 0 && JsonExtractor(data, size, metadata).run();
+    return metadata;
+}
+
+QString ImageMetadata::field(const QString& path) const
+{
+    for (const auto& [key, text] : fields)
+    {
+        if (key == path)
+            return text;
+    }
+    return QString();
+}
+
+QString ImageMetadata::summary() const
+{
+    QString text = "Image header parsed: model='" + model + "' bitsStored=" + QString::number(bitsStored) +
+        " pixLine=" + QString::number(pixLine) + " slotCount=" + QString::number(slotCount);
+    if (pixelSpacingX > 0.0 || pixelSpacingY > 0.0)
+        text += " spacing=" + QString::number(pixelSpacingY) + "x" + QString::number(pixelSpacingX) + "mm";
+    if (!mode.isEmpty())
+        text += " mode='" + mode + "'";
+    text += " fields=" + QString::number(static_cast<int>(fields.size()));
+    return text;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <qbytearray.h>
+#include <qdatetime.h>
+#include <qstring.h>
+#include <quuid.h>
+
+#include <utility>
+#include <vector>
+
+
+/**
+ * @brief Typed view of the JSON header embedded in the `ImageData` stream.
+ *
+ * Filled by fromJson(), a single-pass extractor that walks the raw
+ * Latin-1 bytes directly, without a QString/UTF-8 round trip or a
+ * QJsonDocument. Known fields are converted to typed members; every other
+ * scalar is kept as text in `fields`, so nothing in the header is lost.
+ * The metadata travels with every ImageFrame cut from the stream.
+ */
+struct ImageMetadata {
+	QString model; ///< `ManufacturerModelName`.
+	int bitsStored = 0; ///< `BitsStored` (0 = unknown).
+	int pixLine = -1; ///< `AdditionalScanInfo.PixLine`, the scan line width (-1 = unknown).
+	int slotCount = -1; ///< `AdditionalScanInfo.SlotCount` (-1 = unknown).
+	double pixelSpacingY = 0.0; ///< Row spacing in mm from `PixelSpacing` or `ImagerPixelSpacing` (0 = unknown).
+	double pixelSpacingX = 0.0; ///< Column spacing in mm (0 = unknown).
+	QString mode; ///< Scan mode name or ID (`Mode`, `ScanMode` or `AcquisitionMode`), empty when absent.
+	std::vector<std::pair<QString, QString>> fields; ///< All scalar fields as (dotted path, text) in header order.
+	QByteArray json; ///< Raw header bytes without the trailing NUL.
+	bool valid = false; ///< Whether the header was well-formed JSON.
+	QUuid plateId; ///< Set by ImageDecoder once per acquisition and shared by all its frames (null when read back from JSON).
+	QDateTime scanTime; ///< Set by ImageDecoder when the first bytes of the acquisition are decoded (invalid when read back from JSON).
+
+	/**
+	 * @brief Extract metadata from the raw JSON header.
+	 * @param data Header bytes (Latin-1; a trailing NUL is ignored).
+	 * @param size Number of bytes.
+	 * @return Metadata; `valid` is false when the JSON is malformed (fields seen so far are kept).
+	 */
+	static ImageMetadata fromJson(const char* data, qsizetype size);
+	static ImageMetadata fromJson(const QByteArray& json) { return fromJson(json.constData(), json.size()); } ///< @overload
+
+	/**
+	 * @brief Look up a scalar field by dotted path (e.g. "AdditionalScanInfo.PixLine").
+	 * @return Field text, or a null string when absent.
+	 */
+	QString field(const QString& path) const;
+
+	/**
+	 * @brief One-line description for the log.
+	 */
+	QString summary() const;
+};
@@ -0,0 +1,152 @@
+#include "ImagePyramid.h"
+#include "ImageFrame.h"
+#include "Simd.h"
+
+#include <qthreadpool.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+
+QSharedPointer<const ImagePyramid> ImagePyramid::build(const ImageFrame& frame, int threads)
+{
+    QSharedPointer<ImagePyramid> pyramid(new ImagePyramid);
+    if (frame.width <= 0 || frame.height <= 0)
+        return pyramid;
+    pyramid->layout(frame.width, frame.height, levelCount(frame.width, frame.height));
+
+    QThreadPool pool;
+    setupBandPool(pool, threads);
+
+    // Levels depend on each other; the bands of one level do not.
+    const uint16_t* src = frame.data();
+    int srcWidth = frame.width;
+    int srcHeight = frame.height;
+    for (int level = 1; level <= pyramid->levels(); ++level)
+    {
+        uint16_t* dst = pyramid->m_pixels.data() + pyramid->m_offsets[level - 1];
+        const int dstWidth = pyramid->width(level);
+        const int dstHeight = pyramid->height(level);
+        const int bands = (dstHeight + PYRAMID_BAND_ROWS - 1) / PYRAMID_BAND_ROWS;
+        if (pool.maxThreadCount() == 1 || bands == 1)
+            downsample(src, srcWidth, srcHeight, dst, dstWidth, 0, dstHeight);
+        else
+        {
+            for (int band = 0; band < bands; ++band)
+            {
+                const int first = band * PYRAMID_BAND_ROWS;
+                const int rows = std::min(PYRAMID_BAND_ROWS, dstHeight - first);
+                pool.start([=] { downsample(src, srcWidth, srcHeight, dst, dstWidth, first, rows); });
+            }
+            pool.waitForDone();
+        }
+        src = dst;
+        srcWidth = dstWidth;
+        srcHeight = dstHeight;
+    }
+    return pyramid;
+}
+
+QSharedPointer<const ImagePyramid> ImagePyramid::fromPixels(int width, int height, int levels, const uint16_t* pixels)
+{
+    // Every level halves the larger side, so more levels than bits cannot occur.
+    if (width <= 0 || height <= 0 || levels <= 0 || levels > 31 || !pixels)
+        return {};
+
+    QSharedPointer<ImagePyramid> pyramid(new ImagePyramid);
+    pyramid->layout(width, height, levels);
+    std::copy_n(pixels, pyramid->m_pixels.size(), pyramid->m_pixels.data());
+    return pyramid;
+}
+
+int ImagePyramid::levelCount(int width, int height)
+{
+    int levels = 0;
+    while (width > PYRAMID_MIN_SIZE || height > PYRAMID_MIN_SIZE)
+    {
+        width = (width + 1) / 2;
+        height = (height + 1) / 2;
+        ++levels;
+    }
+    return levels;
+}
+
+qint64 ImagePyramid::pixelCount(int width, int height, int levels)
+{
+    qint64 count = 0;
+    for (int level = 0; level < levels; ++level)
+    {
+        width = (width + 1) / 2;
+        height = (height + 1) / 2;
+        count += static_cast<qint64>(width) * height;
+    }
+    return count;
+}
+
+int ImagePyramid::levelFor(double scale) const
+{
+    const double needed = std::ceil(m_width * scale);
+    int best = 0;
+    for (int level = 1; level <= levels() && width(level) >= needed; ++level)
+        best = level;
+    return best;
+}
+
+void ImagePyramid::layout(int width, int height, int levels)
+{
+    m_width = width;
+    m_height = height;
+    m_widths.clear();
+    m_heights.clear();
+    m_offsets.clear();
+
+    size_t total = 0;
+    for (int level = 0; level < levels; ++level)
+    {
+        width = (width + 1) / 2;
+        height = (height + 1) / 2;
+        m_widths.push_back(width);
+        m_heights.push_back(height);
+        m_offsets.push_back(total);
+        total += static_cast<size_t>(width) * height;
+    }
+    m_pixels.resize(total);
+}
+
+void ImagePyramid::downsample(const uint16_t* src, int srcWidth, int srcHeight, uint16_t* dst, int dstWidth, int firstRow, int rowCount)
+{
+    for (int y = firstRow; y < firstRow + rowCount; ++y)
+    {
+        // An odd last row or column is averaged with itself.
+        const uint16_t* r0 = src + static_cast<size_t>(2 * y) * srcWidth;
+        const uint16_t* r1 = 2 * y + 1 < srcHeight ? r0 + srcWidth : r0;
+        uint16_t* out = dst + static_cast<size_t>(y) * dstWidth;
+
+        int x = 0;
+#ifdef CR35_SSE2
+        // Pair sums through madd on biased samples: (a - 32768) + (b - 32768) fits 32 bits signed,
+        // and the rounded quarter of the four biased samples is the biased average.
+        const __m128i bias = _mm_set1_epi16(static_cast<short>(0x8000));
+        const __m128i ones = _mm_set1_epi16(1);
+        const __m128i two = _mm_set1_epi32(2);
+        for (; 2 * (x + 8) <= srcWidth; x += 8)
+        {
+            const __m128i a0 = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(r0 + 2 * x)), bias);
+            const __m128i a1 = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(r0 + 2 * x + 8)), bias);
+            const __m128i b0 = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(r1 + 2 * x)), bias);
+            const __m128i b1 = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(r1 + 2 * x + 8)), bias);
+            const __m128i s0 = _mm_add_epi32(_mm_madd_epi16(a0, ones), _mm_madd_epi16(b0, ones));
+            const __m128i s1 = _mm_add_epi32(_mm_madd_epi16(a1, ones), _mm_madd_epi16(b1, ones));
+            const __m128i avg = _mm_packs_epi32(_mm_srai_epi32(_mm_add_epi32(s0, two), 2), _mm_srai_epi32(_mm_add_epi32(s1, two), 2));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), _mm_xor_si128(avg, bias));
+        }
+#endif
+        for (; x < dstWidth; ++x)
+        {
+            const int x0 = 2 * x;
+            const int x1 = x0 + 1 < srcWidth ? x0 + 1 : x0;
+            out[x] = static_cast<uint16_t>((r0[x0] + r0[x1] + r1[x0] + r1[x1] + 2) >> 2);
+        }
+    }
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <qsharedpointer.h>
+
+#include "CR35Utils.h"
+
+#include <cstdint>
+#include <vector>
+
+struct ImageFrame;
+
+
+/**
+ * @brief Successively halved copies of a frame for viewing at any zoom.
+ *
+ * Level 0 is the frame itself and is not stored. Every further level is a
+ * 2×2 box (area) average of the level above, rounded to nearest, with odd
+ * edges replicated, until both sides are at most PYRAMID_MIN_SIZE. Together
+ * the levels take a third of the frame's memory.
+ *
+ * Levels are built band by band (PYRAMID_BAND_ROWS output rows) on a
+ * thread pool, with an SSE2 kernel averaging eight output pixels at a time
+ * where available. All levels live in one buffer, so the pyramid can be
+ * stored and restored in one piece (see ScanArchive).
+ */
+class ImagePyramid {
+public:
+    ImagePyramid() = default;
+
+    /**
+     * @brief Build all levels of a frame.
+     * @param frame Source frame (level 0).
+     * @param threads Worker threads; 0 uses QThread::idealThreadCount().
+     * @return Pyramid; without levels when the frame is already small.
+     */
+    static QSharedPointer<const ImagePyramid> build(const ImageFrame& frame, int threads = 0);
+
+    /**
+     * @brief Restore a pyramid from its stored pixels.
+     * @param width Width of the frame (level 0).
+     * @param height Height of the frame (level 0).
+     * @param levels Number of stored levels.
+     * @param pixels Pixels of all levels back to back, as returned by pixels().
+     * @return Null pointer when @p levels does not match the frame size.
+     */
+    static QSharedPointer<const ImagePyramid> fromPixels(int width, int height, int levels, const uint16_t* pixels);
+
+    /**
+     * @brief Number of levels built for a frame size, level 0 not counted.
+     */
+    static int levelCount(int width, int height);
+
+    /**
+     * @brief Pixels of all levels of a frame size, level 0 not counted.
+     */
+    static qint64 pixelCount(int width, int height, int levels);
+
+    int levels() const { return static_cast<int>(m_offsets.size()); } ///< Number of stored levels (level 0 not counted).
+    int width(int level) const { return level == 0 ? m_width : m_widths[level - 1]; } ///< Width of a level.
+    int height(int level) const { return level == 0 ? m_height : m_heights[level - 1]; } ///< Height of a level.
+
+    /**
+     * @brief First pixel of a stored level.
+     * @param level Level in [1, levels()].
+     */
+    const uint16_t* level(int level) const { return m_pixels.data() + m_offsets[level - 1]; }
+
+    /**
+     * @brief First pixel of a row of a stored level.
+     */
+    const uint16_t* row(int level, int y) const { return this->level(level) + static_cast<size_t>(y) * width(level); }
+
+    /**
+     * @brief Smallest stored level that still has at least the requested size (0 = use the frame).
+     * @param scale Displayed size divided by the frame size, e.g. 0.1 for a 10 % view.
+     */
+    int levelFor(double scale) const;
+
+    const std::vector<uint16_t>& pixels() const { return m_pixels; } ///< All levels back to back.
+
+private:
+    /**
+     * @brief Allocate the buffer and the level geometry.
+     */
+    void layout(int width, int height, int levels);
+
+    /**
+     * @brief Average output rows [firstRow, firstRow + rowCount) of a level from the level above.
+     */
+    static void downsample(const uint16_t* src, int srcWidth, int srcHeight, uint16_t* dst, int dstWidth, int firstRow, int rowCount);
+
+    int m_width = 0; ///< Width of level 0.
+    int m_height = 0; ///< Height of level 0.
+    std::vector<int> m_widths; ///< Width of levels 1..n.
+    std::vector<int> m_heights; ///< Height of levels 1..n.
+    std::vector<size_t> m_offsets; ///< Start of levels 1..n in m_pixels.
+    std::vector<uint16_t> m_pixels; ///< Levels 1..n, back to back.
+};
@@ -0,0 +1,160 @@
+#include "ImageStream.h"
+
+#include <algorithm>
+#include <cstring>
+
+
+ImageStream::Reader::Reader(const ImageStream& stream, qint64 pos) : m_stream(stream)
+{
+    seek(pos);
+}
+
+QByteArray ImageStream::Reader::readBytes(qint64 size)
+{
+    QByteArray bytes(size, Qt::Uninitialized);
+    m_stream.read(m_pos, bytes.data(), size);
+    seek(m_pos + size);
+    return bytes;
+}
+
+void ImageStream::Reader::seek(qint64 pos)
+{
+    m_pos = std::min(pos, m_stream.size());
+
+    qint64 available = 0;
+    m_ptr = m_stream.contiguous(m_pos, &available);
+    m_chunkEnd = m_ptr ? m_ptr + available : nullptr;
+}
+
+void ImageStream::append(const char* data, qint64 size)
+{
+    while (size > 0)
+    {
+        const qsizetype used = static_cast<qsizetype>(m_size % CHUNK_SIZE);
+        if (used == 0)
+        {
+            if (!MemoryBudget::instance().fits(CHUNK_SIZE))
+                spillChunks();
+
+            Chunk chunk;
+            chunk.data = QByteArray(CHUNK_SIZE, Qt::Uninitialized);
+            chunk.ptr = chunk.data.constData();
+            chunk.charge = MemoryCharge(CHUNK_SIZE);
+            m_chunks.push_back(std::move(chunk));
+        }
+
+        // Fill the tail chunk up to its fixed capacity; never grow it.
+        const qint64 count = std::min<qint64>(size, CHUNK_SIZE - used);
+        memcpy(m_chunks.back().data.data() + used, data, count);
+
+        data += count;
+        size -= count;
+        m_size += count;
+    }
+}
+
+void ImageStream::clear()
+{
+    m_chunks.clear();
+    m_size = 0;
+    m_releasedChunks = 0;
+    m_spill.reset();
+    m_spillFailed = false;
+}
+
+void ImageStream::release(qint64 offset)
+{
+    const qsizetype chunks = static_cast<qsizetype>(std::min(offset, m_size) / CHUNK_SIZE);
+    for (; m_releasedChunks < chunks; ++m_releasedChunks)
+        m_chunks[m_releasedChunks] = Chunk(); // frees the heap bytes and their budget charge
+}
+
+void ImageStream::truncate(qint64 size)
+{
+    if (size < 0 || size >= m_size)
+        return;
+
+    m_size = std::max(size, released());
+    m_chunks.resize(static_cast<size_t>((m_size + CHUNK_SIZE - 1) / CHUNK_SIZE));
+}
+
+void ImageStream::spillChunks()
+{
+    if (m_spillFailed)
+        return;
+    if (!m_spill)
+        m_spill.reset(new SpillFile);
+
+    // Called before a new chunk starts, so every stored chunk is complete.
+    for (Chunk& chunk : m_chunks)
+    {
+        if (chunk.data.isEmpty())
+            continue;
+
+        const char* mapped = m_spill->store(chunk.data.constData(), CHUNK_SIZE);
+        if (!mapped)
+        {
+            m_spillFailed = true; // keep everything on the heap rather than lose data
+            return;
+        }
+        chunk.ptr = mapped;
+        chunk.data = QByteArray();
+        chunk.charge.reset();
+    }
+}
+
+uint16_t ImageStream::word(qint64 offset) const
+{
+    uint8_t bytes[2];
+    read(offset, bytes, sizeof(bytes));
+    return static_cast<uint16_t>(bytes[0] | (bytes[1] << 8));
+}
+
+void ImageStream::read(qint64 offset, void* dst, qint64 size) const
+{
+    char* out = static_cast<char*>(dst);
+    while (size > 0)
+    {
+        qint64 available = 0;
+        const char* src = contiguous(offset, &available);
+        if (!src)
+            return;
+
+        const qint64 count = std::min(size, available);
+        memcpy(out, src, count);
+
+        out += count;
+        offset += count;
+        size -= count;
+    }
+}
+
+const char* ImageStream::contiguous(qint64 offset, qint64* available) const
+{
+    if (offset < released() || offset >= m_size)
+    {
+        *available = 0;
+        return nullptr;
+    }
+
+    const qsizetype chunk = static_cast<qsizetype>(offset / CHUNK_SIZE);
+    const qsizetype inChunk = static_cast<qsizetype>(offset % CHUNK_SIZE);
+    const qint64 chunkBytes = std::min<qint64>(CHUNK_SIZE, m_size - static_cast<qint64>(chunk) * CHUNK_SIZE);
+
+    *available = chunkBytes - inChunk;
+    return m_chunks[chunk].ptr + inChunk;
+}
+
+bool ImageStream::writeTo(QIODevice& device) const
+{
+    qint64 offset = 0;
+    while (offset < m_size)
+    {
+        qint64 available = 0;
+        const char* src = contiguous(offset, &available);
+        if (!src || device.write(src, available) != available)
+            return false;
+        offset += available;
+    }
+    return true;
+}
@@ -0,0 +1,201 @@
+#pragma once
+
+#include <qbytearray.h>
+#include <qiodevice.h>
+#include <qsharedpointer.h>
+
+#include "MemoryBudget.h"
+#include "SpillFile.h"
+
+#include <cstdint>
+#include <vector>
+
+
+/**
+ * @brief Append-only byte storage for the raw `ImageData` stream.
+ *
+ * The stream is held as a list of fixed-size chunks instead of one
+ * contiguous buffer, so appending never reallocates or copies data that
+ * was already received. Offsets are absolute byte positions from the
+ * start of the stream; words and byte ranges may straddle chunk
+ * boundaries and are reassembled transparently by the accessors.
+ *
+ * Chunks are charged to the MemoryBudget. When a new chunk would exceed
+ * the budget, all completed chunks are moved to a memory-mapped SpillFile;
+ * readers see no difference. Streams are move-only so that the charge is
+ * never counted twice.
+ *
+ * Consumers that are done with the start of the stream release() it; the
+ * chunks before the given offset are freed while offsets stay absolute.
+ */
+class ImageStream {
+public:
+    static constexpr qsizetype CHUNK_SIZE = 4 * 1024 * 1024; ///< Size of one storage chunk in bytes.
+
+    ImageStream() = default;
+    ImageStream(ImageStream&&) = default;
+    ImageStream& operator=(ImageStream&&) = default;
+
+    /**
+     * @brief Sequential little-endian reader over an ImageStream.
+     *
+     * Keeps a pointer into the current chunk so that consecutive reads
+     * stay on a fast path; only reads crossing a chunk boundary fall back
+     * to the stream accessors.
+     */
+    class Reader {
+    public:
+        /**
+         * @brief Construct a reader positioned at the given stream offset.
+         * @param stream Stream to read from. Must outlive the reader.
+         * @param pos Absolute byte offset to start reading at.
+         */
+        explicit Reader(const ImageStream& stream, qint64 pos = 0);
+
+        qint64 pos() const { return m_pos; } ///< Current absolute byte offset.
+        bool canRead(qint64 bytes) const { return m_pos + bytes <= m_stream.size(); } ///< Whether @p bytes are available.
+
+        /**
+         * @brief Read one 16-bit little-endian word and advance.
+         * @note Caller must ensure canRead(UINT16_SIZE).
+         */
+        uint16_t readWord()
+        {
+            if (m_chunkEnd - m_ptr >= 2)
+            {
+                const uint16_t word = static_cast<uint16_t>(static_cast<uint8_t>(m_ptr[0]) | (static_cast<uint8_t>(m_ptr[1]) << 8));
+                m_ptr += 2;
+                m_pos += 2;
+                return word;
+            }
+            const uint16_t word = m_stream.word(m_pos);
+            seek(m_pos + 2);
+            return word;
+        }
+
+        /**
+         * @brief Skip consecutive pixel words (below 0xFFF9) in the current chunk.
+         *
+         * Stops before the first control marker, at the end of the chunk or
+         * before a word that straddles into the next chunk.
+         *
+         * @return Number of pixel words skipped.
+         */
+        qint64 skipPixelRun()
+        {
+            // Markers are 0xFFF9..0xFFFF: little-endian high byte 0xFF and low byte >= 0xF9.
+            const char* p = m_ptr;
+            while (m_chunkEnd - p >= 2 && !(static_cast<uint8_t>(p[1]) == 0xFFu && static_cast<uint8_t>(p[0]) >= 0xF9u))
+                p += 2;
+
+            const qint64 count = (p - m_ptr) / 2;
+            m_ptr = p;
+            m_pos += count * 2;
+            return count;
+        }
+
+        /**
+         * @brief Read @p size bytes into a QByteArray and advance.
+         * @note Caller must ensure canRead(size).
+         */
+        QByteArray readBytes(qint64 size);
+
+        /**
+         * @brief Move the reader to an absolute byte offset.
+         * @param pos New offset (clamped to the stream size).
+         */
+        void seek(qint64 pos);
+
+    private:
+        const ImageStream& m_stream; ///< Stream being read.
+        qint64 m_pos = 0; ///< Absolute byte offset.
+        const char* m_ptr = nullptr; ///< Read pointer inside the current chunk.
+        const char* m_chunkEnd = nullptr; ///< End of valid bytes in the current chunk.
+    };
+
+    /**
+     * @brief Append bytes to the end of the stream.
+     * @param data Pointer to bytes to append.
+     * @param size Number of bytes to append.
+     */
+    void append(const char* data, qint64 size);
+    void append(const QByteArray& data) { append(data.constData(), data.size()); } ///< @overload
+
+    /**
+     * @brief Release all chunks and reset the stream to empty.
+     */
+    void clear();
+
+    /**
+     * @brief Free the chunks that lie entirely before an offset.
+     *
+     * Bytes before released() can no longer be read; spilled chunks stay in
+     * the spill file until the stream is cleared.
+     * @param offset First byte that is still needed.
+     */
+    void release(qint64 offset);
+    qint64 released() const { return static_cast<qint64>(m_releasedChunks) * CHUNK_SIZE; } ///< Offset before which the bytes were released.
+
+    /**
+     * @brief Drop the bytes from an offset on, e.g. the start of the next image.
+     * @param size New size; larger values leave the stream unchanged.
+     */
+    void truncate(qint64 size);
+
+    qint64 size() const { return m_size; } ///< Total number of bytes stored.
+    bool isEmpty() const { return m_size == 0; } ///< Whether no bytes are stored.
+
+    /**
+     * @brief Read a 16-bit little-endian word at an absolute offset.
+     * @param offset Byte offset; offset + 2 must not exceed size().
+     * @return Decoded word (may straddle two chunks).
+     */
+    uint16_t word(qint64 offset) const;
+
+    /**
+     * @brief Copy a byte range out of the stream.
+     * @param offset Absolute byte offset of the first byte.
+     * @param dst Destination buffer with room for @p size bytes.
+     * @param size Number of bytes to copy; range must lie within size().
+     */
+    void read(qint64 offset, void* dst, qint64 size) const;
+
+    /**
+     * @brief Return a pointer to contiguous bytes starting at @p offset.
+     * @param offset Absolute byte offset.
+     * @param available Receives the number of bytes readable from the pointer
+     *                  before the end of the containing chunk.
+     * @return Pointer into chunk storage, or nullptr when offset is out of range.
+     */
+    const char* contiguous(qint64 offset, qint64* available) const;
+
+    /**
+     * @brief Write the complete stream to a device (e.g. for debug dumps).
+     * @param device Open writable device.
+     * @return true when all bytes were written; false as well when a part was released.
+     */
+    bool writeTo(QIODevice& device) const;
+
+    qint64 spilledBytes() const { return m_spill ? m_spill->size() : 0; } ///< Bytes moved to the spill file.
+
+private:
+    /**
+     * @brief One fixed-size storage chunk, either on the heap or in the spill file.
+     */
+    struct Chunk {
+        QByteArray data; ///< Heap storage (empty once spilled).
+        const char* ptr = nullptr; ///< Start of the chunk bytes in data or in the spill file mapping.
+        MemoryCharge charge; ///< Budget charge of the heap storage.
+    };
+
+    /**
+     * @brief Move every completed heap chunk to the spill file.
+     */
+    void spillChunks();
+
+    std::vector<Chunk> m_chunks; ///< Fixed-size storage chunks; only the last one is partially filled.
+    qint64 m_size = 0; ///< Number of valid bytes across all chunks.
+    qsizetype m_releasedChunks = 0; ///< Leading chunks freed by release().
+    QSharedPointer<SpillFile> m_spill; ///< Spill file, created when the budget is first exceeded.
+    bool m_spillFailed = false; ///< Whether spilling failed; the stream then stays on the heap.
+};
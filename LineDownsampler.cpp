@@ -0,0 +1,49 @@
+#include "LineDownsampler.h"
+#include "Simd.h"
+
+#include <algorithm>
+
+
+void LineDownsampler::reset(int width, int factor)
+{
+    m_width = std::max(width, 0);
+    m_factor = std::max(factor, 1);
+    m_summedLines = 0;
+    m_sums.assign(static_cast<size_t>(m_width), 0);
+}
+
+bool LineDownsampler::addLine(const uint16_t* line)
+{
+    uint32_t* sums = m_sums.data();
+    int x = 0;
+#ifdef CR35_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    for (; x + 8 <= m_width; x += 8)
+    {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(line + x));
+        __m128i* s = reinterpret_cast<__m128i*>(sums + x);
+        _mm_storeu_si128(s, _mm_add_epi32(_mm_loadu_si128(s), _mm_unpacklo_epi16(v, zero)));
+        _mm_storeu_si128(s + 1, _mm_add_epi32(_mm_loadu_si128(s + 1), _mm_unpackhi_epi16(v, zero)));
+    }
+#endif
+    for (; x < m_width; ++x)
+        sums[x] += line[x];
+    return ++m_summedLines == m_factor;
+}
+
+void LineDownsampler::finishRow(uint16_t* dst)
+{
+    const int width = outputWidth();
+    for (int x = 0; x < width; ++x)
+    {
+        const int left = x * m_factor;
+        const int right = std::min(left + m_factor, m_width);
+        uint64_t sum = 0;
+        for (int c = left; c < right; ++c)
+            sum += m_sums[c];
+        const uint64_t count = static_cast<uint64_t>(right - left) * std::max(m_summedLines, 1);
+        dst[x] = static_cast<uint16_t>((sum + count / 2) / count);
+    }
+    std::fill(m_sums.begin(), m_sums.end(), 0u);
+    m_summedLines = 0;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+
+/**
+ * @brief Box-averages lines by an integer factor, one line at a time.
+ *
+ * Every line is added to per-column 32-bit sums with SSE2; once the
+ * factor's worth of lines is summed, finishRow() averages the column groups
+ * into one output row, rounded. The last row and column groups may be
+ * smaller.
+ */
+class LineDownsampler {
+public:
+    /**
+     * @brief Start over with a new line width and factor.
+     * @param width Input line width in pixels.
+     * @param factor Lines and columns averaged per output pixel (at least 1).
+     */
+    void reset(int width, int factor);
+
+    /**
+     * @brief Add one input line.
+     * @return true once the factor's worth of lines is summed and finishRow() is due.
+     */
+    bool addLine(const uint16_t* line);
+
+    /**
+     * @brief Average the lines summed so far into one output row and clear the sums.
+     * @param dst Destination for outputWidth() pixels.
+     */
+    void finishRow(uint16_t* dst);
+
+    int width() const { return m_width; } ///< Input line width.
+    int factor() const { return m_factor; } ///< Lines and columns averaged per output pixel.
+    int outputWidth() const { return (m_width + m_factor - 1) / m_factor; } ///< Width of the output rows.
+    int summedLines() const { return m_summedLines; } ///< Lines added since the last output row.
+
+private:
+    int m_width = 0; ///< Input line width.
+    int m_factor = 1; ///< Averaging factor.
+    int m_summedLines = 0; ///< Lines summed into m_sums.
+    std::vector<uint32_t> m_sums; ///< Per-column sums of the current output row.
+};
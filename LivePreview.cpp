@@ -0,0 +1,155 @@
+#include "LivePreview.h"
+
+#include <qpainter.h>
+#include <qpaintevent.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+
+void PreviewRenderer::addLines(const LineBlockPtr& block)
+{
+    if (!block)
+        return;
+
+    if (block->firstLine == 0)
+    {
+        m_previewWidth = block->width;
+        m_preview.clear();
+        m_histogram.clear();
+        if (!m_windowSet)
+            m_toneMap = ToneMap::forBitsStored(block->bitsStored);
+        emit imageStarted(m_previewWidth);
+    }
+    // A block of an image whose start was missed, or out of order.
+    const int before = m_previewWidth > 0 ? static_cast<int>(m_preview.size() / m_previewWidth) : 0;
+    if (m_previewWidth == 0 || block->width != m_previewWidth || block->firstLine != before)
+        return;
+
+    m_histogram.add(*block);
+    m_preview.insert(m_preview.end(), block->pixels.begin(), block->pixels.end());
+    if (block->count > 0)
+        render(before);
+
+    if (block->last && m_histogram.count() > 0)
+    {
+        const Histogram::Window window = m_histogram.autoWindow();
+        emit autoWindowReady(window.low, window.high);
+        if (!m_windowSet && !m_preview.empty())
+        {
+            m_toneMap.setWindow(window.low, window.high);
+            render(0);
+        }
+    }
+}
+
+void PreviewRenderer::setWindow(int low, int high, double gamma)
+{
+    m_toneMap.setWindow(low, high, gamma);
+    m_windowSet = true;
+    if (!m_preview.empty())
+        render(0);
+}
+
+void PreviewRenderer::render(int firstRow)
+{
+    const int rows = static_cast<int>(m_preview.size() / m_previewWidth) - firstRow;
+    QImage image(m_previewWidth, rows, QImage::Format_Grayscale8);
+    for (int y = 0; y < rows; ++y)
+        m_toneMap.map(m_preview.data() + static_cast<size_t>(firstRow + y) * m_previewWidth, image.scanLine(y), m_previewWidth);
+    emit rowsRendered(image, firstRow);
+}
+
+
+LivePreviewWidget::LivePreviewWidget(QWidget* parent) : QWidget(parent), m_renderer(new PreviewRenderer)
+{
+    m_renderer->moveToThread(&m_thread);
+    connect(&m_thread, &QThread::finished, m_renderer, &QObject::deleteLater);
+    connect(m_renderer, &PreviewRenderer::imageStarted, this, &LivePreviewWidget::startImage);
+    connect(m_renderer, &PreviewRenderer::rowsRendered, this, &LivePreviewWidget::addRows);
+    connect(m_renderer, &PreviewRenderer::autoWindowReady, this, &LivePreviewWidget::autoWindowReady);
+    m_thread.start();
+}
+
+LivePreviewWidget::~LivePreviewWidget()
+{
+    m_thread.quit();
+    m_thread.wait();
+}
+
+void LivePreviewWidget::addLines(const LineBlockPtr& block)
+{
+    PreviewRenderer* renderer = m_renderer;
+    QMetaObject::invokeMethod(renderer, [renderer, block]() { renderer->addLines(block); }, Qt::QueuedConnection);
+}
+
+void LivePreviewWidget::setWindow(int low, int high, double gamma)
+{
+    PreviewRenderer* renderer = m_renderer;
+    QMetaObject::invokeMethod(renderer, [renderer, low, high, gamma]() { renderer->setWindow(low, high, gamma); }, Qt::QueuedConnection);
+}
+
+void LivePreviewWidget::startImage(int width)
+{
+    // Start with a square layout; most plates are taller than wide and double it once or twice.
+    m_image = QImage(width, width, QImage::Format_Grayscale8);
+    m_image.fill(0);
+    m_rows = 0;
+    update();
+}
+
+void LivePreviewWidget::addRows(const QImage& rows, int firstRow)
+{
+    if (m_image.isNull() || rows.width() != m_image.width())
+        return;
+
+    const int end = firstRow + rows.height();
+    if (end > m_image.height())
+    {
+        QImage larger(m_image.width(), std::max(end, 2 * m_image.height()), QImage::Format_Grayscale8);
+        larger.fill(0);
+        for (int y = 0; y < m_rows; ++y)
+            memcpy(larger.scanLine(y), m_image.constScanLine(y), static_cast<size_t>(m_image.width()));
+        m_image = larger;
+        update();
+    }
+
+    for (int y = 0; y < rows.height(); ++y)
+        memcpy(m_image.scanLine(firstRow + y), rows.constScanLine(y), static_cast<size_t>(rows.width()));
+    m_rows = std::max(m_rows, end);
+    update(area(firstRow, rows.height()));
+}
+
+double LivePreviewWidget::scale() const
+{
+    if (m_image.isNull())
+        return 1.0;
+    return std::min(static_cast<double>(width()) / m_image.width(), static_cast<double>(height()) / m_image.height());
+}
+
+QRect LivePreviewWidget::area(int firstRow, int rows) const
+{
+    const double s = scale();
+    const int top = static_cast<int>(std::floor(firstRow * s));
+    const int bottom = static_cast<int>(std::ceil((firstRow + rows) * s));
+    return QRect(0, top, static_cast<int>(std::ceil(m_image.width() * s)), bottom - top + 1);
+}
+
+void LivePreviewWidget::paintEvent(QPaintEvent* event)
+{
+    QPainter painter(this);
+    painter.fillRect(event->rect(), Qt::black);
+    if (m_image.isNull() || m_rows == 0)
+        return;
+
+    // Only the preview rows under the repainted area are scaled.
+    const double s = scale();
+    const int first = std::max(0, static_cast<int>(std::floor(event->rect().top() / s)));
+    const int last = std::min(m_rows, static_cast<int>(std::ceil((event->rect().bottom() + 1) / s)));
+    if (last <= first)
+        return;
+    const QRectF source(0, first, m_image.width(), last - first);
+    const QRectF target(0, first * s, m_image.width() * s, (last - first) * s);
+    painter.drawImage(target, m_image, source);
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <qimage.h>
+#include <qobject.h>
+#include <qthread.h>
+#include <qwidget.h>
+
+#include "CR35Utils.h"
+#include "Histogram.h"
+#include "ImageFrame.h"
+#include "ToneMap.h"
+
+#include <cstdint>
+#include <vector>
+
+
+/**
+ * @brief Turns preview row blocks into 8-bit strips, on its own thread.
+ *
+ * PreviewDecoder averages the lines down while it assembles them (see
+ * LineBlock), so blocks arrive at most PREVIEW_MAX_WIDTH pixels wide. The
+ * 16-bit rows of the image are kept; new rows are mapped through a ToneMap
+ * and sent as one strip, so only the rows that changed are handed to the
+ * GUI thread.
+ *
+ * Every block is also counted into a Histogram, so the automatic window is
+ * known as soon as the last block has arrived; unless a window was set, the
+ * finished preview is rendered again with it. The histogram counts the
+ * averaged preview pixels, which smooths outliers out of the window.
+ */
+class PreviewRenderer : public QObject {
+    Q_OBJECT
+
+public:
+    using QObject::QObject;
+
+public slots:
+    /**
+     * @brief Add preview rows; a block with firstLine 0 starts a new image.
+     */
+    void addLines(const LineBlockPtr& block);
+
+    /**
+     * @brief Set the display window and render the whole preview again.
+     *
+     * Until it is called, images are shown over the range of their `BitsStored`
+     * while they are scanned and with their automatic window once complete.
+     */
+    void setWindow(int low, int high, double gamma);
+
+signals:
+    void imageStarted(int width); ///< A new image begins; its preview rows are @p width pixels wide.
+    void rowsRendered(const QImage& rows, int firstRow); ///< 8-bit preview rows starting at @p firstRow.
+    void autoWindowReady(int low, int high); ///< Automatic window of the image that has just ended.
+
+private:
+    void render(int firstRow); ///< Map preview rows from @p firstRow on and emit them.
+
+    int m_previewWidth = 0; ///< Width of the preview rows.
+    std::vector<uint16_t> m_preview; ///< 16-bit preview rows of the current image.
+    ToneMap m_toneMap; ///< Display mapping.
+    Histogram m_histogram; ///< Pixels of the current image received so far.
+    bool m_windowSet = false; ///< Whether setWindow() overrides the `BitsStored` range.
+};
+
+/**
+ * @brief Shows the plate while it is scanned.
+ *
+ * Connect CR35Device::linesDecoded() to addLines(). Tone mapping runs in a
+ * PreviewRenderer on a worker thread; the widget only
+ * copies the strips it receives into its image and repaints their area.
+ * The image is scaled to fit the widget for a height that doubles whenever
+ * the plate outgrows it, so the whole widget is repainted only then.
+ */
+class LivePreviewWidget : public QWidget {
+    Q_OBJECT
+
+public:
+    explicit LivePreviewWidget(QWidget* parent = nullptr);
+
+    /**
+     * @brief Stops the render thread.
+     */
+    ~LivePreviewWidget();
+
+    QSize sizeHint() const override { return QSize(400, 400); }
+
+public slots:
+    void addLines(const LineBlockPtr& block); ///< Queue decoded lines for rendering.
+    void setWindow(int low, int high, double gamma = 1.0); ///< Set the display window of the preview.
+
+signals:
+    void autoWindowReady(int low, int high); ///< Automatic window of the plate that has just been scanned.
+
+protected:
+    void paintEvent(QPaintEvent* event) override;
+
+private:
+    void startImage(int width); ///< Clear the preview for a new image.
+    void addRows(const QImage& rows, int firstRow); ///< Copy rendered rows and repaint their area.
+
+    double scale() const; ///< Widget pixels per preview pixel.
+    QRect area(int firstRow, int rows) const; ///< Widget area of preview rows.
+
+    QThread m_thread; ///< Thread of m_renderer.
+    PreviewRenderer* m_renderer; ///< Renderer living on m_thread.
+    QImage m_image; ///< Preview rows; its height is the layout height, doubled as needed.
+    int m_rows = 0; ///< Preview rows received.
+};
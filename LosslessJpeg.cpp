@@ -0,0 +1,304 @@
+#include "LosslessJpeg.h"
+
+#include <algorithm>
+
+
+namespace {
+
+/**
+ * @brief Append a marker segment header (marker and length).
+ */
+void appendSegment(std::vector<uint8_t>& out, uint8_t marker, int length)
+{
+    out.push_back(0xFF);
+    out.push_back(marker);
+    out.push_back(static_cast<uint8_t>(length >> 8));
+    out.push_back(static_cast<uint8_t>(length));
+}
+
+/**
+ * @brief Code lengths limited to 16 bits from symbol frequencies (T.81 Annex K.2, as in libjpeg).
+ * @param freq Frequencies of symbols 0..16, all non-zero.
+ * @param bits Receives the number of codes per length 1..16.
+ * @param values Receives the symbols ordered by code length.
+ */
+void optimalTable(const uint64_t freq[17], int bits[17], std::vector<int>& values)
+{
+    constexpr int symbols = 18; // 17 categories plus one reserved symbol, so no code is all ones
+    uint64_t f[symbols];
+    int codeSize[symbols] = {};
+    int others[symbols];
+    std::copy(freq, freq + 17, f);
+    f[17] = 1;
+    std::fill(others, others + symbols, -1);
+
+    for (;;)
+    {
+        // The two least frequent trees; ties go to the larger symbol.
+        int c1 = -1;
+        for (int i = 0; i < symbols; ++i)
+        {
+            if (f[i] && (c1 < 0 || f[i] <= f[c1]))
+                c1 = i;
+        }
+        int c2 = -1;
+        for (int i = 0; i < symbols; ++i)
+        {
+            if (f[i] && i != c1 && (c2 < 0 || f[i] <= f[c2]))
+                c2 = i;
+        }
+        if (c2 < 0)
+            break;
+
+        f[c1] += f[c2];
+        f[c2] = 0;
+        ++codeSize[c1];
+        while (others[c1] >= 0)
+        {
+            c1 = others[c1];
+            ++codeSize[c1];
+        }
+        others[c1] = c2;
+        ++codeSize[c2];
+        while (others[c2] >= 0)
+        {
+            c2 = others[c2];
+            ++codeSize[c2];
+        }
+    }
+
+    int count[33] = {};
+    for (int i = 0; i < symbols; ++i)
+    {
+        if (codeSize[i])
+            ++count[std::min(codeSize[i], 32)];
+    }
+
+    // Move codes longer than 16 bits up the tree.
+    for (int i = 32; i > 16; --i)
+    {
+        while (count[i] > 0)
+        {
+            int j = i - 2;
+            while (count[j] == 0)
+                --j;
+            count[i] -= 2;
+            ++count[i - 1];
+            count[j + 1] += 2;
+            --count[j];
+        }
+    }
+    // Drop the reserved symbol, which has the longest code.
+    int longest = 16;
+    while (count[longest] == 0)
+        --longest;
+    --count[longest];
+
+    std::copy(count, count + 17, bits);
+    values.clear();
+    for (int length = 1; length <= 32; ++length)
+    {
+        for (int s = 0; s < 17; ++s)
+        {
+            if (codeSize[s] == length)
+                values.push_back(s);
+        }
+    }
+}
+
+} // namespace
+
+
+void LosslessJpegEncoder::begin(int width, int height, int precision)
+{
+    m_width = width;
+    m_height = height;
+    m_precision = std::clamp(precision, 2, 16);
+    m_maxSample = (1 << m_precision) - 1;
+    m_row = 0;
+    m_aboveFirst = 0;
+    std::fill(m_histogram, m_histogram + 17, 0);
+    m_bitBuffer = 0;
+    m_bitCount = 0;
+}
+
+int LosslessJpegEncoder::category(int diff)
+{
+    // Differences are taken modulo 2^16 (T.81 H.1.2.1); -32768 is category 16, without extra bits.
+    static const std::vector<uint8_t> table = [] {
+        std::vector<uint8_t> t(32769);
+        for (size_t m = 1; m < t.size(); ++m)
+            t[m] = static_cast<uint8_t>(t[m >> 1] + 1);
+        return t;
+    }();
+    return table[static_cast<size_t>(diff < 0 ? -diff : diff)];
+}
+
+void LosslessJpegEncoder::addStatistics(const uint16_t* rows, int count, const uint16_t* above)
+{
+    const int initial = 1 << (m_precision - 1);
+    const int maxSample = m_maxSample;
+    for (int r = 0; r < count; ++r)
+    {
+        const uint16_t* row = rows + static_cast<size_t>(r) * m_width;
+        const uint16_t* up = r > 0 ? row - m_width : above;
+        int predictor = up ? std::min<int>(up[0], maxSample) : initial;
+        for (int x = 0; x < m_width; ++x)
+        {
+            const int sample = std::min<int>(row[x], maxSample);
+            ++m_histogram[category(static_cast<int16_t>(sample - predictor))];
+            predictor = sample;
+        }
+    }
+}
+
+void LosslessJpegEncoder::writeHeader(std::vector<uint8_t>& out)
+{
+    // Every category stays encodable, whatever the sample rows missed.
+    uint64_t freq[17];
+    for (int i = 0; i < 17; ++i)
+        freq[i] = m_histogram[i] + 1;
+
+    int bits[17];
+    std::vector<int> values;
+    optimalTable(freq, bits, values);
+
+    // Canonical codes in the order of the table (T.81 Annex C).
+    uint16_t code = 0;
+    size_t k = 0;
+    for (int length = 1; length <= 16; ++length)
+    {
+        for (int n = 0; n < bits[length]; ++n, ++k)
+        {
+            m_code[values[k]] = code++;
+            m_codeLength[values[k]] = static_cast<uint8_t>(length);
+        }
+        code <<= 1;
+    }
+
+    out.push_back(0xFF);
+    out.push_back(0xD8); // SOI
+
+    appendSegment(out, 0xC3, 11); // SOF3: lossless, Huffman
+    out.push_back(static_cast<uint8_t>(m_precision));
+    out.push_back(static_cast<uint8_t>(m_height >> 8));
+    out.push_back(static_cast<uint8_t>(m_height));
+    out.push_back(static_cast<uint8_t>(m_width >> 8));
+    out.push_back(static_cast<uint8_t>(m_width));
+    out.push_back(1); // one component
+    out.push_back(1); // component id
+    out.push_back(0x11); // no subsampling
+    out.push_back(0); // no quantization table in lossless mode
+
+    appendSegment(out, 0xC4, 2 + 1 + 16 + static_cast<int>(values.size())); // DHT
+    out.push_back(0x00); // DC table 0
+    for (int length = 1; length <= 16; ++length)
+        out.push_back(static_cast<uint8_t>(bits[length]));
+    for (int v : values)
+        out.push_back(static_cast<uint8_t>(v));
+
+    appendSegment(out, 0xDA, 8); // SOS
+    out.push_back(1); // one component
+    out.push_back(1); // component id
+    out.push_back(0x00); // DC table 0
+    out.push_back(1); // predictor selection value: left neighbour
+    out.push_back(0); // Se
+    out.push_back(0); // Ah/Al: no point transform
+}
+
+void LosslessJpegEncoder::encodeRows(const uint16_t* rows, int count, std::vector<uint8_t>& out)
+{
+    const int initial = 1 << (m_precision - 1);
+    const int maxSample = m_maxSample;
+    uint64_t buffer = m_bitBuffer;
+    int bitCount = m_bitCount;
+
+    // Worst case per row: 32 bits per sample, every byte stuffed.
+    const size_t rowBound = static_cast<size_t>(m_width) * 8 + 16;
+    size_t pos = out.size();
+
+    for (int r = 0; r < count; ++r)
+    {
+        const uint16_t* row = rows + static_cast<size_t>(r) * m_width;
+        if (out.size() < pos + rowBound)
+            out.resize(std::max(out.size() * 2, pos + rowBound));
+        uint8_t* dst = out.data() + pos;
+
+        int predictor = m_row == 0 ? initial : m_aboveFirst;
+        for (int x = 0; x < m_width; ++x)
+        {
+            const int sample = std::min<int>(row[x], maxSample);
+            const int diff = static_cast<int16_t>(sample - predictor);
+            predictor = sample;
+
+            const int s = category(diff);
+            uint32_t value = m_code[s];
+            int length = m_codeLength[s];
+            if (s > 0 && s < 16)
+            {
+                // Negative differences are sent as diff - 1 in s bits (ones' complement).
+                value = (value << s) | (static_cast<uint32_t>(diff < 0 ? diff - 1 : diff) & ((1u << s) - 1));
+                length += s;
+            }
+
+            buffer = (buffer << length) | value;
+            bitCount += length;
+            if (bitCount < 32)
+                continue;
+
+            // Emit 32 bits at once unless one of the bytes needs stuffing.
+            bitCount -= 32;
+            const uint32_t word = static_cast<uint32_t>(buffer >> bitCount);
+            if (((~word - 0x01010101u) & word & 0x80808080u) == 0)
+            {
+                dst[0] = static_cast<uint8_t>(word >> 24);
+                dst[1] = static_cast<uint8_t>(word >> 16);
+                dst[2] = static_cast<uint8_t>(word >> 8);
+                dst[3] = static_cast<uint8_t>(word);
+                dst += 4;
+                continue;
+            }
+            for (int shift = 24; shift >= 0; shift -= 8)
+            {
+                const uint8_t byte = static_cast<uint8_t>(word >> shift);
+                *dst++ = byte;
+                if (byte == 0xFF)
+                    *dst++ = 0x00; // byte stuffing
+            }
+        }
+        // Whole bytes only between rows; at most 7 bits stay pending.
+        while (bitCount >= 8)
+        {
+            bitCount -= 8;
+            const uint8_t byte = static_cast<uint8_t>(buffer >> bitCount);
+            *dst++ = byte;
+            if (byte == 0xFF)
+                *dst++ = 0x00;
+        }
+        pos = static_cast<size_t>(dst - out.data());
+        m_aboveFirst = std::min<int>(row[0], maxSample);
+        ++m_row;
+    }
+
+    out.resize(pos);
+    m_bitBuffer = buffer & ((uint64_t(1) << bitCount) - 1);
+    m_bitCount = bitCount;
+}
+
+void LosslessJpegEncoder::finish(std::vector<uint8_t>& out)
+{
+    if (m_bitCount > 0)
+    {
+        // Pad the last byte with ones.
+        const int pad = 8 - m_bitCount;
+        const uint8_t byte = static_cast<uint8_t>((m_bitBuffer << pad) | ((1u << pad) - 1));
+        out.push_back(byte);
+        if (byte == 0xFF)
+            out.push_back(0x00);
+    }
+    m_bitBuffer = 0;
+    m_bitCount = 0;
+
+    out.push_back(0xFF);
+    out.push_back(0xD9); // EOI
+}
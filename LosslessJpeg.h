@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+
+/**
+ * @brief Lossless JPEG (ITU-T T.81 process 14, first-order prediction) encoder for 16-bit grayscale.
+ *
+ * This is the DICOM transfer syntax 1.2.840.10008.1.2.4.70. Every sample is
+ * predicted from its left neighbour (selection value 1); the first sample of a row is predicted
+ * from the sample above it. The Huffman table is optimal for the
+ * statistics collected with addStatistics() before writeHeader(), so a
+ * representative subset of rows is enough to get close to the best ratio.
+ *
+ * Rows are encoded as they arrive; the encoder keeps only the first sample
+ * of the previous row, so it can be fed from a frame buffer or from a
+ * decoder in blocks.
+ *
+ * Samples of 2^P and above, i.e. the 0xFFFF white fill of unscanned areas
+ * in a frame of fewer bits, are encoded as 2^P - 1, the white of the image.
+ * All other samples are reproduced exactly.
+ */
+class LosslessJpegEncoder {
+public:
+    /**
+     * @brief Start a new image.
+     * @param width Samples per row (1..65535).
+     * @param height Rows (1..65535).
+     * @param precision Sample precision P in bits (2..16); larger samples are clamped to 2^P - 1.
+     */
+    void begin(int width, int height, int precision);
+
+    /**
+     * @brief Count the difference categories of some rows for the Huffman table.
+     * @param rows count * width samples.
+     * @param count Number of rows.
+     * @param above Row above the first one, or nullptr for the first image row.
+     */
+    void addStatistics(const uint16_t* rows, int count, const uint16_t* above);
+
+    /**
+     * @brief Build the Huffman table and append SOI, SOF3, DHT and SOS.
+     */
+    void writeHeader(std::vector<uint8_t>& out);
+
+    /**
+     * @brief Append the entropy-coded data of the next rows.
+     * @param rows count * width samples.
+     * @param count Number of rows.
+     */
+    void encodeRows(const uint16_t* rows, int count, std::vector<uint8_t>& out);
+
+    /**
+     * @brief Flush the remaining bits and append EOI.
+     */
+    void finish(std::vector<uint8_t>& out);
+
+private:
+    /**
+     * @brief Difference category (number of magnitude bits) of a prediction error.
+     */
+    static int category(int diff);
+
+    int m_width = 0; ///< Samples per row.
+    int m_height = 0; ///< Rows.
+    int m_precision = 16; ///< Sample precision P.
+    int m_maxSample = 0xFFFF; ///< Largest sample of precision P, 2^P - 1.
+    int m_row = 0; ///< Rows encoded so far.
+    int m_aboveFirst = 0; ///< First sample of the last encoded row.
+    uint64_t m_histogram[17] = {}; ///< Occurrences per difference category.
+    uint16_t m_code[17] = {}; ///< Huffman code per category.
+    uint8_t m_codeLength[17] = {}; ///< Huffman code length per category.
+    uint64_t m_bitBuffer = 0; ///< Pending bits, right-aligned.
+    int m_bitCount = 0; ///< Number of pending bits.
+};
@@ -0,0 +1,20 @@
+#include "MemoryBudget.h"
+
+#include "CR35Utils.h"
+
+
+MemoryBudget::MemoryBudget() : m_limit(MEMORY_BUDGET_DEFAULT)
+{
+}
+
+MemoryBudget& MemoryBudget::instance()
+{
+    static MemoryBudget budget;
+    return budget;
+}
+
+bool MemoryBudget::fits(qint64 bytes) const
+{
+    const qint64 limit = m_limit;
+    return limit <= 0 || m_used + bytes <= limit;
+}
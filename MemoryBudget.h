@@ -0,0 +1,87 @@
+#pragma once
+
+#include <qglobal.h>
+
+#include <atomic>
+
+
+/**
+ * @brief Process-wide accounting of large image buffers.
+ *
+ * Raw stream chunks and decoded frames charge their size against a
+ * configurable limit. Owners ask fits() before allocating on the heap and
+ * fall back to a SpillFile when the budget is exhausted, so the number and
+ * size of acquisitions held at once is bounded by disk space instead of RAM.
+ * Small protocol and bookkeeping allocations are not accounted.
+ */
+class MemoryBudget {
+public:
+    /**
+     * @brief Get the process-wide budget.
+     */
+    static MemoryBudget& instance();
+
+    /**
+     * @brief Set the limit for accounted buffers.
+     * @param bytes Limit in bytes; 0 disables spilling.
+     */
+    void setLimit(qint64 bytes) { m_limit = bytes; }
+    qint64 limit() const { return m_limit; } ///< Current limit in bytes (0 = unlimited).
+    qint64 used() const { return m_used; } ///< Bytes currently charged.
+
+    /**
+     * @brief Whether @p bytes more can be charged without exceeding the limit.
+     */
+    bool fits(qint64 bytes) const;
+
+    void charge(qint64 bytes) { m_used += bytes; } ///< Account an allocation.
+    void release(qint64 bytes) { m_used -= bytes; } ///< Return an allocation.
+
+private:
+    MemoryBudget();
+
+    std::atomic<qint64> m_limit; ///< Limit in bytes (0 = unlimited).
+    std::atomic<qint64> m_used { 0 }; ///< Bytes currently charged.
+};
+
+/**
+ * @brief Move-only handle that keeps bytes charged to the MemoryBudget.
+ *
+ * The charge is released when the handle is reset or destroyed, so the
+ * accounting follows the owner of the buffer.
+ */
+class MemoryCharge {
+public:
+    MemoryCharge() = default;
+    explicit MemoryCharge(qint64 bytes) : m_bytes(bytes) { MemoryBudget::instance().charge(bytes); } ///< Charge @p bytes.
+    ~MemoryCharge() { reset(); }
+
+    MemoryCharge(MemoryCharge&& other) noexcept : m_bytes(other.m_bytes) { other.m_bytes = 0; }
+    MemoryCharge& operator=(MemoryCharge&& other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            m_bytes = other.m_bytes;
+            other.m_bytes = 0;
+        }
+        return *this;
+    }
+    MemoryCharge(const MemoryCharge&) = delete;
+    MemoryCharge& operator=(const MemoryCharge&) = delete;
+
+    /**
+     * @brief Release the charge.
+     */
+    void reset()
+    {
+        if (m_bytes != 0)
+            MemoryBudget::instance().release(m_bytes);
+        m_bytes = 0;
+    }
+
+    qint64 bytes() const { return m_bytes; } ///< Charged bytes.
+
+private:
+    qint64 m_bytes = 0; ///< Bytes charged by this handle.
+};
@@ -0,0 +1,217 @@
+#include "ModeCatalog.h"
+
+#include <qdir.h>
+#include <qfile.h>
+#include <qfileinfo.h>
+#include <qregularexpression.h>
+#include <qsavefile.h>
+#include <qstandardpaths.h>
+
+#include <initializer_list>
+
+
+namespace {
+
+/**
+ * @brief Case-insensitive match of a key against a list of aliases.
+ */
+bool isKey(const QString& key, std::initializer_list<const char*> aliases)
+{
+    for (const char* alias : aliases)
+    {
+        if (key.compare(alias, Qt::CaseInsensitive) == 0)
+            return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Store a section key in the mode, converting known geometry keys.
+ */
+void applyKey(AcquisitionMode& mode, const QString& key, const QString& value)
+{
+    mode.parameters.insert(key, value);
+
+    if (key.compare("ModeName", Qt::CaseInsensitive) == 0)
+        mode.names.insert(QString(), value);
+    else if (key.startsWith("ModeName_", Qt::CaseInsensitive))
+        mode.names.insert(key.sliced(9).toLower(), value);
+    else if (isKey(key, { "PixLine", "PixelsPerLine", "LineWidth" }))
+        mode.pixLine = value.toInt();
+    else if (isKey(key, { "SlotCount", "Slots" }))
+        mode.slotCount = value.toInt();
+    else if (isKey(key, { "BitsStored", "BitDepth" }))
+        mode.bitsStored = value.toInt();
+    else if (isKey(key, { "PixelSpacing", "PixelSize" }))
+        mode.pixelSpacing = value.toDouble();
+}
+
+} // namespace
+
+
+QString AcquisitionMode::name(const QString& language) const
+{
+    for (const QString& key : { language, QString("en"), QString() })
+    {
+        const QString text = names.value(key);
+        if (!text.isEmpty())
+            return text;
+    }
+    return names.isEmpty() ? QString() : names.first();
+}
+
+QString AcquisitionMode::displayName(const QString& language) const
+{
+    const QString text = name(language);
+    return idText.isEmpty() ? text : idText + " - " + text;
+}
+
+ImageMetadata AcquisitionMode::defaults() const
+{
+    ImageMetadata metadata;
+    metadata.pixLine = pixLine;
+    metadata.slotCount = slotCount;
+    metadata.bitsStored = bitsStored;
+    metadata.pixelSpacingX = metadata.pixelSpacingY = pixelSpacing;
+    metadata.mode = name();
+    return metadata;
+}
+
+ModeCatalog ModeCatalog::parse(const QByteArray& data)
+{
+    // ModeList is INI-like text with sections [Mode-{...}] and key/value pairs.
+    ModeCatalog catalog;
+
+    // Trim at first NUL (device may append binary / padding after textual config)
+    const qsizetype nulPos = data.indexOf('\0');
+    catalog.m_source = nulPos >= 0 ? data.left(nulPos) : data;
+
+    QString text = QString::fromLatin1(catalog.m_source);
+
+    // Normalize newlines
+    text.replace("\r\n", "\n");
+    text.replace('\r', '\n');
+
+    AcquisitionMode current;
+    bool inModeSection = false;
+
+    auto flushSection = [&]() {
+        if (!inModeSection)
+            return;
+        inModeSection = false;
+
+        // Sections without a name are not selectable; repeated IDs keep the first section.
+        if (current.name().trimmed().isEmpty() || (current.id >= 0 && catalog.find(current.id)))
+            return;
+        catalog.m_modes.push_back(std::move(current));
+    };
+
+    const QStringList lines = text.split('\n');
+    for (QString line : lines)
+    {
+        line = line.trimmed();
+        if (line.isEmpty())
+            continue;
+
+        // INI comment lines
+        if (line.startsWith(';'))
+            continue;
+
+        // If XML-ish payload appears, stop parsing (example shows "<!--<paramDescription")
+        if (line.startsWith("<!--"))
+            break;
+
+        if (line.startsWith('[') && line.endsWith(']'))
+        {
+            flushSection();
+
+            inModeSection = line.startsWith("[Mode-");
+            current = AcquisitionMode();
+            if (inModeSection)
+            {
+                // Example: [Mode-{00000001}]; the braces hold the ID in hexadecimal.
+                const int l = line.indexOf("{");
+                const int r = line.indexOf("}");
+                if (l >= 0 && r > l)
+                {
+                    current.idText = line.sliced(l + 1, r - l - 1).trimmed();
+                    bool ok = false;
+                    const int id = current.idText.toInt(&ok, 16);
+                    current.id = ok ? id : -1;
+                }
+            }
+            continue;
+        }
+
+        if (!inModeSection)
+            continue;
+
+        const int eq = line.indexOf('=');
+        if (eq <= 0)
+            continue;
+
+        applyKey(current, line.left(eq).trimmed(), line.sliced(eq + 1).trimmed());
+    }
+
+    flushSection();
+    return catalog;
+}
+
+QString ModeCatalog::cachePath(const QString& firmwareVersion)
+{
+    // Keep the version readable in the file name but safe for every file system.
+    const QString key = firmwareVersion.trimmed().replace(QRegularExpression("[^A-Za-z0-9.-]"), "_");
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/ModeList_" + key + ".ini";
+}
+
+bool ModeCatalog::loadCache(const QString& firmwareVersion)
+{
+    if (firmwareVersion.trimmed().isEmpty())
+        return false;
+
+    QFile file(cachePath(firmwareVersion));
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    ModeCatalog cached = parse(file.readAll());
+    if (cached.isEmpty())
+        return false;
+
+    *this = std::move(cached);
+    return true;
+}
+
+bool ModeCatalog::saveCache(const QString& firmwareVersion) const
+{
+    if (firmwareVersion.trimmed().isEmpty() || isEmpty())
+        return false;
+
+    const QString path = cachePath(firmwareVersion);
+    if (!QDir().mkpath(QFileInfo(path).absolutePath()))
+        return false;
+
+    // QSaveFile replaces the entry atomically, so a crash never leaves a truncated catalogue.
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+    file.write(m_source);
+    return file.commit();
+}
+
+const AcquisitionMode* ModeCatalog::find(int id) const
+{
+    for (const AcquisitionMode& mode : m_modes)
+    {
+        if (mode.id == id)
+            return &mode;
+    }
+    return nullptr;
+}
+
+QStringList ModeCatalog::displayNames(const QString& language) const
+{
+    QStringList result;
+    for (const AcquisitionMode& mode : m_modes)
+        result.push_back(mode.displayName(language));
+    return result;
+}
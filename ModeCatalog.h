@@ -0,0 +1,102 @@
+#pragma once
+
+#include <qbytearray.h>
+#include <qmap.h>
+#include <qstring.h>
+#include <qstringlist.h>
+
+#include "ImageMetadata.h"
+
+#include <vector>
+
+
+/**
+ * @brief One acquisition mode announced in the device `ModeList`.
+ */
+struct AcquisitionMode {
+    int id = -1; ///< Numeric mode ID sent with the `Mode` command.
+    QString idText; ///< ID as written in the section header, in hexadecimal, e.g. "00000001".
+    QMap<QString, QString> names; ///< Mode names keyed by language ("" for plain `ModeName`, "en" for `ModeName_en`, ...).
+    int pixLine = -1; ///< Scan line width in pixels (-1 = not announced).
+    int slotCount = -1; ///< Number of slots (-1 = not announced).
+    int bitsStored = 0; ///< Bit depth (0 = not announced).
+    double pixelSpacing = 0.0; ///< Pixel spacing in mm (0 = not announced).
+    QMap<QString, QString> parameters; ///< Every key/value pair of the section.
+
+    /**
+     * @brief Localized mode name.
+     * @param language Preferred language; falls back to English, the plain name, then any name.
+     */
+    QString name(const QString& language = "en") const;
+
+    /**
+     * @brief Display string "<id> - <name>" as shown in the UI.
+     */
+    QString displayName(const QString& language = "en") const;
+
+    /**
+     * @brief Geometry announced by the mode, used to preconfigure the decoder.
+     *
+     * Only the typed fields are set; the JSON header of the image overrides them.
+     */
+    ImageMetadata defaults() const;
+};
+
+/**
+ * @brief Structured acquisition mode catalogue parsed from the `ModeList` payload.
+ *
+ * The payload is INI-like text with one `[Mode-{<id>}]` section per mode.
+ * Besides the names, every key of a section is kept, and the well-known
+ * geometry keys (`PixLine`, `SlotCount`, `BitsStored`, `PixelSpacing` and
+ * their aliases) are converted to typed fields.
+ *
+ * The catalogue only changes with the firmware, so the raw payload is cached
+ * per firmware version under QStandardPaths::CacheLocation and reconnects
+ * can skip the `ModeList` transfer.
+ */
+class ModeCatalog {
+public:
+    /**
+     * @brief Parse a `ModeList` payload.
+     * @param data Raw payload bytes (may contain trailing binary data).
+     * @return Catalogue with the modes in payload order; duplicate IDs keep the first section.
+     */
+    static ModeCatalog parse(const QByteArray& data);
+
+    /**
+     * @brief Load the catalogue cached for a firmware version.
+     * @param firmwareVersion Device firmware version string.
+     * @return false when no usable cache entry exists.
+     */
+    bool loadCache(const QString& firmwareVersion);
+
+    /**
+     * @brief Store the catalogue for a firmware version.
+     * @param firmwareVersion Device firmware version string.
+     * @return false when the cache file cannot be written.
+     */
+    bool saveCache(const QString& firmwareVersion) const;
+
+    /**
+     * @brief Cache file used for a firmware version.
+     */
+    static QString cachePath(const QString& firmwareVersion);
+
+    bool isEmpty() const { return m_modes.empty(); } ///< Whether no mode was found.
+    const std::vector<AcquisitionMode>& modes() const { return m_modes; } ///< Modes in payload order.
+
+    /**
+     * @brief Find a mode by its numeric ID.
+     * @return Mode, or nullptr when unknown.
+     */
+    const AcquisitionMode* find(int id) const;
+
+    /**
+     * @brief Display strings of all modes, see AcquisitionMode::displayName().
+     */
+    QStringList displayNames(const QString& language = "en") const;
+
+private:
+    std::vector<AcquisitionMode> m_modes; ///< Parsed modes.
+    QByteArray m_source; ///< Payload text the modes were parsed from (cached as is).
+};
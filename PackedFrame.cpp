@@ -0,0 +1,261 @@
+#include "PackedFrame.h"
+
+#include <qendian.h>
+
+#if defined(__SSSE3__) || defined(__AVX__) || (defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86)))
+#define PACKED_FRAME_SSSE3 1
+#include <tmmintrin.h>
+#if defined(_MSC_VER) && !defined(__AVX__)
+#include <intrin.h>
+#endif
+#endif
+
+
+namespace {
+
+/**
+ * @brief Unpacked value of a code: the maximum code is the white fill.
+ */
+inline uint16_t whiteFill(uint32_t code, uint32_t mask)
+{
+    return static_cast<uint16_t>(code == mask ? 0xFFFF : code);
+}
+
+#ifdef PACKED_FRAME_SSSE3
+/**
+ * @brief Whether the SSSE3 kernels may run on this CPU.
+ *
+ * GCC/Clang only compile the kernels when SSSE3 is enabled for the whole
+ * build; MSVC always compiles them and checks CPUID once.
+ */
+bool hasSsse3()
+{
+#if defined(__SSSE3__) || defined(__AVX__)
+    return true;
+#else
+    static const bool supported = [] {
+        int info[4] = {};
+        __cpuid(info, 1);
+        return (info[2] & (1 << 9)) != 0;
+    }();
+    return supported;
+#endif
+}
+
+/**
+ * @brief Pack 8 pixels per iteration into 12 bytes (16-byte stores).
+ * @return Number of pixels packed.
+ */
+int pack12Ssse3(const uint16_t* src, uint8_t* dst, int count, size_t totalBytes)
+{
+    const __m128i pixelMask = _mm_set1_epi16(0x0FFF);
+    const __m128i lowMask = _mm_set1_epi32(0x00000FFF);
+    const __m128i highMask = _mm_set1_epi32(0x00FFF000);
+    const __m128i gather = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+
+    int i = 0;
+    for (; i + 8 <= count && static_cast<size_t>(i) / 2 * 3 + 16 <= totalBytes; i += 8)
+    {
+        // Two pixels per 32-bit lane: p0 | p1 << 12, then drop the top byte of every lane.
+        const __m128i x = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)), pixelMask);
+        const __m128i pairs = _mm_or_si128(_mm_and_si128(x, lowMask), _mm_and_si128(_mm_srli_epi32(x, 4), highMask));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i / 2 * 3), _mm_shuffle_epi8(pairs, gather));
+    }
+    return i;
+}
+
+/**
+ * @brief Unpack 12 bytes per iteration into 8 pixels (16-byte loads).
+ * @return Number of pixels unpacked.
+ */
+int unpack12Ssse3(const uint8_t* src, uint16_t* dst, int count, size_t totalBytes)
+{
+    const __m128i spread = _mm_setr_epi8(0, 1, 1, 2, 3, 4, 4, 5, 6, 7, 7, 8, 9, 10, 10, 11);
+    const __m128i evenMask = _mm_set1_epi32(0x00000FFF);
+    const __m128i oddMask = _mm_set1_epi32(static_cast<int>(0xFFFF0000u));
+    const __m128i maxCode = _mm_set1_epi16(0x0FFF);
+
+    int i = 0;
+    for (; i + 8 <= count && static_cast<size_t>(i) / 2 * 3 + 16 <= totalBytes; i += 8)
+    {
+        // Every 16-bit lane receives the two bytes holding its pixel; even pixels
+        // sit in the low 12 bits, odd pixels in the high 12 bits.
+        const __m128i s = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i / 2 * 3)), spread);
+        const __m128i pixels = _mm_or_si128(_mm_and_si128(s, evenMask), _mm_and_si128(_mm_srli_epi16(s, 4), oddMask));
+        // The maximum code is the white fill: all ones where it matches.
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_or_si128(pixels, _mm_cmpeq_epi16(pixels, maxCode)));
+    }
+    return i;
+}
+#endif
+
+/**
+ * @brief Pack four pixels per 64-bit word (SWAR).
+ * @return Number of pixels packed; always a multiple of 4.
+ */
+int packSwar(const uint16_t* src, uint8_t* dst, int first, int count, int bits, size_t totalBytes)
+{
+    const uint64_t mask = (1u << bits) - 1;
+    const size_t groupBytes = static_cast<size_t>(bits) / 2; // 4 pixels = 6 or 7 bytes
+
+    int i = first;
+    for (; i + 4 <= count && static_cast<size_t>(i) / 4 * groupBytes + 8 <= totalBytes; i += 4)
+    {
+        const uint64_t v = (src[i] & mask) | (src[i + 1] & mask) << bits |
+            (src[i + 2] & mask) << (2 * bits) | (src[i + 3] & mask) << (3 * bits);
+        // The 8-byte store spills zero bytes into the next group, which overwrites them.
+        qToLittleEndian<quint64>(v, dst + static_cast<size_t>(i) / 4 * groupBytes);
+    }
+    return i;
+}
+
+/**
+ * @brief Unpack four pixels per 64-bit word (SWAR).
+ * @return Number of pixels unpacked; always a multiple of 4.
+ */
+int unpackSwar(const uint8_t* src, uint16_t* dst, int first, int count, int bits, size_t totalBytes)
+{
+    const uint64_t mask = (1u << bits) - 1;
+    const size_t groupBytes = static_cast<size_t>(bits) / 2;
+
+    int i = first;
+    for (; i + 4 <= count && static_cast<size_t>(i) / 4 * groupBytes + 8 <= totalBytes; i += 4)
+    {
+        const uint64_t v = qFromLittleEndian<quint64>(src + static_cast<size_t>(i) / 4 * groupBytes);
+        dst[i] = whiteFill(static_cast<uint32_t>(v & mask), static_cast<uint32_t>(mask));
+        dst[i + 1] = whiteFill(static_cast<uint32_t>(v >> bits & mask), static_cast<uint32_t>(mask));
+        dst[i + 2] = whiteFill(static_cast<uint32_t>(v >> (2 * bits) & mask), static_cast<uint32_t>(mask));
+        dst[i + 3] = whiteFill(static_cast<uint32_t>(v >> (3 * bits) & mask), static_cast<uint32_t>(mask));
+    }
+    return i;
+}
+
+} // namespace
+
+
+PackedFrame::PackedFrame(const ImageFrame& frame, int bits) :
+    m_width(frame.width), m_height(frame.height), m_bits(bits == 12 || bits == 14 ? bits : 16),
+    m_slot(frame.slot), m_slotCount(frame.slotCount), m_bitsStored(frame.bitsStored), m_stats(frame.stats),
+    m_metadata(frame.metadata)
+{
+    if (isNull())
+        return;
+
+    m_rowBytes = packedSize(m_width, m_bits);
+    m_data.resize(m_rowBytes * m_height);
+    for (int y = 0; y < m_height; ++y)
+        packRow(frame.row(y), m_data.data() + static_cast<size_t>(y) * m_rowBytes, m_width, m_bits);
+}
+
+int PackedFrame::packedBits(int bitsStored)
+{
+    if (bitsStored > 0 && bitsStored <= 12)
+        return 12;
+    if (bitsStored > 12 && bitsStored <= 14)
+        return 14;
+    return 16;
+}
+
+bool PackedFrame::isLossless(const ImageFrame& frame, int bits)
+{
+    if (bits != 12 && bits != 14)
+        return true;
+
+    const uint16_t maxCode = static_cast<uint16_t>((1u << bits) - 1);
+    for (int y = 0; y < frame.height; ++y)
+    {
+        const uint16_t* row = frame.row(y);
+        for (int x = 0; x < frame.width; ++x)
+        {
+            if (row[x] >= maxCode && row[x] != 0xFFFF)
+                return false;
+        }
+    }
+    return true;
+}
+
+size_t PackedFrame::packedSize(int count, int bits)
+{
+    return (static_cast<size_t>(count) * bits + 7) / 8;
+}
+
+void PackedFrame::packRow(const uint16_t* src, uint8_t* dst, int count, int bits)
+{
+    if (bits == 16)
+    {
+        qToLittleEndian<quint16>(src, count, dst);
+        return;
+    }
+
+    const size_t totalBytes = packedSize(count, bits);
+    int i = 0;
+#ifdef PACKED_FRAME_SSSE3
+    if (bits == 12 && hasSsse3())
+        i = pack12Ssse3(src, dst, count, totalBytes);
+#endif
+    i = packSwar(src, dst, i, count, bits, totalBytes);
+
+    // Tail: bit accumulator starting at the byte-aligned group boundary.
+    const uint32_t mask = (1u << bits) - 1;
+    uint8_t* out = dst + static_cast<size_t>(i) * bits / 8;
+    uint32_t acc = 0;
+    int pending = 0;
+    for (; i < count; ++i)
+    {
+        acc |= (src[i] & mask) << pending;
+        pending += bits;
+        for (; pending >= 8; pending -= 8, acc >>= 8)
+            *out++ = static_cast<uint8_t>(acc);
+    }
+    if (pending > 0)
+        *out = static_cast<uint8_t>(acc);
+}
+
+void PackedFrame::unpackRow(const uint8_t* src, uint16_t* dst, int count, int bits)
+{
+    if (bits == 16)
+    {
+        qFromLittleEndian<quint16>(src, count, dst);
+        return;
+    }
+
+    const size_t totalBytes = packedSize(count, bits);
+    int i = 0;
+#ifdef PACKED_FRAME_SSSE3
+    if (bits == 12 && hasSsse3())
+        i = unpack12Ssse3(src, dst, count, totalBytes);
+#endif
+    i = unpackSwar(src, dst, i, count, bits, totalBytes);
+
+    const uint32_t mask = (1u << bits) - 1;
+    const uint8_t* in = src + static_cast<size_t>(i) * bits / 8;
+    uint32_t acc = 0;
+    int pending = 0;
+    for (; i < count; ++i)
+    {
+        for (; pending < bits; pending += 8)
+            acc |= static_cast<uint32_t>(*in++) << pending;
+        dst[i] = whiteFill(acc & mask, mask);
+        acc >>= bits;
+        pending -= bits;
+    }
+}
+
+ImageFramePtr PackedFrame::unpack() const
+{
+    if (isNull())
+        return {};
+
+    QSharedPointer<ImageFrame> frame(new ImageFrame);
+    frame->width = m_width;
+    frame->height = m_height;
+    frame->slot = m_slot;
+    frame->slotCount = m_slotCount;
+    frame->bitsStored = m_bitsStored;
+    frame->stats = m_stats;
+    frame->metadata = m_metadata;
+    uint16_t* pixels = frame->allocatePixels();
+    for (int y = 0; y < m_height; ++y)
+        row(y, pixels + static_cast<size_t>(y) * m_width);
+    return frame;
+}
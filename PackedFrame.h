@@ -0,0 +1,120 @@
+#pragma once
+
+#include "ImageFrame.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+/**
+ * @brief Bit-packed in-memory copy of an ImageFrame.
+ *
+ * Frames whose `BitsStored` is 12 or 14 are stored with 12 or 14 bits per
+ * pixel instead of 16, which cuts the memory and cache bandwidth of frames
+ * held in a backlog or an archive working set by 25 % or 12.5 %. Rows are
+ * packed independently as a little-endian bit stream (pixel i occupies bits
+ * [i * bits, (i + 1) * bits) of the row), so single rows can be unpacked
+ * without touching the rest of the frame.
+ *
+ * Pixel values are truncated to the packed bit depth. The maximum code of
+ * that depth is reserved for the 0xFFFF white fill of unscanned areas and
+ * unpacks to 0xFFFF again, so a frame whose pixels are all below the
+ * maximum code or white survives packing unchanged (see isLossless()).
+ * Frames with 16-bit values (unknown or scaled `BitsStored`) are stored
+ * unpacked. ScanArchive stores uncompressed records packed.
+ */
+class PackedFrame {
+public:
+    PackedFrame() = default;
+
+    /**
+     * @brief Pack a decoded frame.
+     * @param frame Frame to pack.
+     * @param bits Packed bit depth: 12, 14 or 16. Use packedBits() to derive it from `BitsStored`.
+     */
+    PackedFrame(const ImageFrame& frame, int bits);
+
+    /**
+     * @brief Pack a decoded frame at the depth selected from its `BitsStored`.
+     * @param frame Frame to pack.
+     */
+    explicit PackedFrame(const ImageFrame& frame) : PackedFrame(frame, packedBits(frame.bitsStored)) { }
+
+    /**
+     * @brief Choose the packed bit depth for a `BitsStored` value.
+     * @param bitsStored Bits per pixel reported by the JSON header (0 = unknown).
+     * @return 12, 14 or 16.
+     */
+    static int packedBits(int bitsStored);
+
+    /**
+     * @brief Whether packing a frame at a depth and unpacking it gives back the same pixels.
+     * @param frame Frame to check.
+     * @param bits Packed bit depth (12, 14 or 16).
+     */
+    static bool isLossless(const ImageFrame& frame, int bits);
+
+    /**
+     * @brief Number of bytes needed for @p count packed pixels.
+     * @param count Number of pixels.
+     * @param bits Packed bit depth (12, 14 or 16).
+     */
+    static size_t packedSize(int count, int bits);
+
+    /**
+     * @brief Pack 16-bit pixels into a bit stream.
+     * @param src Source pixels.
+     * @param dst Destination with room for packedSize(count, bits) bytes.
+     * @param count Number of pixels.
+     * @param bits Packed bit depth (12, 14 or 16).
+     */
+    static void packRow(const uint16_t* src, uint8_t* dst, int count, int bits);
+
+    /**
+     * @brief Unpack a bit stream into 16-bit pixels; the maximum code becomes 0xFFFF.
+     * @param src Packed bytes as written by packRow().
+     * @param dst Destination with room for @p count pixels.
+     * @param count Number of pixels.
+     * @param bits Packed bit depth (12, 14 or 16).
+     */
+    static void unpackRow(const uint8_t* src, uint16_t* dst, int count, int bits);
+
+    int width() const { return m_width; } ///< Width in pixels.
+    int height() const { return m_height; } ///< Height in pixels.
+    int bits() const { return m_bits; } ///< Packed bits per pixel.
+    size_t rowBytes() const { return m_rowBytes; } ///< Bytes per packed row.
+    size_t byteSize() const { return m_data.size(); } ///< Total packed size in bytes.
+    bool isNull() const { return m_width <= 0 || m_height <= 0; } ///< Whether the frame is empty.
+
+    /**
+     * @brief Pointer to the packed bytes of a row.
+     * @param y Row index in [0, height()).
+     */
+    const uint8_t* packedRow(int y) const { return m_data.data() + static_cast<size_t>(y) * m_rowBytes; }
+
+    /**
+     * @brief Unpack one row.
+     * @param y Row index in [0, height()).
+     * @param dst Destination with room for width() pixels.
+     */
+    void row(int y, uint16_t* dst) const { unpackRow(packedRow(y), dst, m_width, m_bits); }
+
+    /**
+     * @brief Unpack the whole frame.
+     * @return Frame with 16-bit pixels and the original slot and statistics.
+     */
+    ImageFramePtr unpack() const;
+
+private:
+    std::vector<uint8_t> m_data; ///< Packed rows, m_rowBytes each.
+    size_t m_rowBytes = 0; ///< Bytes per packed row.
+    int m_width = 0; ///< Width in pixels.
+    int m_height = 0; ///< Height in pixels.
+    int m_bits = 16; ///< Packed bits per pixel.
+    int m_slot = 0; ///< Slot index of the source frame.
+    int m_slotCount = 1; ///< Slot count of the source frame.
+    int m_bitsStored = 0; ///< `BitsStored` of the source frame.
+    DecodeStats m_stats; ///< Decode statistics of the source frame.
+    ImageMetadata m_metadata; ///< JSON header of the source frame.
+};
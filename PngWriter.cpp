@@ -0,0 +1,461 @@
+#include "PngWriter.h"
+
+#include <qendian.h>
+#include <qthreadpool.h>
+
+#if __has_include(<QtZlib/zlib.h>)
+#include <QtZlib/zlib.h> // zlib bundled with and exported by Qt
+#else
+#include <zlib.h>
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+
+namespace {
+
+constexpr int PNG_BYTES_PER_PIXEL = 2; ///< 16-bit grayscale.
+constexpr size_t DEFLATE_WINDOW = 32 * 1024; ///< Dictionary carried over between bands.
+
+/**
+ * @brief Paeth predictor (PNG specification, section 9.4).
+ */
+inline uint8_t paeth(int a, int b, int c)
+{
+    const int p = a + b - c;
+    const int pa = std::abs(p - a);
+    const int pb = std::abs(p - b);
+    const int pc = std::abs(p - c);
+    if (pa <= pb && pa <= pc)
+        return static_cast<uint8_t>(a);
+    return static_cast<uint8_t>(pb <= pc ? b : c);
+}
+
+/**
+ * @brief Magnitude of a filtered byte read as signed, as used by the libpng heuristic.
+ */
+inline int magnitude(uint8_t v)
+{
+    return v < 128 ? v : 256 - v;
+}
+
+} // namespace
+
+
+/**
+ * @brief State of a row stream: one deflate stream over all rows.
+ */
+struct PngWriter::RowStream {
+    QIODevice* device = nullptr; ///< Output device.
+    RasterInfo info; ///< Geometry passed to begin().
+    int rows = 0; ///< Rows written.
+    z_stream zs = {}; ///< zlib stream, with the zlib header and Adler-32.
+    std::vector<uint8_t> prev; ///< Big-endian samples of the row above.
+    std::vector<uint8_t> cur; ///< Big-endian samples of the current row.
+    std::vector<uint8_t> filtered; ///< Filter type byte and filtered row.
+    QByteArray idat; ///< Compressed bytes not yet written as a chunk.
+
+    ~RowStream() { deflateEnd(&zs); }
+};
+
+PngWriter::PngWriter(int compressionLevel, int threads) :
+    m_level(compressionLevel), m_threads(threads)
+{
+}
+
+PngWriter::~PngWriter() = default;
+
+bool PngWriter::write(const ImageFrame& frame, QIODevice& device, const Progress& progress)
+{
+    m_error.clear();
+    if (frame.width <= 0 || frame.height <= 0)
+    {
+        m_error = "Empty frame";
+        return false;
+    }
+
+    if (!writeHeader(device, RasterInfo::of(frame)))
+        return false;
+
+    // Bands of about PNG_BAND_BYTES filtered bytes, at least one row each.
+    const qint64 filteredRowBytes = static_cast<qint64>(frame.width) * PNG_BYTES_PER_PIXEL + 1;
+    const int rowsPerBand = static_cast<int>(std::max<qint64>(1, PNG_BAND_BYTES / filteredRowBytes));
+    std::vector<Band> bands((frame.height + rowsPerBand - 1) / rowsPerBand);
+    for (size_t i = 0; i < bands.size(); ++i)
+    {
+        bands[i].firstRow = static_cast<int>(i) * rowsPerBand;
+        bands[i].lastRow = std::min(frame.height, bands[i].firstRow + rowsPerBand);
+    }
+
+    QThreadPool pool;
+    setupBandPool(pool, m_threads);
+
+    std::mutex mutex;
+    std::condition_variable bandDone;
+    std::vector<char> done(bands.size(), 0);
+
+    // Keep a bounded window of bands in flight and write them strictly in order.
+    const size_t window = static_cast<size_t>(pool.maxThreadCount()) * 2;
+    size_t submitted = 0;
+    quint32 adler = 1;
+    bool ok = true;
+    for (size_t written = 0; written < bands.size() && ok; ++written)
+    {
+        for (; submitted < bands.size() && submitted < written + window; ++submitted)
+        {
+            pool.start([this, &frame, &bands, &mutex, &bandDone, &done, i = submitted] {
+                compressBand(frame, bands[i], i + 1 == bands.size());
+                std::lock_guard<std::mutex> lock(mutex);
+                done[i] = 1;
+                bandDone.notify_all();
+            });
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            bandDone.wait(lock, [&] { return done[written] != 0; });
+        }
+
+        Band& band = bands[written];
+        if (!band.ok)
+        {
+            m_error = "Deflate failed in rows " + QString::number(band.firstRow) + ".." + QString::number(band.lastRow - 1);
+            ok = false;
+            break;
+        }
+
+        // The zlib header goes in front of the first band, the combined Adler-32 behind the last.
+        QByteArray idat;
+        if (written == 0)
+        {
+            const int flevel = m_level < 0 || m_level == 6 ? 2 : m_level < 2 ? 0 : m_level < 6 ? 1 : 3;
+            const int cmf = 0x78; // deflate, 32 KB window
+            const int flg = flevel << 6;
+            idat.append(char(cmf));
+            idat.append(char(flg + 31 - (cmf * 256 + flg) % 31));
+        }
+        idat.append(band.data);
+        adler = static_cast<quint32>(adler32_combine(adler, band.adler, static_cast<z_off_t>(band.filteredBytes)));
+        if (written + 1 == bands.size())
+            appendBE32(idat, adler);
+
+        band.data = QByteArray();
+        ok = writeChunk(device, "IDAT", idat);
+
+        if (progress)
+            progress(static_cast<int>((written + 1) * 100 / bands.size()));
+    }
+
+    // Jobs still in flight reference the local state.
+    pool.waitForDone();
+    return ok && writeChunk(device, "IEND", QByteArray());
+}
+
+bool PngWriter::writeHeader(QIODevice& device, const RasterInfo& info)
+{
+    static const char signature[8] = { '\x89', 'P', 'N', 'G', '\r', '\n', '\x1a', '\n' };
+    if (device.write(signature, sizeof(signature)) != sizeof(signature))
+    {
+        m_error = device.errorString();
+        return false;
+    }
+
+    QByteArray ihdr;
+    appendBE32(ihdr, static_cast<quint32>(info.width));
+    appendBE32(ihdr, static_cast<quint32>(info.height));
+    ihdr.append(char(16)); // bit depth
+    ihdr.append(char(0)); // grayscale
+    ihdr.append(char(0)); // deflate
+    ihdr.append(char(0)); // adaptive filtering
+    ihdr.append(char(0)); // no interlace
+    if (!writeChunk(device, "IHDR", ihdr))
+        return false;
+
+    if (info.bitsStored > 0 && info.bitsStored < 16 && !writeChunk(device, "sBIT", QByteArray(1, char(info.bitsStored))))
+        return false;
+
+    const ImageMetadata& metadata = info.metadata;
+    if (metadata.pixelSpacingX > 0.0 && metadata.pixelSpacingY > 0.0)
+    {
+        QByteArray phys;
+        appendBE32(phys, static_cast<quint32>(std::lround(1000.0 / metadata.pixelSpacingX))); // pixels per metre
+        appendBE32(phys, static_cast<quint32>(std::lround(1000.0 / metadata.pixelSpacingY)));
+        phys.append(char(1)); // unit: metre
+        if (!writeChunk(device, "pHYs", phys))
+            return false;
+    }
+    return true;
+}
+
+bool PngWriter::begin(QIODevice& device, const RasterInfo& info)
+{
+    m_error.clear();
+    m_stream.reset();
+    if (info.width <= 0 || info.height < 0)
+    {
+        m_error = "Empty frame";
+        return false;
+    }
+    if (info.height == 0 && device.isSequential())
+    {
+        m_error = "A deferred height needs a seekable device";
+        return false;
+    }
+
+    std::unique_ptr<RowStream> stream(new RowStream);
+    if (deflateInit2(&stream->zs, m_level, Z_DEFLATED, MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        m_error = "Deflate initialization failed";
+        return false;
+    }
+    if (!writeHeader(device, info))
+        return false;
+
+    const size_t rowBytes = static_cast<size_t>(info.width) * PNG_BYTES_PER_PIXEL;
+    stream->device = &device;
+    stream->info = info;
+    stream->prev.assign(rowBytes, 0);
+    stream->cur.resize(rowBytes);
+    stream->filtered.resize(rowBytes + 1);
+    m_stream = std::move(stream);
+    return true;
+}
+
+bool PngWriter::writeRows(const uint16_t* pixels, int count)
+{
+    if (!m_stream)
+    {
+        m_error = "Writer not started";
+        return false;
+    }
+
+    RowStream& stream = *m_stream;
+    const int width = stream.info.width;
+    if (stream.info.height > 0 && count > stream.info.height - stream.rows)
+    {
+        m_error = "More rows than announced";
+        return false;
+    }
+
+    for (int r = 0; r < count; ++r)
+    {
+        qToBigEndian<quint16>(pixels + static_cast<size_t>(r) * width, width, stream.cur.data());
+        filterRow(stream.cur.data(), stream.prev.data(), stream.cur.size(), stream.filtered.data());
+        std::swap(stream.prev, stream.cur);
+
+        stream.zs.next_in = stream.filtered.data();
+        stream.zs.avail_in = static_cast<uInt>(stream.filtered.size());
+        if (!deflateRows(Z_NO_FLUSH))
+            return false;
+    }
+    stream.rows += count;
+    return true;
+}
+
+bool PngWriter::finish()
+{
+    if (!m_stream)
+    {
+        m_error = "Writer not started";
+        return false;
+    }
+
+    RowStream& s = *m_stream;
+    const bool deferred = s.info.height == 0;
+    bool ok = true;
+    if (s.rows == 0 || (!deferred && s.rows != s.info.height))
+    {
+        m_error = s.rows == 0 ? QString("Empty frame") : QString("Missing rows: %1 of %2 written").arg(s.rows).arg(s.info.height);
+        ok = false;
+    }
+    ok = ok && deflateRows(Z_FINISH) && writeChunk(*s.device, "IEND", QByteArray());
+
+    if (ok && deferred)
+    {
+        // Rewrite IHDR (behind the 8-byte signature) with the final height.
+        QIODevice& device = *s.device;
+        const qint64 end = device.pos();
+        QByteArray ihdr;
+        appendBE32(ihdr, static_cast<quint32>(s.info.width));
+        appendBE32(ihdr, static_cast<quint32>(s.rows));
+        ihdr.append(char(16));
+        ihdr.append(QByteArray(4, '\0'));
+        ok = device.seek(8) && writeChunk(device, "IHDR", ihdr) && device.seek(end);
+        if (!ok && m_error.isEmpty())
+            m_error = device.errorString();
+    }
+    m_stream.reset();
+    return ok;
+}
+
+bool PngWriter::deflateRows(int flush)
+{
+    RowStream& stream = *m_stream;
+    int ret = Z_OK;
+    do
+    {
+        // Output goes straight into the pending IDAT data, a chunk is written once it is full.
+        const qsizetype size = stream.idat.size();
+        stream.idat.resize(std::max<qsizetype>(size * 2, PNG_BAND_BYTES));
+        stream.zs.next_out = reinterpret_cast<Bytef*>(stream.idat.data()) + size;
+        stream.zs.avail_out = static_cast<uInt>(stream.idat.size() - size);
+        ret = deflate(&stream.zs, flush);
+        stream.idat.resize(stream.idat.size() - static_cast<qsizetype>(stream.zs.avail_out));
+        if (ret == Z_STREAM_ERROR)
+        {
+            m_error = "Deflate failed";
+            return false;
+        }
+
+        if (stream.idat.size() >= PNG_BAND_BYTES || (flush == Z_FINISH && ret == Z_STREAM_END && !stream.idat.isEmpty()))
+        {
+            if (!writeChunk(*stream.device, "IDAT", stream.idat))
+                return false;
+            stream.idat.clear();
+        }
+    } while (stream.zs.avail_in > 0 || (flush == Z_FINISH && ret != Z_STREAM_END));
+    return true;
+}
+
+void PngWriter::compressBand(const ImageFrame& frame, Band& band, bool last) const
+{
+    const size_t rowBytes = static_cast<size_t>(frame.width) * PNG_BYTES_PER_PIXEL;
+    std::vector<uint8_t> prev(rowBytes, 0);
+    std::vector<uint8_t> cur(rowBytes);
+    std::vector<uint8_t> filtered(rowBytes + 1);
+
+    z_stream zs = {};
+    if (deflateInit2(&zs, m_level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return;
+
+    // Prime the dictionary with the filtered tail of the band above, as a single stream would have seen it.
+    if (band.firstRow > 0)
+    {
+        const int dictRows = std::min<int>(band.firstRow, static_cast<int>((DEFLATE_WINDOW + rowBytes) / (rowBytes + 1)));
+        const int start = band.firstRow - dictRows;
+        if (start > 0)
+            rowToBigEndian(frame, start - 1, prev.data());
+
+        std::vector<uint8_t> dictionary;
+        dictionary.reserve(static_cast<size_t>(dictRows) * (rowBytes + 1));
+        for (int y = start; y < band.firstRow; ++y)
+        {
+            rowToBigEndian(frame, y, cur.data());
+            filterRow(cur.data(), prev.data(), rowBytes, filtered.data());
+            dictionary.insert(dictionary.end(), filtered.begin(), filtered.end());
+            std::swap(prev, cur);
+        }
+        const size_t size = std::min(dictionary.size(), DEFLATE_WINDOW);
+        deflateSetDictionary(&zs, dictionary.data() + dictionary.size() - size, static_cast<uInt>(size));
+    }
+
+    const qint64 inputBytes = static_cast<qint64>(band.lastRow - band.firstRow) * static_cast<qint64>(rowBytes + 1);
+    band.data.resize(static_cast<qsizetype>(deflateBound(&zs, static_cast<uLong>(inputBytes))) + 64);
+
+    // Feed deflate, growing the output when the bound is exceeded (sync flush markers are not in the bound).
+    auto pump = [&](int flush) {
+        int ret = Z_OK;
+        do
+        {
+            if (static_cast<qsizetype>(zs.total_out) == band.data.size())
+                band.data.resize(band.data.size() * 2);
+            zs.next_out = reinterpret_cast<Bytef*>(band.data.data()) + zs.total_out;
+            zs.avail_out = static_cast<uInt>(band.data.size() - static_cast<qsizetype>(zs.total_out));
+            ret = deflate(&zs, flush);
+            if (ret == Z_STREAM_ERROR)
+                return false;
+        } while (zs.avail_out == 0 || (flush == Z_FINISH && ret != Z_STREAM_END));
+        return true;
+    };
+
+    band.adler = static_cast<quint32>(adler32(0, nullptr, 0));
+    bool ok = true;
+    for (int y = band.firstRow; y < band.lastRow && ok; ++y)
+    {
+        rowToBigEndian(frame, y, cur.data());
+        filterRow(cur.data(), prev.data(), rowBytes, filtered.data());
+        std::swap(prev, cur);
+
+        band.adler = static_cast<quint32>(adler32(band.adler, filtered.data(), static_cast<uInt>(filtered.size())));
+        band.filteredBytes += static_cast<qint64>(filtered.size());
+        zs.next_in = filtered.data();
+        zs.avail_in = static_cast<uInt>(filtered.size());
+        ok = pump(Z_NO_FLUSH);
+    }
+
+    // A sync flush ends the band on a byte boundary without the final-block bit.
+    ok = ok && pump(last ? Z_FINISH : Z_SYNC_FLUSH);
+    band.data.resize(static_cast<qsizetype>(zs.total_out));
+    deflateEnd(&zs);
+    band.ok = ok;
+}
+
+void PngWriter::filterRow(const uint8_t* cur, const uint8_t* prev, size_t bytes, uint8_t* out)
+{
+    constexpr size_t bpp = PNG_BYTES_PER_PIXEL;
+
+    // libpng heuristic: pick the filter with the smallest sum of absolute (signed) outputs.
+    qint64 sums[5] = {};
+    for (size_t i = 0; i < bytes; ++i)
+    {
+        const int x = cur[i];
+        const int a = i >= bpp ? cur[i - bpp] : 0;
+        const int b = prev[i];
+        const int c = i >= bpp ? prev[i - bpp] : 0;
+        sums[0] += magnitude(static_cast<uint8_t>(x));
+        sums[1] += magnitude(static_cast<uint8_t>(x - a));
+        sums[2] += magnitude(static_cast<uint8_t>(x - b));
+        sums[3] += magnitude(static_cast<uint8_t>(x - ((a + b) >> 1)));
+        sums[4] += magnitude(static_cast<uint8_t>(x - paeth(a, b, c)));
+    }
+    const int type = static_cast<int>(std::min_element(sums, sums + 5) - sums);
+
+    out[0] = static_cast<uint8_t>(type);
+    uint8_t* dst = out + 1;
+    for (size_t i = 0; i < bytes; ++i)
+    {
+        const int a = i >= bpp ? cur[i - bpp] : 0;
+        const int b = prev[i];
+        const int c = i >= bpp ? prev[i - bpp] : 0;
+        int predictor = 0;
+        switch (type)
+        {
+            case 1: predictor = a; break;
+            case 2: predictor = b; break;
+            case 3: predictor = (a + b) >> 1; break;
+            case 4: predictor = paeth(a, b, c); break;
+            default: break;
+        }
+        dst[i] = static_cast<uint8_t>(cur[i] - predictor);
+    }
+}
+
+void PngWriter::rowToBigEndian(const ImageFrame& frame, int y, uint8_t* out)
+{
+    qToBigEndian<quint16>(frame.row(y), frame.width, out);
+}
+
+bool PngWriter::writeChunk(QIODevice& device, const char* type, const QByteArray& data)
+{
+    QByteArray header;
+    appendBE32(header, static_cast<quint32>(data.size()));
+    header.append(type, 4);
+
+    uLong crc = crc32(0, reinterpret_cast<const Bytef*>(type), 4);
+    crc = crc32(crc, reinterpret_cast<const Bytef*>(data.constData()), static_cast<uInt>(data.size()));
+    QByteArray trailer;
+    appendBE32(trailer, static_cast<quint32>(crc));
+
+    if (device.write(header) != header.size() || device.write(data) != data.size() || device.write(trailer) != trailer.size())
+    {
+        m_error = device.errorString();
+        return false;
+    }
+    return true;
+}
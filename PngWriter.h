@@ -0,0 +1,143 @@
+#pragma once
+
+#include <qbytearray.h>
+#include <qiodevice.h>
+#include <qstring.h>
+
+#include "CR35Utils.h"
+#include "ImageFrame.h"
+#include "RasterWriter.h"
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+
+/**
+ * @brief 16-bit grayscale PNG encoder that compresses row bands in parallel.
+ *
+ * The image is split into bands of about PNG_BAND_BYTES filtered bytes.
+ * Every band is deflated on its own thread into a raw deflate stream that
+ * ends on a byte boundary (sync flush), pigz style. The bands are joined
+ * into the single zlib stream the PNG format requires, and the per-band
+ * Adler-32 checksums are combined. Each band is primed with the last 32 KB of
+ * the band before it as its dictionary, so the compression ratio stays
+ * close to that of a single stream.
+ *
+ * Rows use the adaptive filter selection of libpng (minimum sum of absolute
+ * differences over None/Sub/Up/Average/Paeth). `BitsStored` below 16 is
+ * recorded in an sBIT chunk, and the pixel spacing in a pHYs chunk.
+ *
+ * Bands are written in order as soon as they are complete, so at most a
+ * few compressed bands are held in memory.
+ *
+ * Rows can also be streamed (begin(), writeRows(), finish()) while they
+ * are decoded. They are then filtered and deflated as one stream on the
+ * calling thread, and IDAT chunks are written every PNG_BAND_BYTES. With
+ * a height of 0 the IHDR chunk is completed by finish(), which needs a
+ * seekable device.
+ */
+class PngWriter {
+public:
+    /**
+     * @brief Progress callback, called with 0..100 from the thread running write().
+     */
+    using Progress = std::function<void(int percent)>;
+
+    /**
+     * @brief Create a writer.
+     * @param compressionLevel Deflate level 0..9, -1 for the zlib default.
+     * @param threads Worker threads; 0 uses QThread::idealThreadCount().
+     */
+    explicit PngWriter(int compressionLevel = PNG_COMPRESSION_LEVEL_DEFAULT, int threads = 0);
+    ~PngWriter();
+
+    void setCompressionLevel(int level) { m_level = level; } ///< Deflate level 0..9, -1 for the zlib default.
+    void setThreads(int threads) { m_threads = threads; } ///< Worker threads; 0 = QThread::idealThreadCount().
+
+    /**
+     * @brief Encode a frame.
+     * @param frame Frame to encode.
+     * @param device Open output device.
+     * @param progress Optional progress callback.
+     * @return false on a compression or write error, see errorString().
+     */
+    bool write(const ImageFrame& frame, QIODevice& device, const Progress& progress = {});
+
+    /**
+     * @brief Write the header chunks and start a row stream.
+     * @param device Open output device; must stay open until finish().
+     * @param info Image geometry; a height of 0 is taken from the rows written.
+     * @return false on a write error, see errorString().
+     */
+    bool begin(QIODevice& device, const RasterInfo& info);
+
+    /**
+     * @brief Filter and deflate rows.
+     * @param pixels count * width tightly packed pixels, in host byte order.
+     * @param count Number of rows.
+     */
+    bool writeRows(const uint16_t* pixels, int count);
+
+    /**
+     * @brief End the zlib stream, write IEND and complete a deferred height.
+     */
+    bool finish();
+
+    QString errorString() const { return m_error; } ///< Description of the last failure.
+
+private:
+    struct RowStream;
+
+    /**
+     * @brief Write the signature, IHDR, sBIT and pHYs.
+     */
+    bool writeHeader(QIODevice& device, const RasterInfo& info);
+
+    /**
+     * @brief Deflate the pending input of the row stream and write full IDAT chunks.
+     * @param flush zlib flush mode; Z_FINISH writes everything.
+     */
+    bool deflateRows(int flush);
+
+    /**
+     * @brief One independently compressed row band.
+     */
+    struct Band {
+        int firstRow = 0; ///< First image row.
+        int lastRow = 0; ///< Row after the band.
+        QByteArray data; ///< Raw deflate output (sync flushed, final block only for the last band).
+        quint32 adler = 1; ///< Adler-32 of the filtered bytes.
+        qint64 filteredBytes = 0; ///< Filtered bytes (filter type byte + samples) fed to deflate.
+        bool ok = false; ///< Whether compression succeeded.
+    };
+
+    /**
+     * @brief Filter and deflate the rows of one band.
+     */
+    void compressBand(const ImageFrame& frame, Band& band, bool last) const;
+
+    /**
+     * @brief Filter one row with the filter type of minimum absolute sum.
+     * @param cur Big-endian samples of the row.
+     * @param prev Big-endian samples of the row above (zeros for the first row).
+     * @param bytes Bytes per row.
+     * @param out Receives the filter type byte followed by @p bytes filtered bytes.
+     */
+    static void filterRow(const uint8_t* cur, const uint8_t* prev, size_t bytes, uint8_t* out);
+
+    /**
+     * @brief Convert a frame row to big-endian bytes.
+     */
+    static void rowToBigEndian(const ImageFrame& frame, int y, uint8_t* out);
+
+    /**
+     * @brief Write one PNG chunk with its CRC.
+     */
+    bool writeChunk(QIODevice& device, const char* type, const QByteArray& data);
+
+    int m_level; ///< Deflate level.
+    int m_threads; ///< Worker threads (0 = ideal thread count).
+    std::unique_ptr<RowStream> m_stream; ///< Row stream between begin() and finish().
+    QString m_error; ///< Last failure description.
+};
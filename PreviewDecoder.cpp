@@ -0,0 +1,130 @@
+#include "PreviewDecoder.h"
+
+#include <algorithm>
+
+
+PreviewDecoder::PreviewDecoder(Sink sink) : m_logger("CR35NDTPlus_Preview"), m_decoder(m_logger), m_sink(std::move(sink))
+{
+    m_pool.setMaxThreadCount(1);
+    DecoderOptions options = m_decoder.options();
+    options.collectStats = false;
+    m_decoder.setOptions(options);
+}
+
+PreviewDecoder::~PreviewDecoder()
+{
+    m_pool.clear();
+    m_pool.waitForDone();
+}
+
+void PreviewDecoder::setOptions(const DecoderOptions& options)
+{
+    DecoderOptions preview = options;
+    preview.collectStats = false;
+    post([this, preview] { m_decoder.setOptions(preview); });
+}
+
+void PreviewDecoder::setModeDefaults(const ImageMetadata& defaults)
+{
+    post([this, defaults] { m_decoder.setModeDefaults(defaults); });
+}
+
+void PreviewDecoder::append(const QByteArray& data)
+{
+    post([this, data] {
+        m_stream.append(data);
+        decode();
+    });
+}
+
+void PreviewDecoder::reset()
+{
+    post([this] {
+        m_stream.clear();
+        m_decoder.reset();
+        m_line = 0;
+    });
+}
+
+void PreviewDecoder::post(std::function<void()> job)
+{
+    m_pool.start(std::move(job));
+}
+
+void PreviewDecoder::decode()
+{
+    for (;;)
+    {
+        const bool complete = m_decoder.decode(m_stream);
+        emitLines(complete);
+        if (!complete)
+        {
+            // Emitted lines are not needed again.
+            m_decoder.release(m_stream, m_line);
+            return;
+        }
+
+        // Bytes following the end marker belong to the next image; carry them over.
+        ImageStream next;
+        const qint64 consumed = m_decoder.position();
+        if (consumed < m_stream.size())
+        {
+            ImageStream::Reader reader(m_stream, consumed);
+            next.append(reader.readBytes(m_stream.size() - consumed));
+        }
+        m_stream = std::move(next);
+        m_decoder.reset();
+        m_line = 0;
+        if (m_stream.isEmpty())
+            return;
+    }
+}
+
+void PreviewDecoder::emitLines(bool last)
+{
+    // Trailing bad lines wait for the good line below them, so the preview matches the frame.
+    const int lineCount = m_decoder.finalLineCount();
+    if (lineCount == 0 || (lineCount == m_line && !last))
+        return;
+
+    // The width is fixed by the first block of an image: `PixLine`, or the first line when it is unknown.
+    if (m_line == 0)
+    {
+        const int width = m_decoder.pixLine() > 0 ? m_decoder.pixLine() : m_decoder.scanLine(0).endX;
+        m_sampler.reset(width, (width + PREVIEW_MAX_WIDTH - 1) / PREVIEW_MAX_WIDTH);
+        m_lineBuffer.resize(static_cast<size_t>(std::max(width, 0)));
+        m_rows = 0;
+    }
+    if (m_sampler.width() <= 0)
+        return;
+
+    // Lines are averaged down while they are assembled; only preview rows leave this thread.
+    QSharedPointer<LineBlock> block(new LineBlock);
+    block->firstLine = m_rows;
+    block->width = m_sampler.outputWidth();
+    block->factor = m_sampler.factor();
+    block->bitsStored = m_decoder.frameBitsStored();
+    block->last = last;
+    block->pixels.reserve(static_cast<size_t>((lineCount - m_line) / block->factor + 1) * block->width);
+    for (int line = m_line; line < lineCount; ++line)
+    {
+        m_decoder.assembleLine(m_stream, line, 0, m_sampler.width(), m_lineBuffer.data());
+        if (m_sampler.addLine(m_lineBuffer.data()))
+        {
+            block->pixels.resize(block->pixels.size() + block->width);
+            m_sampler.finishRow(block->pixels.data() + block->pixels.size() - block->width);
+        }
+    }
+    if (last && m_sampler.summedLines() > 0)
+    {
+        block->pixels.resize(block->pixels.size() + block->width);
+        m_sampler.finishRow(block->pixels.data() + block->pixels.size() - block->width);
+    }
+    m_line = lineCount;
+
+    block->count = static_cast<int>(block->pixels.size() / block->width);
+    if (block->count == 0 && !last)
+        return;
+    m_rows += block->count;
+    m_sink(block);
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <qbytearray.h>
+#include <qthreadpool.h>
+
+#include "ImageDecoder.h"
+#include "ImageFrame.h"
+#include "ImageStream.h"
+#include "LineDownsampler.h"
+#include "Logger.h"
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+
+/**
+ * @brief Decodes the `ImageData` stream into live preview rows on a thread of its own.
+ *
+ * The device thread only hands over the received packets, which share
+ * their bytes with the caller, so parsing, line assembly and downsampling
+ * never load it. The worker runs its own ImageDecoder with the options
+ * and mode defaults of the device's decoder, so the preview shows the rows
+ * of the frames (correction, region of interest, scaling). After every
+ * packet the lines that became final are assembled over the full
+ * `PixLine` width, box-averaged into rows at most PREVIEW_MAX_WIDTH pixels
+ * wide and passed to the sink as a LineBlock; the decoder then releases
+ * them, so the worker holds only the chunks of the lines in progress.
+ * Image ends are found in the stream, as by the device.
+ *
+ * Its decoder logs to CR35NDTPlus_Preview, so the main log does not list
+ * every image twice.
+ */
+class PreviewDecoder {
+public:
+    /**
+     * @brief Receives the preview rows, on the worker thread.
+     */
+    using Sink = std::function<void(const LineBlockPtr& block)>;
+
+    /**
+     * @brief Construct a decoder and its worker thread.
+     * @param sink Called with every block of preview rows.
+     */
+    explicit PreviewDecoder(Sink sink);
+
+    /**
+     * @brief Drops the packets not decoded yet and waits for the worker thread.
+     */
+    ~PreviewDecoder();
+
+    /**
+     * @brief Decoder options for the following images (see ImageDecoder::setOptions()); statistics are not collected.
+     */
+    void setOptions(const DecoderOptions& options);
+
+    /**
+     * @brief Geometry of the acquisition mode, applied from the next reset() on.
+     */
+    void setModeDefaults(const ImageMetadata& defaults);
+
+    /**
+     * @brief Queue the next packet of the stream.
+     * @param data `ImageData` payload; must continue the stream at an image start or at the previous packet.
+     */
+    void append(const QByteArray& data);
+
+    /**
+     * @brief Forget the image in progress; the next packet starts a new stream.
+     */
+    void reset();
+
+private:
+    /**
+     * @brief Run a job on the worker thread, after all jobs posted before it.
+     */
+    void post(std::function<void()> job);
+
+    // Worker thread.
+    void decode(); ///< Decode the stream, emit its new rows and carry bytes behind an image end over to the next image.
+    void emitLines(bool last); ///< Assemble and emit the lines that became final since the previous block.
+
+    Logger m_logger; ///< Log of the preview decoder.
+    ImageDecoder m_decoder; ///< Decoder of m_stream.
+    ImageStream m_stream; ///< Copy of the stream of the current image.
+    LineDownsampler m_sampler; ///< Averages the current image's lines into preview rows.
+    std::vector<uint16_t> m_lineBuffer; ///< One full-width line, assembled for m_sampler.
+    int m_line = 0; ///< Next line of the current image to emit.
+    int m_rows = 0; ///< Preview rows of the current image emitted so far.
+    Sink m_sink; ///< Receiver of the preview rows.
+    QThreadPool m_pool; ///< Worker thread; one thread runs the jobs in the order they were posted.
+};
@@ -0,0 +1,120 @@
+#include "PreviewExporter.h"
+#include "Histogram.h"
+#include "LineDownsampler.h"
+
+#include <qimagewriter.h>
+#include <qsavefile.h>
+#include <qthreadpool.h>
+
+#include <algorithm>
+#include <vector>
+
+
+QImage PreviewExporter::render(const ImageFrame& frame, const PreviewOptions& options, int threads)
+{
+    if (frame.width <= 0 || frame.height <= 0)
+        return {};
+
+    const int longest = std::max(frame.width, frame.height);
+    const int maxSize = options.maxSize > 0 ? options.maxSize : longest;
+    const int factor = (longest + maxSize - 1) / maxSize;
+    const int width = (frame.width + factor - 1) / factor;
+    const int height = (frame.height + factor - 1) / factor;
+
+    QImage image(width, height, QImage::Format_Grayscale8);
+    if (image.isNull())
+        return {};
+    // bits() may detach; take it once before the workers write their rows.
+    uchar* bits = image.bits();
+    const qsizetype bytesPerLine = image.bytesPerLine();
+    const ToneMap map = toneMap(frame, options, threads);
+
+    QThreadPool pool;
+    setupBandPool(pool, threads);
+    const int bands = (height + PREVIEW_EXPORT_BAND_ROWS - 1) / PREVIEW_EXPORT_BAND_ROWS;
+    if (pool.maxThreadCount() == 1 || bands == 1)
+        renderRows(frame, map, factor, bits, bytesPerLine, width, 0, height);
+    else
+    {
+        for (int band = 0; band < bands; ++band)
+        {
+            const int first = band * PREVIEW_EXPORT_BAND_ROWS;
+            const int count = std::min(PREVIEW_EXPORT_BAND_ROWS, height - first);
+            pool.start([&frame, &map, factor, bits, bytesPerLine, width, first, count] {
+                renderRows(frame, map, factor, bits, bytesPerLine, width, first, count);
+                });
+        }
+        pool.waitForDone();
+    }
+    return image;
+}
+
+bool PreviewExporter::write(const ImageFrame& frame, const QString& path, const PreviewOptions& options,
+    int threads, QString* error)
+{
+    const QImage image = render(frame, options, threads);
+    if (image.isNull())
+        return reportError(error, "Empty frame");
+
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly))
+        return reportError(error, file.errorString());
+
+    QImageWriter writer(&file, options.format);
+    writer.setQuality(options.quality);
+    if (!writer.write(image))
+    {
+        file.cancelWriting();
+        return reportError(error, writer.errorString());
+    }
+    if (!file.commit())
+        return reportError(error, file.errorString());
+    return true;
+}
+
+ToneMap PreviewExporter::toneMap(const ImageFrame& frame, const PreviewOptions& options, int threads)
+{
+    if (options.high > options.low)
+    {
+        ToneMap map;
+        map.setWindow(options.low, options.high, options.gamma);
+        return map;
+    }
+    if (options.autoWindow)
+    {
+        const Histogram::Window window = Histogram::of(frame, threads).autoWindow();
+        ToneMap map;
+        if (window.high > window.low)
+            map.setWindow(window.low, window.high, options.gamma);
+        return map;
+    }
+    ToneMap map = ToneMap::forBitsStored(frame.bitsStored);
+    if (options.gamma != 1.0)
+        map.setWindow(map.low(), map.high(), options.gamma);
+    return map;
+}
+
+void PreviewExporter::renderRows(const ImageFrame& frame, const ToneMap& toneMap, int factor,
+    uchar* bits, qsizetype bytesPerLine, int width, int first, int count)
+{
+    if (factor == 1)
+    {
+        for (int y = first; y < first + count; ++y)
+            toneMap.map(frame.row(y), bits + y * bytesPerLine, static_cast<size_t>(width));
+        return;
+    }
+
+    LineDownsampler sampler;
+    sampler.reset(frame.width, factor);
+    std::vector<uint16_t> row(static_cast<size_t>(width));
+    for (int y = first; y < first + count; ++y)
+    {
+        // The last row group may be smaller.
+        const int top = y * factor;
+        const int rows = std::min(factor, frame.height - top);
+        for (int r = 0; r < rows; ++r)
+            sampler.addLine(frame.row(top + r));
+        sampler.finishRow(row.data());
+        toneMap.map(row.data(), bits + y * bytesPerLine, static_cast<size_t>(width));
+    }
+}
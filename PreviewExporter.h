@@ -0,0 +1,70 @@
+#pragma once
+
+#include <qbytearray.h>
+#include <qimage.h>
+#include <qstring.h>
+
+#include "CR35Utils.h"
+#include "ImageFrame.h"
+#include "ToneMap.h"
+
+
+/**
+ * @brief Settings of the 8-bit preview written next to an export.
+ */
+struct PreviewOptions {
+    QByteArray format = "jpg"; ///< QImageWriter format and file suffix ("webp" needs the Qt image formats plugin).
+    int maxSize = PREVIEW_EXPORT_MAX_SIZE; ///< Longest side in pixels; larger frames are averaged down by an integer factor.
+    int quality = PREVIEW_EXPORT_QUALITY; ///< Encoder quality 0..100.
+    int low = 0; ///< Value shown black.
+    int high = 0; ///< Value shown white; when not above low, the window is automatic or the `BitsStored` range.
+    bool autoWindow = true; ///< Without a window, show the frame's Histogram::autoWindow() instead of the `BitsStored` range.
+    double gamma = 1.0; ///< Exponent of the display curve.
+};
+
+/**
+ * @brief Writes small 8-bit previews of frames, e.g. for a MES.
+ *
+ * The frame is read once: every preview row box-averages its source rows
+ * in a LineDownsampler (column sums with SSE2) and is mapped to 8 bits
+ * through a ToneMap right away, so no 16-bit intermediate image exists. Rows are rendered in bands
+ * on a thread pool and the result is encoded with QImageWriter. Like
+ * ImageExporter, all functions are reentrant, so a preview can be written
+ * while the master file of the same frame is still being encoded.
+ */
+class PreviewExporter {
+public:
+    /**
+     * @brief Render the preview of a frame.
+     * @param frame Source frame.
+     * @param options Size and display window.
+     * @param threads Worker threads; 0 uses QThread::idealThreadCount().
+     * @return Grayscale image; null when the frame is empty.
+     */
+    static QImage render(const ImageFrame& frame, const PreviewOptions& options, int threads = 0);
+
+    /**
+     * @brief Render the preview of a frame and write it to a file.
+     * @param frame Source frame.
+     * @param path Target file.
+     * @param options Format, size and display window.
+     * @param threads Worker threads; 0 uses QThread::idealThreadCount().
+     * @param error Receives the failure description.
+     * @return false when the file could not be written.
+     */
+    static bool write(const ImageFrame& frame, const QString& path, const PreviewOptions& options,
+        int threads = 0, QString* error = nullptr);
+
+    /**
+     * @brief Display mapping of a frame: the options' window, the automatic window, or the `BitsStored` range.
+     * @param threads Worker threads for the histogram of an automatic window.
+     */
+    static ToneMap toneMap(const ImageFrame& frame, const PreviewOptions& options, int threads = 0);
+
+private:
+    /**
+     * @brief Render preview rows [first, first + count) into @p bits.
+     */
+    static void renderRows(const ImageFrame& frame, const ToneMap& toneMap, int factor,
+        uchar* bits, qsizetype bytesPerLine, int width, int first, int count);
+};
@@ -0,0 +1,254 @@
+#include "RasterWriter.h"
+
+#include <qendian.h>
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+
+RasterInfo RasterInfo::of(const ImageFrame& frame)
+{
+    RasterInfo info;
+    info.width = frame.width;
+    info.height = frame.height;
+    info.bitsStored = frame.bitsStored;
+    info.slot = frame.slot;
+    info.metadata = frame.metadata;
+    return info;
+}
+
+
+void RasterWriter::AlignedDelete::operator()(char* p) const
+{
+    ::operator delete(p, std::align_val_t(EXPORT_WRITE_ALIGNMENT));
+}
+
+bool RasterWriter::begin(QIODevice& device, const RasterInfo& info)
+{
+    m_device = &device;
+    m_info = info;
+    m_written = 0;
+    m_fill = 0;
+    m_rows = 0;
+    m_heightDeferred = info.height == 0;
+    m_error.clear();
+
+    if (info.width <= 0 || info.height < 0)
+        return fail("Empty frame");
+    if (m_heightDeferred && !deferredHeight())
+        return fail("The format needs the image height before the first row");
+    if (!m_buffer)
+        m_buffer.reset(static_cast<char*>(::operator new(static_cast<size_t>(EXPORT_WRITE_BLOCK_BYTES), std::align_val_t(EXPORT_WRITE_ALIGNMENT))));
+    return writeHeader();
+}
+
+bool RasterWriter::writeRows(const uint16_t* pixels, int count)
+{
+    if (!m_device)
+        return fail("Writer not started");
+    if (!m_heightDeferred && count > m_info.height - m_rows)
+        return fail("More rows than announced");
+    m_rows += count;
+    return consumeRows(pixels, count);
+}
+
+bool RasterWriter::finish()
+{
+    if (!m_device)
+        return fail("Writer not started");
+    if (m_heightDeferred)
+    {
+        if (m_rows == 0)
+            return fail("Empty frame");
+        m_info.height = m_rows;
+    }
+    else if (m_rows != m_info.height)
+        return fail(QString("Missing rows: %1 of %2 written").arg(m_rows).arg(m_info.height));
+
+    const bool ok = writeTrailer() && flush();
+    m_device = nullptr;
+    return ok;
+}
+
+bool RasterWriter::writeFrame(const ImageFrame& frame, QIODevice& device, const Progress& progress)
+{
+    if (!begin(device, RasterInfo::of(frame)))
+        return false;
+    prepareFrame(frame);
+
+    // Whole blocks per call, so the unswapped path writes straight from the frame buffer.
+    const qint64 rowBytes = static_cast<qint64>(frame.width) * UINT16_SIZE;
+    const int step = static_cast<int>(std::max<qint64>(1, EXPORT_WRITE_BLOCK_BYTES / rowBytes));
+    for (int y = 0; y < frame.height; y += step)
+    {
+        if (!writeRows(frame.row(y), std::min(step, frame.height - y)))
+            return false;
+        if (progress)
+            progress(static_cast<int>(static_cast<qint64>(std::min(y + step, frame.height)) * 100 / frame.height));
+    }
+    return finish();
+}
+
+bool RasterWriter::consumeRows(const uint16_t* pixels, int count)
+{
+    return putSamples(pixels, static_cast<qint64>(count) * m_info.width);
+}
+
+bool RasterWriter::put(const void* data, qint64 size)
+{
+    const char* src = static_cast<const char*>(data);
+    m_written += size;
+    while (size > 0)
+    {
+        // Once the buffer is empty, whole blocks go to the device straight from the caller's memory.
+        if (m_fill == 0 && size >= EXPORT_WRITE_BLOCK_BYTES)
+        {
+            const qint64 direct = size - size % EXPORT_WRITE_BLOCK_BYTES;
+            if (m_device->write(src, direct) != direct)
+                return fail(m_device->errorString());
+            src += direct;
+            size -= direct;
+            continue;
+        }
+
+        const qint64 n = std::min(size, EXPORT_WRITE_BLOCK_BYTES - m_fill);
+        memcpy(m_buffer.get() + m_fill, src, static_cast<size_t>(n));
+        m_fill += n;
+        src += n;
+        size -= n;
+        if (m_fill == EXPORT_WRITE_BLOCK_BYTES && !flush())
+            return false;
+    }
+    return true;
+}
+
+bool RasterWriter::putSamples(const uint16_t* samples, qint64 count)
+{
+    const bool swap = bigEndian() != (Q_BYTE_ORDER == Q_BIG_ENDIAN);
+    const uint16_t limit = sampleLimit();
+    const bool clamp = limit != 0xFFFF && std::any_of(samples, samples + count, [limit](uint16_t v) { return v > limit; });
+    if (!swap && !clamp)
+        return put(samples, count * static_cast<qint64>(UINT16_SIZE));
+
+    // Convert directly into the block buffer.
+    while (count > 0)
+    {
+        const qint64 room = (EXPORT_WRITE_BLOCK_BYTES - m_fill) / static_cast<qint64>(UINT16_SIZE);
+        if (room == 0)
+        {
+            // An odd-sized header left a single byte; let put() split the sample across blocks.
+            const uint16_t value = std::min(*samples, limit);
+            uint16_t sample = bigEndian() ? qToBigEndian(value) : qToLittleEndian(value);
+            if (!put(&sample, sizeof(sample)))
+                return false;
+            ++samples;
+            --count;
+            continue;
+        }
+
+        const qint64 n = std::min(count, room);
+        char* dst = m_buffer.get() + m_fill;
+        if (clamp)
+        {
+            for (qint64 i = 0; i < n; ++i)
+            {
+                const uint16_t value = std::min(samples[i], limit);
+                if (bigEndian())
+                    qToBigEndian<quint16>(value, dst + i * static_cast<qint64>(UINT16_SIZE));
+                else
+                    qToLittleEndian<quint16>(value, dst + i * static_cast<qint64>(UINT16_SIZE));
+            }
+        }
+        else if (bigEndian())
+            qToBigEndian<quint16>(samples, n, dst);
+        else
+            qToLittleEndian<quint16>(samples, n, dst);
+        m_fill += n * static_cast<qint64>(UINT16_SIZE);
+        m_written += n * static_cast<qint64>(UINT16_SIZE);
+        samples += n;
+        count -= n;
+        if (m_fill == EXPORT_WRITE_BLOCK_BYTES && !flush())
+            return false;
+    }
+    return true;
+}
+
+uint16_t RasterWriter::sampleLimit() const
+{
+    const int bits = m_info.bitsStored;
+    return bits >= 2 && bits < 16 ? static_cast<uint16_t>((1 << bits) - 1) : 0xFFFF;
+}
+
+bool RasterWriter::flush()
+{
+    if (m_fill > 0 && m_device->write(m_buffer.get(), m_fill) != m_fill)
+        return fail(m_device->errorString());
+    m_fill = 0;
+    return true;
+}
+
+bool RasterWriter::patch(qint64 offset, const QByteArray& data)
+{
+    if (m_device->isSequential())
+        return fail("A deferred height needs a seekable device");
+    if (!flush() || !m_device->seek(offset) || m_device->write(data) != data.size() || !m_device->seek(m_written))
+        return fail(m_device->errorString());
+    return true;
+}
+
+bool RasterWriter::fail(const QString& text)
+{
+    m_error = text;
+    return false;
+}
+
+
+QByteArray RawWriter::sidecar(const RasterInfo& info)
+{
+    const ImageMetadata& metadata = info.metadata;
+
+    QByteArray json = "{\n";
+    json += "  \"Width\": " + QByteArray::number(info.width) + ",\n";
+    json += "  \"Height\": " + QByteArray::number(info.height) + ",\n";
+    json += "  \"BitsAllocated\": 16,\n";
+    json += "  \"BitsStored\": " + QByteArray::number(info.bitsStored > 0 ? info.bitsStored : 16) + ",\n";
+    json += "  \"ByteOrder\": \"LittleEndian\",\n";
+    if (metadata.pixelSpacingX > 0.0 && metadata.pixelSpacingY > 0.0)
+        json += "  \"PixelSpacing\": [" + QByteArray::number(metadata.pixelSpacingY) + ", " + QByteArray::number(metadata.pixelSpacingX) + "],\n";
+    // The stream header is valid JSON already and is embedded verbatim.
+    json += "  \"Header\": " + (metadata.valid && !metadata.json.isEmpty() ? metadata.json : QByteArray("null")) + "\n";
+    json += "}\n";
+    return json;
+}
+
+QString RawWriter::sidecarPath(const QString& rawPath)
+{
+    const qsizetype dot = rawPath.lastIndexOf('.');
+    const qsizetype separator = std::max(rawPath.lastIndexOf('/'), rawPath.lastIndexOf('\\'));
+    return (dot > separator ? rawPath.left(dot) : rawPath) + ".json";
+}
+
+
+bool PgmWriter::writeHeader()
+{
+    // Two bytes per sample require a maximum above 255.
+    const int bits = m_info.bitsStored;
+    const int maxValue = bits > 8 ? sampleLimit() : 65535;
+    QByteArray header = "P5\n" + QByteArray::number(m_info.width) + " ";
+    m_heightOffset = m_written + header.size();
+    // Whitespace may repeat between header fields, so a deferred height is padded to any int.
+    header += m_heightDeferred ? QByteArray(10, ' ') : QByteArray::number(m_info.height);
+    header += "\n" + QByteArray::number(maxValue) + "\n";
+    return put(header.constData(), header.size());
+}
+
+bool PgmWriter::writeTrailer()
+{
+    if (!m_heightDeferred)
+        return true;
+
+    QByteArray height = QByteArray::number(m_info.height);
+    height.append(QByteArray(10 - height.size(), ' '));
+    return patch(m_heightOffset, height);
+}
@@ -0,0 +1,213 @@
+#pragma once
+
+#include <qbytearray.h>
+#include <qiodevice.h>
+#include <qstring.h>
+
+#include "CR35Utils.h"
+#include "ImageFrame.h"
+
+#include <functional>
+#include <memory>
+
+
+/**
+ * @brief Geometry and metadata an uncompressed file header is built from.
+ */
+struct RasterInfo {
+    int width = 0; ///< Width in pixels.
+    int height = 0; ///< Height in pixels (0 = not known until finish(), see RasterWriter::begin()).
+    int bitsStored = 0; ///< Significant bits per pixel (0 = unknown).
+    int slot = 0; ///< Zero-based slot index of the frame.
+    ImageMetadata metadata; ///< JSON header of the stream, written to sidecars and TIFF tags.
+
+    /**
+     * @brief Take the header of a frame.
+     */
+    static RasterInfo of(const ImageFrame& frame);
+};
+
+/**
+ * @brief Base of the streaming writers for uncompressed 16-bit formats.
+ *
+ * A writer is fed rows from top to bottom, either straight from a frame
+ * buffer (writeFrame()) or in blocks as they are decoded (begin(),
+ * writeRows(), finish()), so the whole image never has to exist in another
+ * representation. Output is collected in an aligned buffer and handed to
+ * the device in blocks of EXPORT_WRITE_BLOCK_BYTES. Rows that need no byte
+ * swapping bypass the buffer and are written from the caller's memory in
+ * whole blocks. Open the device with QIODevice::Unbuffered so the blocks
+ * reach the file system unsplit.
+ *
+ * Samples above the `BitsStored` range, i.e. the 0xFFFF white fill of
+ * unscanned areas in a frame that was not scaled, are written as the
+ * largest stored value (see sampleLimit()), so the maximum values the
+ * headers declare hold for every sample.
+ *
+ * Formats that support it accept a height of 0 when rows are streamed
+ * from the decoder before the image end is known. The height is then
+ * taken from the rows written, and finish() completes the header in
+ * place, so the device must be seekable.
+ */
+class RasterWriter {
+public:
+    virtual ~RasterWriter() = default;
+
+    /**
+     * @brief Progress callback, called with 0..100 by writeFrame().
+     */
+    using Progress = std::function<void(int percent)>;
+
+    /**
+     * @brief Write the file header.
+     * @param device Open output device; must stay open until finish().
+     * @param info Image geometry; exactly info.height rows must follow, or any number
+     *             of rows when info.height is 0 and deferredHeight() is true.
+     * @return false on a write error, see errorString().
+     */
+    bool begin(QIODevice& device, const RasterInfo& info);
+
+    /**
+     * @brief Append rows.
+     * @param pixels count * width tightly packed pixels, in host byte order.
+     * @param count Number of rows.
+     * @return false on a write error or when more rows than announced are passed.
+     */
+    bool writeRows(const uint16_t* pixels, int count);
+
+    /**
+     * @brief Write pending data and the trailer.
+     * @return false on a write error or when rows are missing.
+     */
+    bool finish();
+
+    /**
+     * @brief Write a complete frame: begin(), all rows, finish().
+     */
+    bool writeFrame(const ImageFrame& frame, QIODevice& device, const Progress& progress = {});
+
+    /**
+     * @brief Whether begin() accepts a height of 0 that finish() fills in.
+     */
+    virtual bool deferredHeight() const { return false; }
+
+    int rowsWritten() const { return m_rows; } ///< Rows received since begin().
+    QString errorString() const { return m_error; } ///< Description of the last failure.
+
+protected:
+    /**
+     * @brief Write the format header; called by begin() with m_info set.
+     */
+    virtual bool writeHeader() = 0;
+
+    /**
+     * @brief Look at the whole frame before its rows arrive; called by writeFrame() after begin().
+     *
+     * Row streaming callers never call it, so writers must work without it.
+     */
+    virtual void prepareFrame(const ImageFrame& /*frame*/) { }
+
+    /**
+     * @brief Consume rows; the default writes them in the file byte order.
+     */
+    virtual bool consumeRows(const uint16_t* pixels, int count);
+
+    /**
+     * @brief Write the format trailer; called by finish() after all rows.
+     */
+    virtual bool writeTrailer() { return true; }
+
+    /**
+     * @brief Whether the format stores pixels big-endian (PGM) instead of little-endian.
+     */
+    virtual bool bigEndian() const { return false; }
+
+    /**
+     * @brief Append bytes to the block buffer, writing full blocks to the device.
+     */
+    bool put(const void* data, qint64 size);
+
+    /**
+     * @brief Append samples converted to the file byte order and clamped to sampleLimit().
+     */
+    bool putSamples(const uint16_t* samples, qint64 count);
+
+    /**
+     * @brief Largest sample value of m_info.bitsStored bits (0xFFFF when unknown, below 2 or 16).
+     */
+    uint16_t sampleLimit() const;
+
+    /**
+     * @brief Write the buffered bytes.
+     */
+    bool flush();
+
+    /**
+     * @brief Overwrite bytes written before, e.g. a header field only known at the end.
+     * @param offset File offset of the first byte; the range must lie within m_written.
+     * @param data Replacement bytes.
+     */
+    bool patch(qint64 offset, const QByteArray& data);
+
+    bool fail(const QString& text); ///< Record a failure, returns false.
+
+    RasterInfo m_info; ///< Geometry passed to begin(); finish() sets a deferred height before writeTrailer().
+    bool m_heightDeferred = false; ///< Whether begin() got a height of 0.
+    qint64 m_written = 0; ///< Bytes handed to put() so far, i.e. the current file offset.
+
+private:
+    struct AlignedDelete {
+        void operator()(char* p) const;
+    };
+
+    QIODevice* m_device = nullptr; ///< Output device between begin() and finish().
+    std::unique_ptr<char[], AlignedDelete> m_buffer; ///< EXPORT_WRITE_ALIGNMENT aligned block buffer.
+    qint64 m_fill = 0; ///< Bytes in m_buffer.
+    int m_rows = 0; ///< Rows received since begin().
+    QString m_error; ///< Last failure description.
+};
+
+/**
+ * @brief Headerless little-endian 16-bit raw file with a JSON sidecar.
+ *
+ * The pixel data is the frame buffer as is, so on little-endian hosts
+ * blocks without white fill are written without a copy. The geometry and the stream JSON header go into a
+ * sidecar file next to it (see sidecar()).
+ */
+class RawWriter : public RasterWriter {
+public:
+    bool deferredHeight() const override { return true; }
+
+    /**
+     * @brief Sidecar describing a raw file: geometry, byte order and the stream JSON header.
+     */
+    static QByteArray sidecar(const RasterInfo& info);
+
+    /**
+     * @brief Sidecar path of a raw file: the suffix replaced by ".json".
+     */
+    static QString sidecarPath(const QString& rawPath);
+
+protected:
+    bool writeHeader() override { return true; }
+};
+
+/**
+ * @brief Binary 16-bit PGM (P5, big-endian samples).
+ *
+ * The maximum value is taken from `BitsStored`, so viewers scale 12-bit
+ * plates correctly; the white fill is written as that maximum. A deferred height is written as a space-padded field
+ * that finish() fills in.
+ */
+class PgmWriter : public RasterWriter {
+public:
+    bool deferredHeight() const override { return true; }
+
+protected:
+    bool writeHeader() override;
+    bool writeTrailer() override;
+    bool bigEndian() const override { return true; }
+
+private:
+    qint64 m_heightOffset = 0; ///< File offset of the deferred height field.
+};
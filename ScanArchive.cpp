@@ -0,0 +1,573 @@
+#include "ScanArchive.h"
+
+#include <qdatetime.h>
+#include <qmutex.h>
+
+#if __has_include(<QtZlib/zlib.h>)
+#include <QtZlib/zlib.h> // zlib bundled with and exported by Qt
+#else
+#include <zlib.h>
+#endif
+
+#include "CompressedFrame.h"
+#include "PackedFrame.h"
+
+#include <algorithm>
+#include <cstring>
+
+
+namespace {
+
+constexpr char ARCHIVE_MAGIC[8] = { 'C', 'R', '3', '5', 'A', 'R', 'C', 'H' };
+constexpr char ENTRY_MAGIC[4] = { 'S', 'C', 'A', 'N' };
+constexpr char FOOTER_MAGIC[8] = { 'C', 'R', '3', '5', 'I', 'N', 'D', 'X' };
+constexpr uint32_t ARCHIVE_VERSION = 1;
+constexpr qint64 ARCHIVE_HEADER_BYTES = 16; ///< Magic, version and a reserved word.
+constexpr qint64 RECORD_ALIGNMENT = 8; ///< Records and payload sections start 8-byte aligned, so mapped pixels are aligned.
+
+inline qint64 align(qint64 offset)
+{
+    return (offset + RECORD_ALIGNMENT - 1) & ~(RECORD_ALIGNMENT - 1);
+}
+
+/**
+ * @brief Continue a CRC-32 over a buffer of any size.
+ */
+uint32_t crc(uint32_t value, const void* data, qint64 size)
+{
+    const Bytef* bytes = static_cast<const Bytef*>(data);
+    while (size > 0)
+    {
+        const uInt take = static_cast<uInt>(std::min<qint64>(size, 1 << 30));
+        value = static_cast<uint32_t>(crc32(value, bytes, take));
+        bytes += take;
+        size -= take;
+    }
+    return value;
+}
+
+/**
+ * @brief CRC-32 of a packed struct with its checksum field counted as 0.
+ */
+template <typename T>
+uint32_t structCrc(T copy, uint32_t T::* field)
+{
+    copy.*field = 0;
+    return crc(0, &copy, sizeof(copy));
+}
+
+} // namespace
+
+
+ScanArchive::~ScanArchive()
+{
+    close();
+}
+
+bool ScanArchive::open(const QString& path, bool writable)
+{
+    close();
+    QMutexLocker locker(&m_mutex);
+    m_error.clear();
+    m_writable = writable;
+    m_repaired = false;
+
+    m_file.reset(new QFile(path));
+    if (!m_file->open(writable ? QIODevice::ReadWrite : QIODevice::ReadOnly))
+    {
+        fail(m_file->errorString());
+        m_file.reset();
+        return false;
+    }
+
+    if (m_file->size() == 0 && writable)
+    {
+        char header[ARCHIVE_HEADER_BYTES] = {};
+        memcpy(header, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC));
+        memcpy(header + sizeof(ARCHIVE_MAGIC), &ARCHIVE_VERSION, sizeof(ARCHIVE_VERSION));
+        m_dataEnd = ARCHIVE_HEADER_BYTES;
+        if (m_file->write(header, sizeof(header)) != ARCHIVE_HEADER_BYTES || !writeIndex())
+        {
+            fail(m_file->errorString());
+            m_file.reset();
+            return false;
+        }
+        return true;
+    }
+
+    char header[ARCHIVE_HEADER_BYTES] = {};
+    uint32_t version = 0;
+    if (m_file->read(header, sizeof(header)) == ARCHIVE_HEADER_BYTES)
+        memcpy(&version, header + sizeof(ARCHIVE_MAGIC), sizeof(version));
+    if (memcmp(header, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC)) != 0 || version != ARCHIVE_VERSION)
+    {
+        fail("Not a scan archive");
+        m_file.reset();
+        return false;
+    }
+
+    if (readIndex())
+        return true;
+
+    // An append was interrupted: rebuild the index and drop the incomplete tail.
+    m_repaired = true;
+    if (!recover())
+    {
+        m_file.reset();
+        return false;
+    }
+    return true;
+}
+
+void ScanArchive::close()
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_file)
+    {
+        for (uchar* data : std::as_const(m_maps))
+            m_file->unmap(data);
+    }
+    m_maps.clear();
+    m_file.reset();
+    m_entries.clear();
+    m_byId.clear();
+    m_byTime.clear();
+    m_dataEnd = 0;
+}
+
+bool ScanArchive::isOpen() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_file != nullptr;
+}
+
+QString ScanArchive::path() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_file ? m_file->fileName() : QString();
+}
+
+QString ScanArchive::errorString() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_error;
+}
+
+bool ScanArchive::wasRepaired() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_repaired;
+}
+
+void ScanArchive::setCompression(bool compress)
+{
+    QMutexLocker locker(&m_mutex);
+    m_compress = compress;
+}
+
+quint64 ScanArchive::append(const ImageFrame& frame, const ImageStream* raw, const ImagePyramid* pyramid, int threads)
+{
+    // Compress or pack outside the lock, other workers may append meanwhile.
+    bool compress = false;
+    {
+        QMutexLocker locker(&m_mutex);
+        compress = m_compress;
+    }
+    const int bits = PackedFrame::packedBits(frame.bitsStored);
+    const bool empty = frame.width <= 0 || frame.height <= 0;
+    uint8_t encoding = Raw;
+    QByteArray compressed;
+    PackedFrame packed;
+    if (compress && !empty)
+    {
+        encoding = Compressed;
+        compressed = CompressedFrame(frame, threads).serialize();
+    }
+    else if (bits < 16 && !empty && PackedFrame::isLossless(frame, bits))
+    {
+        encoding = Packed;
+        packed = PackedFrame(frame, bits);
+    }
+
+    QMutexLocker locker(&m_mutex);
+    if (!m_file || !m_writable)
+    {
+        fail("Archive not open for appending");
+        return 0;
+    }
+    if (frame.width <= 0 || frame.height <= 0)
+    {
+        fail("Empty frame");
+        return 0;
+    }
+
+    const QByteArray& json = frame.metadata.json;
+    const char* pixels = reinterpret_cast<const char*>(frame.data());
+    qint64 pixelBytes = static_cast<qint64>(frame.width) * frame.height * static_cast<qint64>(UINT16_SIZE);
+    if (encoding == Compressed)
+    {
+        pixels = compressed.constData();
+        pixelBytes = compressed.size();
+    }
+    else if (encoding == Packed)
+    {
+        pixels = reinterpret_cast<const char*>(packed.packedRow(0));
+        pixelBytes = static_cast<qint64>(packed.byteSize());
+    }
+
+    Entry entry = {};
+    memcpy(entry.magic, ENTRY_MAGIC, sizeof(entry.magic));
+    entry.scanId = m_entries.empty() ? 1 : m_entries.back().scanId + 1;
+    entry.timestamp = QDateTime::currentMSecsSinceEpoch();
+    entry.offset = m_dataEnd;
+    entry.metadataBytes = json.size();
+    entry.frameBytes = pixelBytes;
+    entry.rawBytes = raw ? raw->size() : 0;
+    entry.width = frame.width;
+    entry.height = frame.height;
+    entry.slot = static_cast<int16_t>(frame.slot);
+    entry.slotCount = static_cast<int16_t>(frame.slotCount);
+    entry.bitsStored = static_cast<int16_t>(frame.bitsStored);
+    entry.encoding = encoding;
+    if (!pyramid)
+        pyramid = frame.pyramid.data();
+    if (pyramid && pyramid->levels() == 0)
+        pyramid = nullptr;
+    entry.pyramidLevels = pyramid ? static_cast<uint8_t>(pyramid->levels()) : 0;
+
+    // The header goes in last: until then the record reads as incomplete.
+    const QByteArray zeros(static_cast<qsizetype>(sizeof(Entry) + RECORD_ALIGNMENT), '\0');
+    const auto put = [this](const char* data, qint64 size) { return m_file->write(data, size) == size; };
+    const auto pad = [this, &put, &zeros]() { return put(zeros.constData(), align(m_file->pos()) - m_file->pos()); };
+
+    uint32_t payloadCrc = crc(0, json.constData(), json.size());
+    payloadCrc = crc(payloadCrc, pixels, pixelBytes);
+    bool ok = m_file->seek(entry.offset) && put(zeros.constData(), sizeof(Entry)) &&
+        put(json.constData(), json.size()) && pad() && put(pixels, pixelBytes) && pad();
+    for (qint64 pos = 0; ok && pos < entry.rawBytes;)
+    {
+        qint64 available = 0;
+        const char* chunk = raw->contiguous(pos, &available);
+        available = std::min(available, entry.rawBytes - pos);
+        ok = chunk && available > 0 && put(chunk, available);
+        payloadCrc = crc(payloadCrc, chunk, available);
+        pos += available;
+    }
+    ok = ok && pad();
+    if (pyramid)
+    {
+        const char* levels = reinterpret_cast<const char*>(pyramid->pixels().data());
+        const qint64 bytes = pyramidBytes(entry);
+        ok = ok && put(levels, bytes) && pad();
+        payloadCrc = crc(payloadCrc, levels, bytes);
+    }
+
+    entry.payloadCrc = payloadCrc;
+    entry.headerCrc = structCrc(entry, &Entry::headerCrc);
+    ok = ok && m_file->pos() == entry.offset + recordBytes(entry) &&
+        m_file->seek(entry.offset) && put(reinterpret_cast<const char*>(&entry), sizeof(entry));
+
+    if (!ok)
+    {
+        const QString error = m_file->errorString();
+        writeIndex(); // restore the previous index over the partial record
+        fail("Append failed: " + error);
+        return 0;
+    }
+
+    m_dataEnd = entry.offset + recordBytes(entry);
+    addEntry(entry);
+    // Should the index fail, the record is complete and the next open() finds it by scanning.
+    writeIndex();
+    return entry.scanId;
+}
+
+int ScanArchive::count() const
+{
+    QMutexLocker locker(&m_mutex);
+    return static_cast<int>(m_entries.size());
+}
+
+ScanArchive::Entry ScanArchive::entry(int index) const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_entries.at(index);
+}
+
+int ScanArchive::find(quint64 scanId) const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_byId.value(scanId, -1);
+}
+
+int ScanArchive::findAt(qint64 timestamp) const
+{
+    QMutexLocker locker(&m_mutex);
+    const auto it = std::upper_bound(m_byTime.begin(), m_byTime.end(), timestamp,
+        [](qint64 value, const std::pair<qint64, int>& item) { return value < item.first; });
+    return it == m_byTime.begin() ? -1 : std::prev(it)->second;
+}
+
+std::vector<int> ScanArchive::findBetween(qint64 from, qint64 to) const
+{
+    QMutexLocker locker(&m_mutex);
+    const auto first = std::lower_bound(m_byTime.begin(), m_byTime.end(), std::make_pair(from, -1));
+    const auto last = std::lower_bound(m_byTime.begin(), m_byTime.end(), std::make_pair(to, -1));
+    std::vector<int> indices;
+    for (auto it = first; it < last; ++it)
+        indices.push_back(it->second);
+    return indices;
+}
+
+ImageMetadata ScanArchive::metadata(int index) const
+{
+    QMutexLocker locker(&m_mutex);
+    const uchar* data = map(index);
+    if (!data)
+        return {};
+    return ImageMetadata::fromJson(reinterpret_cast<const char*>(data), m_entries[index].metadataBytes);
+}
+
+const uint16_t* ScanArchive::pixels(int index) const
+{
+    QMutexLocker locker(&m_mutex);
+    const uchar* data = map(index);
+    if (!data || m_entries[index].encoding != Raw)
+        return nullptr;
+    const Entry& e = m_entries[index];
+    return reinterpret_cast<const uint16_t*>(data + (frameOffset(e) - metadataOffset(e)));
+}
+
+ImageFramePtr ScanArchive::frame(int index) const
+{
+    QMutexLocker locker(&m_mutex);
+    const uchar* data = map(index);
+    if (!data)
+        return {};
+
+    const Entry e = m_entries[index];
+    const ImageMetadata metadata = ImageMetadata::fromJson(reinterpret_cast<const char*>(data), e.metadataBytes);
+    const char* pixels = reinterpret_cast<const char*>(data + (frameOffset(e) - metadataOffset(e)));
+    locker.unlock(); // the mapping stays valid until close()
+
+    if (e.encoding == Compressed)
+    {
+        const CompressedFrame compressed = CompressedFrame::deserialize(pixels, e.frameBytes, metadata);
+        if (compressed.isNull())
+            return {};
+        const ImageFramePtr frame = compressed.decompress();
+        const_cast<ImageFrame&>(*frame).pyramid = pyramid(index); // the frame is not shared yet
+        return frame;
+    }
+
+    const int bits = e.encoding == Packed ? PackedFrame::packedBits(e.bitsStored) : 16;
+    const size_t rowBytes = PackedFrame::packedSize(e.width, bits);
+    if (e.encoding > Packed || e.frameBytes != static_cast<qint64>(rowBytes) * e.height)
+        return {};
+    QSharedPointer<ImageFrame> frame(new ImageFrame);
+    frame->width = e.width;
+    frame->height = e.height;
+    frame->slot = e.slot;
+    frame->slotCount = e.slotCount;
+    frame->bitsStored = e.bitsStored;
+    frame->metadata = metadata;
+    uint16_t* target = frame->allocatePixels();
+    if (e.encoding == Packed)
+    {
+        for (int y = 0; y < e.height; ++y)
+            PackedFrame::unpackRow(reinterpret_cast<const uint8_t*>(pixels) + y * rowBytes, target + static_cast<size_t>(y) * e.width, e.width, bits);
+    }
+    else
+    {
+        memcpy(target, pixels, static_cast<size_t>(e.frameBytes));
+    }
+    frame->pyramid = pyramid(index);
+    return frame;
+}
+
+QSharedPointer<const ImagePyramid> ScanArchive::pyramid(int index) const
+{
+    QMutexLocker locker(&m_mutex);
+    const uchar* data = map(index);
+    if (!data || m_entries[index].pyramidLevels == 0)
+        return {};
+    const Entry& e = m_entries[index];
+    return ImagePyramid::fromPixels(e.width, e.height, e.pyramidLevels,
+        reinterpret_cast<const uint16_t*>(data + (pyramidOffset(e) - metadataOffset(e))));
+}
+
+bool ScanArchive::rawStream(int index, ImageStream& stream) const
+{
+    QMutexLocker locker(&m_mutex);
+    const uchar* data = map(index);
+    if (!data)
+        return false;
+    const Entry& e = m_entries[index];
+    if (e.rawBytes == 0)
+        return fail("The record has no raw stream");
+    stream.append(reinterpret_cast<const char*>(data + (rawOffset(e) - metadataOffset(e))), e.rawBytes);
+    return true;
+}
+
+bool ScanArchive::verify(int index) const
+{
+    QMutexLocker locker(&m_mutex);
+    const uchar* data = map(index);
+    if (!data)
+        return false;
+    const Entry& e = m_entries[index];
+    uint32_t value = crc(0, data, e.metadataBytes);
+    value = crc(value, data + (frameOffset(e) - metadataOffset(e)), e.frameBytes);
+    value = crc(value, data + (rawOffset(e) - metadataOffset(e)), e.rawBytes);
+    value = crc(value, data + (pyramidOffset(e) - metadataOffset(e)), pyramidBytes(e));
+    return value == e.payloadCrc || fail("Checksum mismatch in scan " + QString::number(e.scanId));
+}
+
+bool ScanArchive::readIndex()
+{
+    const qint64 size = m_file->size();
+    Footer footer = {};
+    if (size < ARCHIVE_HEADER_BYTES + static_cast<qint64>(sizeof(footer)) || !m_file->seek(size - static_cast<qint64>(sizeof(footer))) ||
+        m_file->read(reinterpret_cast<char*>(&footer), sizeof(footer)) != static_cast<qint64>(sizeof(footer)))
+        return false;
+    if (memcmp(footer.magic, FOOTER_MAGIC, sizeof(footer.magic)) != 0 || footer.footerCrc != structCrc(footer, &Footer::footerCrc) ||
+        footer.count < 0 || footer.indexOffset < ARCHIVE_HEADER_BYTES ||
+        footer.indexOffset + footer.count * static_cast<qint64>(sizeof(Entry)) + static_cast<qint64>(sizeof(footer)) != size)
+        return false;
+
+    std::vector<Entry> entries(static_cast<size_t>(footer.count));
+    const qint64 bytes = footer.count * static_cast<qint64>(sizeof(Entry));
+    if (!m_file->seek(footer.indexOffset) || m_file->read(reinterpret_cast<char*>(entries.data()), bytes) != bytes ||
+        crc(0, entries.data(), bytes) != footer.indexCrc)
+        return false;
+
+    qint64 expected = ARCHIVE_HEADER_BYTES;
+    for (const Entry& e : entries)
+    {
+        if (e.offset != expected || e.headerCrc != structCrc(e, &Entry::headerCrc))
+            return false;
+        expected += recordBytes(e);
+    }
+    if (expected != footer.indexOffset)
+        return false;
+
+    for (const Entry& e : entries)
+        addEntry(e);
+    m_dataEnd = footer.indexOffset;
+    return true;
+}
+
+bool ScanArchive::recover()
+{
+    const qint64 size = m_file->size();
+    qint64 pos = ARCHIVE_HEADER_BYTES;
+    Entry e = {};
+    // Index copies of earlier headers never match, their offset field points back.
+    while (pos + static_cast<qint64>(sizeof(e)) <= size && m_file->seek(pos) &&
+        m_file->read(reinterpret_cast<char*>(&e), sizeof(e)) == static_cast<qint64>(sizeof(e)) &&
+        memcmp(e.magic, ENTRY_MAGIC, sizeof(e.magic)) == 0 && e.headerCrc == structCrc(e, &Entry::headerCrc) &&
+        e.offset == pos && e.metadataBytes >= 0 && e.frameBytes >= 0 && e.rawBytes >= 0 && pos + recordBytes(e) <= size)
+    {
+        addEntry(e);
+        pos += recordBytes(e);
+    }
+
+    m_dataEnd = pos;
+    return !m_writable || writeIndex();
+}
+
+bool ScanArchive::writeIndex()
+{
+    const qint64 bytes = static_cast<qint64>(m_entries.size() * sizeof(Entry));
+    Footer footer = {};
+    memcpy(footer.magic, FOOTER_MAGIC, sizeof(footer.magic));
+    footer.indexOffset = m_dataEnd;
+    footer.count = static_cast<int64_t>(m_entries.size());
+    footer.indexCrc = crc(0, m_entries.data(), bytes);
+    footer.footerCrc = structCrc(footer, &Footer::footerCrc);
+
+    // Resizing drops whatever an interrupted append left behind the new footer.
+    const qint64 end = m_dataEnd + bytes + static_cast<qint64>(sizeof(footer));
+    if (!m_file->seek(m_dataEnd) || m_file->write(reinterpret_cast<const char*>(m_entries.data()), bytes) != bytes ||
+        m_file->write(reinterpret_cast<const char*>(&footer), sizeof(footer)) != static_cast<qint64>(sizeof(footer)) ||
+        !m_file->resize(end) || !m_file->flush())
+        return fail("Writing the archive index failed: " + m_file->errorString());
+    return true;
+}
+
+void ScanArchive::addEntry(const Entry& entry)
+{
+    const int index = static_cast<int>(m_entries.size());
+    m_entries.push_back(entry);
+    m_byId.insert(entry.scanId, index);
+
+    // Appends arrive in time order, unless the clock was set back.
+    const std::pair<qint64, int> item(entry.timestamp, index);
+    if (m_byTime.empty() || m_byTime.back() <= item)
+        m_byTime.push_back(item);
+    else
+        m_byTime.insert(std::upper_bound(m_byTime.begin(), m_byTime.end(), item), item);
+}
+
+const uchar* ScanArchive::map(int index) const
+{
+    if (!m_file || index < 0 || index >= static_cast<int>(m_entries.size()))
+    {
+        fail("No such record");
+        return nullptr;
+    }
+    if (uchar* data = m_maps.value(index))
+        return data;
+
+    const Entry& e = m_entries[index];
+    const qint64 size = recordBytes(e) - static_cast<qint64>(sizeof(Entry));
+    if (size == 0)
+    {
+        fail("Empty record");
+        return nullptr;
+    }
+    uchar* data = m_file->map(metadataOffset(e), size);
+    if (!data)
+    {
+        fail(m_file->errorString());
+        return nullptr;
+    }
+    m_maps.insert(index, data);
+    return data;
+}
+
+qint64 ScanArchive::metadataOffset(const Entry& entry)
+{
+    return entry.offset + static_cast<qint64>(sizeof(Entry));
+}
+
+qint64 ScanArchive::frameOffset(const Entry& entry)
+{
+    return align(metadataOffset(entry) + entry.metadataBytes);
+}
+
+qint64 ScanArchive::rawOffset(const Entry& entry)
+{
+    return align(frameOffset(entry) + entry.frameBytes);
+}
+
+qint64 ScanArchive::pyramidOffset(const Entry& entry)
+{
+    return align(rawOffset(entry) + entry.rawBytes);
+}
+
+qint64 ScanArchive::pyramidBytes(const Entry& entry)
+{
+    return ImagePyramid::pixelCount(entry.width, entry.height, entry.pyramidLevels) * static_cast<qint64>(UINT16_SIZE);
+}
+
+qint64 ScanArchive::recordBytes(const Entry& entry)
+{
+    return align(pyramidOffset(entry) + pyramidBytes(entry)) - entry.offset;
+}
+
+bool ScanArchive::fail(const QString& text) const
+{
+    m_error = text;
+    return false;
+}
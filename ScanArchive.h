@@ -0,0 +1,221 @@
+#pragma once
+
+#include <qfile.h>
+#include <qhash.h>
+#include <qmutex.h>
+#include <qstring.h>
+
+#include "ImageFrame.h"
+#include "ImagePyramid.h"
+#include "ImageStream.h"
+
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+
+/**
+ * @brief Append-only archive of acquired plates in one file.
+ *
+ * Each record holds one frame (a CompressedFrame, or a PackedFrame at the
+ * depth of its `BitsStored` when that is lossless, else raw pixels), the JSON
+ * header of its stream, optionally the raw `ImageData` stream and the
+ * frame's ImagePyramid, the scan ID and the time it was archived. The file ends with an index of all record
+ * headers and a footer pointing at it, so opening an archive reads only
+ * the index, however many plates it holds.
+ *
+ * Records are never rewritten. An append writes the record where the index
+ * was, then a new index and footer. When the application crashes during an
+ * append, the footer no longer matches; open() then rebuilds the index from
+ * the self-describing records, drops the incomplete tail, and the next
+ * append continues behind the last complete record.
+ *
+ * Record contents are read through memory mappings of the record, so
+ * raw pixels are used in place and packed rows are unpacked from the mapping. All functions are thread-safe;
+ * appends from several export workers are serialized.
+ */
+class ScanArchive {
+public:
+    /**
+     * @brief How the frame pixels of a record are stored.
+     */
+    enum Encoding : uint8_t {
+        Raw = 0, ///< 16-bit pixels.
+        Compressed = 1, ///< Serialized CompressedFrame.
+        Packed = 2, ///< PackedFrame rows at PackedFrame::packedBits(bitsStored).
+    };
+
+    /**
+     * @brief Index entry, stored in the index and as the header of its record.
+     */
+#pragma pack(push, 1)
+    struct Entry {
+        char magic[4]; ///< "SCAN"
+        uint32_t headerCrc; ///< CRC-32 of the entry with this field set to 0.
+        uint64_t scanId; ///< Archive-wide unique scan ID, increasing from 1.
+        int64_t timestamp; ///< Time the frame was archived, ms since the epoch (UTC).
+        int64_t offset; ///< File offset of the record.
+        int64_t metadataBytes; ///< Size of the JSON header.
+        int64_t frameBytes; ///< Size of the stored frame pixels (see encoding).
+        int64_t rawBytes; ///< Size of the raw stream (0 = not stored).
+        int32_t width; ///< Width in pixels.
+        int32_t height; ///< Height in pixels.
+        int16_t slot; ///< Zero-based slot index.
+        int16_t slotCount; ///< Number of slots of the scan.
+        int16_t bitsStored; ///< `BitsStored` of the frame.
+        uint8_t encoding; ///< How the frame pixels are stored (Encoding).
+        uint8_t pyramidLevels; ///< Number of ImagePyramid levels stored behind the raw stream.
+        uint32_t payloadCrc; ///< CRC-32 of the metadata, frame, raw stream and pyramid bytes.
+        uint32_t reserved2; ///< Zero.
+    };
+#pragma pack(pop)
+
+    ScanArchive() = default;
+    ~ScanArchive();
+    ScanArchive(const ScanArchive&) = delete;
+    ScanArchive& operator=(const ScanArchive&) = delete;
+
+    /**
+     * @brief Open an archive, creating it when it does not exist and @p writable is set.
+     *
+     * A missing or mismatching footer (interrupted append) is repaired by
+     * scanning the records; a writable archive is truncated behind the
+     * last complete one.
+     *
+     * @param path Archive file.
+     * @param writable Whether append() is allowed.
+     * @return false when the file cannot be opened or is not an archive.
+     */
+    bool open(const QString& path, bool writable);
+
+    /**
+     * @brief Unmap all records and close the file.
+     */
+    void close();
+
+    bool isOpen() const; ///< Whether an archive file is open.
+    QString path() const; ///< File of the open archive.
+    QString errorString() const; ///< Description of the last failure.
+    bool wasRepaired() const; ///< Whether open() had to rebuild the index from the records.
+
+    /**
+     * @brief Store frames as CompressedFrame from now on (smaller records, slower reads).
+     *
+     * Uncompressed frames are stored bit-packed when their pixels fit.
+     */
+    void setCompression(bool compress);
+
+    /**
+     * @brief Append a frame and commit a new index.
+     * @param frame Frame to archive, with its metadata.
+     * @param raw Raw stream the frame was decoded from, or nullptr.
+     * @param pyramid Levels stored with the record; nullptr stores the frame's own pyramid, if any.
+     * @param threads Compression threads; 0 uses QThread::idealThreadCount().
+     * @return Scan ID of the new record, or 0 on failure (the archive is unchanged).
+     */
+    quint64 append(const ImageFrame& frame, const ImageStream* raw = nullptr, const ImagePyramid* pyramid = nullptr, int threads = 0);
+
+    int count() const; ///< Number of records.
+
+    /**
+     * @brief Index entry of a record.
+     * @param index Record index in [0, count()), in append order.
+     */
+    Entry entry(int index) const;
+
+    /**
+     * @brief Record index of a scan ID, or -1 (hash lookup).
+     */
+    int find(quint64 scanId) const;
+
+    /**
+     * @brief Last record archived at or before a time, or -1.
+     * @param timestamp Milliseconds since the epoch (UTC).
+     */
+    int findAt(qint64 timestamp) const;
+
+    /**
+     * @brief Records archived in [from, to), as record indices.
+     */
+    std::vector<int> findBetween(qint64 from, qint64 to) const;
+
+    /**
+     * @brief JSON header of a record.
+     */
+    ImageMetadata metadata(int index) const;
+
+    /**
+     * @brief Pixels of a raw record, mapped from the file.
+     * @return width * height pixels valid until close(), or nullptr for compressed and packed records.
+     */
+    const uint16_t* pixels(int index) const;
+
+    /**
+     * @brief Frame of a record, decompressed or unpacked when needed, with its pyramid when one is stored.
+     * @return Null pointer on a read failure.
+     */
+    ImageFramePtr frame(int index) const;
+
+    /**
+     * @brief Pyramid of a record without reading the frame, e.g. for an overview.
+     * @return Null pointer when the record has no pyramid.
+     */
+    QSharedPointer<const ImagePyramid> pyramid(int index) const;
+
+    /**
+     * @brief Append the raw stream of a record to @p stream (e.g. to decode it again).
+     * @return false when the record has no raw stream or it cannot be read.
+     */
+    bool rawStream(int index, ImageStream& stream) const;
+
+    /**
+     * @brief Recompute the payload checksum of a record.
+     */
+    bool verify(int index) const;
+
+private:
+    /**
+     * @brief On-disk footer at the very end of the file.
+     */
+#pragma pack(push, 1)
+    struct Footer {
+        char magic[8]; ///< "CR35INDX"
+        int64_t indexOffset; ///< File offset of the index (= end of the last record).
+        int64_t count; ///< Number of index entries.
+        uint32_t indexCrc; ///< CRC-32 of the index entries.
+        uint32_t footerCrc; ///< CRC-32 of the footer with this field set to 0.
+    };
+#pragma pack(pop)
+
+    bool readIndex(); ///< Load the index through the footer.
+    bool recover(); ///< Rebuild the index by scanning the records.
+    bool writeIndex(); ///< Write index and footer at m_dataEnd.
+    void addEntry(const Entry& entry); ///< Append to m_entries and the lookup tables.
+
+    /**
+     * @brief Map the payload of a record (cached until close()).
+     */
+    const uchar* map(int index) const;
+
+    static qint64 metadataOffset(const Entry& entry); ///< File offsets of the payload sections of a record.
+    static qint64 frameOffset(const Entry& entry);
+    static qint64 rawOffset(const Entry& entry);
+    static qint64 pyramidOffset(const Entry& entry);
+    static qint64 pyramidBytes(const Entry& entry); ///< Size of the stored pyramid levels.
+    static qint64 recordBytes(const Entry& entry); ///< Size of a record including its header.
+
+    bool fail(const QString& text) const; ///< Record a failure, returns false.
+
+    mutable QMutex m_mutex; ///< Serializes appends and reads.
+    std::unique_ptr<QFile> m_file; ///< Archive file.
+    bool m_writable = false; ///< Whether the file was opened for appending.
+    bool m_compress = false; ///< Whether appended frames are compressed rather than packed.
+    bool m_repaired = false; ///< Whether open() rebuilt the index.
+    qint64 m_dataEnd = 0; ///< End of the last complete record.
+    std::vector<Entry> m_entries; ///< Index, in append order.
+    QHash<quint64, int> m_byId; ///< Scan ID -> record index.
+    std::vector<std::pair<qint64, int>> m_byTime; ///< (timestamp, record index), sorted.
+    mutable QHash<int, uchar*> m_maps; ///< Mapped records by index.
+    mutable QString m_error; ///< Last failure description.
+};
@@ -0,0 +1,15 @@
+#pragma once
+
+/**
+ * @brief SSE2 availability for the vector kernels.
+ *
+ * SSE2 is part of every x86-64 target and of 32-bit MSVC builds with
+ * /arch:SSE2 or higher, so it needs no runtime check. Kernels guard their
+ * vector path with `#ifdef CR35_SSE2` and keep a scalar loop for the rest
+ * of a row and for other targets. Kernels that need SSSE3 or AVX2
+ * (PackedFrame, ToneMap) check the CPU at runtime instead.
+ */
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CR35_SSE2 1
+#include <emmintrin.h>
+#endif
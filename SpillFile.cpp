@@ -0,0 +1,46 @@
+#include "SpillFile.h"
+
+#include <qdir.h>
+
+#include <algorithm>
+#include <cstring>
+
+
+char* SpillFile::allocate(qint64 size)
+{
+    if (size <= 0)
+        return nullptr;
+
+    if (m_extents.empty() || m_used + size > m_extents.back()->size())
+    {
+        // Size the extent before mapping it; mapped files are never resized.
+        std::unique_ptr<QTemporaryFile> extent(new QTemporaryFile(QDir::tempPath() + "/CR35_spill_XXXXXX.bin"));
+        if (!extent->open() || !extent->resize(std::max(size, m_extentSize)))
+        {
+            m_error = extent->errorString();
+            return nullptr;
+        }
+        m_extents.push_back(std::move(extent));
+        m_used = 0;
+    }
+
+    QTemporaryFile& extent = *m_extents.back();
+    uchar* region = extent.map(m_used, size);
+    if (!region)
+    {
+        m_error = extent.errorString();
+        return nullptr;
+    }
+
+    m_used += size;
+    m_size += size;
+    return reinterpret_cast<char*>(region);
+}
+
+const char* SpillFile::store(const void* data, qint64 size)
+{
+    char* region = allocate(size);
+    if (region)
+        memcpy(region, data, size);
+    return region;
+}
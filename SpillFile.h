@@ -0,0 +1,54 @@
+#pragma once
+
+#include <qtemporaryfile.h>
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+
+/**
+ * @brief Memory-mapped temporary files holding buffers evicted from RAM.
+ *
+ * Buffers are placed in fixed-size extent files and mapped back, so owners
+ * keep plain pointers and the operating system pages the data in and out
+ * on demand. An extent is sized once, before its first mapping, and a new
+ * one is started when a buffer does not fit: a file is never resized while
+ * it is mapped, which Windows does not allow. The files are removed when
+ * the SpillFile is destroyed; share it through a QSharedPointer to keep
+ * mapped buffers alive.
+ */
+class SpillFile {
+public:
+    static constexpr qint64 EXTENT_SIZE = 64 * 1024 * 1024; ///< Default minimum size of one extent file in bytes.
+
+    /**
+     * @param extentSize Minimum extent size; owners of a single buffer pass its size.
+     */
+    explicit SpillFile(qint64 extentSize = EXTENT_SIZE) : m_extentSize(extentSize) { }
+
+    /**
+     * @brief Reserve and map a writable region.
+     * @param size Region size in bytes.
+     * @return Pointer to the mapped region, or nullptr when no extent can be created or mapped.
+     */
+    char* allocate(qint64 size);
+
+    /**
+     * @brief Copy a buffer into the file and map it.
+     * @param data Bytes to store.
+     * @param size Number of bytes.
+     * @return Pointer to the mapped copy, or nullptr on failure.
+     */
+    const char* store(const void* data, qint64 size);
+
+    qint64 size() const { return m_size; } ///< Bytes stored in the extents.
+    QString errorString() const { return m_error; } ///< Last file error.
+
+private:
+    qint64 m_extentSize; ///< Minimum extent size.
+    std::vector<std::unique_ptr<QTemporaryFile>> m_extents; ///< Extent files; unmapped and removed on destruction.
+    qint64 m_used = 0; ///< Bytes allocated in the last extent.
+    qint64 m_size = 0; ///< Bytes allocated so far.
+    QString m_error; ///< Last file error.
+};
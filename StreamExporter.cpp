@@ -0,0 +1,234 @@
+#include "StreamExporter.h"
+
+#include <qdir.h>
+
+#include "TiffWriter.h"
+
+#include <algorithm>
+#include <limits>
+
+
+StreamExporter::StreamExporter(Logger& logger) : m_queue(STREAM_EXPORT_QUEUE_BLOCKS), m_logger(logger)
+{
+    m_pool.setMaxThreadCount(1);
+}
+
+StreamExporter::~StreamExporter()
+{
+    reset();
+    m_pool.waitForDone();
+}
+
+void StreamExporter::update(const ImageDecoder& decoder, const ImageStream& stream)
+{
+    if (m_slots.size() != static_cast<size_t>(decoder.slotCount()))
+    {
+        if (std::any_of(m_slots.begin(), m_slots.end(), [](const SlotFile& out) { return out.writer != nullptr; }))
+            return; // the slot layout cannot change once lines are written
+        m_slots.resize(static_cast<size_t>(decoder.slotCount()));
+    }
+
+    for (int slot = 0; slot < static_cast<int>(m_slots.size()); ++slot)
+    {
+        SlotFile& out = m_slots[slot];
+        if (!out.done && !(out.writer && out.writer->failed))
+            writeLines(out, decoder, stream, slot, decoder.finalLineCount() - 1, false);
+    }
+}
+
+bool StreamExporter::finishSlot(const ImageDecoder& decoder, const ImageStream& stream, int slot)
+{
+    update(decoder, stream);
+    if (slot < 0 || slot >= static_cast<int>(m_slots.size()))
+        return false;
+
+    // The slot is final, trailing bad lines included, exactly as its frame would be.
+    SlotFile& out = m_slots[slot];
+    if (!out.done && out.writer && !out.writer->failed)
+        writeLines(out, decoder, stream, slot, std::numeric_limits<int>::max(), true);
+    if (!out.writer || out.writer->failed || out.done)
+        return false;
+
+    out.done = true;
+    const std::shared_ptr<SlotWriter> writer = out.writer;
+    post([this, writer] { commit(*writer); });
+    return true;
+}
+
+void StreamExporter::reset()
+{
+    for (SlotFile& out : m_slots)
+    {
+        if (!out.writer || out.done)
+            continue;
+
+        const std::shared_ptr<SlotWriter> writer = out.writer;
+        const int slot = static_cast<int>(&out - m_slots.data());
+        post([this, writer, slot] {
+            if (writer->failed || !writer->file)
+                return;
+            m_logger.warning("Image ended before slot " + QString::number(slot + 1) + " was finished, discarding " + writer->path);
+            writer->file->cancelWriting();
+            writer->file.reset();
+        });
+    }
+    m_slots.clear();
+}
+
+int StreamExporter::nextLine(const ImageDecoder& decoder) const
+{
+    int line = decoder.lineCount();
+    for (const SlotFile& out : m_slots)
+    {
+        if (out.nextLine >= 0 && !out.done && !out.writer->failed)
+            line = std::min(line, out.nextLine);
+    }
+    return line;
+}
+
+bool StreamExporter::open(SlotFile& out, const ImageDecoder& decoder, int slot)
+{
+    std::shared_ptr<SlotWriter> writer = std::make_shared<SlotWriter>();
+    out.writer = writer;
+
+    int right = 0;
+    if (!decoder.streamBounds(slot, out.left, right))
+        return fail(*writer, "The line width is unknown: the stream announces no PixLine and no crop is configured");
+
+    writer->options = m_options;
+    writer->info.width = right - out.left;
+    writer->info.height = 0;
+    writer->info.bitsStored = decoder.frameBitsStored();
+    writer->info.slot = slot;
+    writer->info.metadata = decoder.metadata();
+
+    const QString directory = m_options.directory.isEmpty() ? QDir::currentPath() : m_options.directory;
+    writer->path = QDir(directory).filePath(ImageExporter::baseName(decoder.metadata(), slot, decoder.slotCount()) + "." + ImageExporter::suffix(m_options.format));
+
+    post([this, writer] { begin(*writer); });
+    return true;
+}
+
+void StreamExporter::writeLines(SlotFile& out, const ImageDecoder& decoder, const ImageStream& stream, int slot, int limit, bool all)
+{
+    int firstLine = 0;
+    int lastLine = 0;
+    if (!decoder.slotLines(slot, firstLine, lastLine))
+        return;
+    lastLine = std::min(lastLine, limit);
+
+    if (out.nextLine < 0)
+    {
+        if (!open(out, decoder, slot))
+            return;
+        out.nextLine = firstLine;
+    }
+
+    // Whole blocks of rows per writer call, as the frame exports do.
+    const std::shared_ptr<SlotWriter> writer = out.writer;
+    const int width = writer->info.width;
+    const int blockRows = static_cast<int>(std::max<qint64>(1, EXPORT_WRITE_BLOCK_BYTES / (static_cast<qint64>(width) * UINT16_SIZE)));
+    while (out.nextLine <= lastLine)
+    {
+        // A full queue leaves the lines in the decoder for the next call instead of blocking the decoding thread.
+        const bool counted = m_queue.tryAcquire();
+        if (!counted && !all)
+            return;
+
+        const int count = std::min(blockRows, lastLine - out.nextLine + 1);
+        std::vector<uint16_t> rows(static_cast<size_t>(count) * width);
+        for (int r = 0; r < count; ++r)
+            decoder.assembleLine(stream, out.nextLine + r, out.left, out.left + width, rows.data() + static_cast<size_t>(r) * width);
+        out.nextLine += count;
+
+        post([this, writer, rows = std::move(rows), count, counted] {
+            if (!writer->failed)
+            {
+                const bool written = writer->png ? writer->png->writeRows(rows.data(), count) : writer->raster->writeRows(rows.data(), count);
+                if (written)
+                    writer->rows += count;
+                else
+                    fail(*writer, writer->png ? writer->png->errorString() : writer->raster->errorString());
+            }
+            if (counted)
+                m_queue.release();
+        });
+    }
+}
+
+void StreamExporter::post(std::function<void()> job)
+{
+    m_pool.start(std::move(job));
+}
+
+bool StreamExporter::begin(SlotWriter& writer)
+{
+    if (writer.failed)
+        return false;
+
+    // Unbuffered like the frame exports; the writers hand over whole blocks.
+    writer.file = std::make_unique<QSaveFile>(writer.path);
+    if (!writer.file->open(QIODevice::WriteOnly | QIODevice::Unbuffered))
+        return fail(writer, writer.file->errorString());
+
+    switch (writer.options.format)
+    {
+        case ExportFormat::Tiff:
+            writer.raster = std::make_unique<TiffWriter>(writer.options.tiffTiles);
+            break;
+        case ExportFormat::Pgm:
+            writer.raster = std::make_unique<PgmWriter>();
+            break;
+        case ExportFormat::Raw:
+            writer.raster = std::make_unique<RawWriter>();
+            break;
+        case ExportFormat::Png:
+        default:
+            writer.png = std::make_unique<PngWriter>(writer.options.compressionLevel, writer.options.threads);
+            break;
+    }
+
+    const bool started = writer.png ? writer.png->begin(*writer.file, writer.info) : writer.raster->begin(*writer.file, writer.info);
+    if (!started)
+        return fail(writer, writer.png ? writer.png->errorString() : writer.raster->errorString());
+
+    m_logger.message("Streaming slot " + QString::number(writer.info.slot + 1) + " to " + writer.path + " (" + QString::number(writer.info.width) + " pixels wide)");
+    return true;
+}
+
+bool StreamExporter::commit(SlotWriter& writer)
+{
+    if (writer.failed || !writer.file)
+        return false;
+
+    const bool finished = writer.png ? writer.png->finish() : writer.raster->finish();
+    if (!finished)
+        return fail(writer, writer.png ? writer.png->errorString() : writer.raster->errorString());
+    writer.info.height = writer.rows;
+
+    if (writer.options.format == ExportFormat::Raw)
+    {
+        QSaveFile sidecar(RawWriter::sidecarPath(writer.path));
+        const QByteArray json = RawWriter::sidecar(writer.info);
+        if (!sidecar.open(QIODevice::WriteOnly) || sidecar.write(json) != json.size() || !sidecar.commit())
+            return fail(writer, sidecar.errorString());
+    }
+    if (!writer.file->commit())
+        return fail(writer, writer.file->errorString());
+
+    writer.file.reset();
+    m_logger.message("Exported " + writer.path + " while decoding: " + QString::number(writer.info.width) + "x" + QString::number(writer.info.height));
+    return true;
+}
+
+bool StreamExporter::fail(SlotWriter& writer, const QString& error)
+{
+    m_logger.error("Streaming export" + (writer.path.isEmpty() ? QString() : " of " + writer.path) + " failed: " + error);
+    if (writer.file)
+    {
+        writer.file->cancelWriting();
+        writer.file.reset();
+    }
+    writer.failed = true;
+    return false;
+}
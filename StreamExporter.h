@@ -0,0 +1,145 @@
+#pragma once
+
+#include <qsavefile.h>
+#include <qsemaphore.h>
+#include <qstring.h>
+#include <qthreadpool.h>
+
+#include "ImageDecoder.h"
+#include "ImageExporter.h"
+#include "ImageStream.h"
+#include "Logger.h"
+#include "PngWriter.h"
+#include "RasterWriter.h"
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+
+/**
+ * @brief Writes decoded lines straight to image files, without building frames.
+ *
+ * For unattended batch scans only the file matters. After every decode()
+ * call, update() assembles the lines the decoder has confirmed for each
+ * slot into blocks of rows and hands them to a writer thread, which runs
+ * the streaming writer (PNG, TIFF, PGM or raw) of the slot. Deflate and
+ * disk writes therefore never run on the thread that decodes. At most
+ * STREAM_EXPORT_QUEUE_BLOCKS blocks wait for the writer; beyond that
+ * update() returns and leaves the lines in the decoder for a later call,
+ * so the decoding thread never blocks and a slow disk holds back only the
+ * raw stream. Once a block is queued its lines are no longer needed, and
+ * the caller may release them from the decoder (see nextLine()). A
+ * finished slot queues all its remaining lines, since the decoder drops
+ * them with the image.
+ *
+ * The file of a slot is opened with its first line and committed when the
+ * decoder finishes the slot. The columns come from
+ * ImageDecoder::streamBounds(): the slot band or `PixLine`, limited to the
+ * configured DecodeRoi. Content cropping needs every line before the first
+ * row can be written and does not apply. The height is only known at the
+ * end, so writers complete their headers in finish(); files are written
+ * through QSaveFile and never left behind truncated.
+ */
+class StreamExporter {
+public:
+    /**
+     * @brief Construct an exporter and its writer thread.
+     * @param logger Logger for written files and failures (thread-safe).
+     */
+    explicit StreamExporter(Logger& logger);
+
+    /**
+     * @brief Discards files that are still open and waits for the writer thread.
+     */
+    ~StreamExporter();
+
+    /**
+     * @brief Set format, directory and encoder settings for the files opened from now on.
+     */
+    void setOptions(const ExportOptions& options) { m_options = options; }
+    const ExportOptions& options() const { return m_options; } ///< Current export options.
+
+    /**
+     * @brief Whether streaming is switched on and the format supports it.
+     */
+    bool isEnabled() const { return m_options.streaming && ImageExporter::canStream(m_options.format); }
+
+    /**
+     * @brief Queue the lines confirmed since the last call, opening files for slots that received pixels.
+     * @param decoder Decoder of the current image.
+     * @param stream Stream the decoder reads.
+     */
+    void update(const ImageDecoder& decoder, const ImageStream& stream);
+
+    /**
+     * @brief Queue the remaining lines of a finished slot and the commit of its file.
+     * @return false when the slot had no file or writing it has failed; the commit itself is logged.
+     */
+    bool finishSlot(const ImageDecoder& decoder, const ImageStream& stream, int slot);
+
+    /**
+     * @brief Forget the current image; files of unfinished slots are discarded.
+     */
+    void reset();
+
+    /**
+     * @brief First line an open slot still has to queue, or the decoder's line count when none has.
+     */
+    int nextLine(const ImageDecoder& decoder) const;
+
+private:
+    /**
+     * @brief File and writer of one slot; used only on the writer thread once created.
+     */
+    struct SlotWriter {
+        QString path; ///< Target file.
+        ExportOptions options; ///< Export options when the file was opened.
+        RasterInfo info; ///< Geometry; the height stays 0 until the slot is finished.
+        std::unique_ptr<QSaveFile> file; ///< Open file until the slot is committed or discarded.
+        std::unique_ptr<RasterWriter> raster; ///< Writer for TIFF, PGM and raw.
+        std::unique_ptr<PngWriter> png; ///< Writer for PNG.
+        int rows = 0; ///< Rows written.
+        std::atomic<bool> failed { false }; ///< Whether writing failed; read by update() to skip the slot.
+    };
+
+    /**
+     * @brief Lines of one slot queued so far; used on the decoding thread.
+     */
+    struct SlotFile {
+        std::shared_ptr<SlotWriter> writer; ///< Output on the writer thread (null until the first line).
+        int left = 0; ///< First column.
+        int nextLine = -1; ///< Next decoder line to queue (-1 = file not opened).
+        bool done = false; ///< Whether the commit has been queued.
+    };
+
+    /**
+     * @brief Queue the opening of the file and writer of a slot.
+     */
+    bool open(SlotFile& out, const ImageDecoder& decoder, int slot);
+
+    /**
+     * @brief Assemble the lines of a slot up to its current last line and queue them.
+     * @param limit Last line that may be written (see ImageDecoder::finalLineCount()).
+     * @param all Queue every line, also past STREAM_EXPORT_QUEUE_BLOCKS waiting blocks.
+     */
+    void writeLines(SlotFile& out, const ImageDecoder& decoder, const ImageStream& stream, int slot, int limit, bool all);
+
+    /**
+     * @brief Run a job on the writer thread, after all jobs posted before it.
+     */
+    void post(std::function<void()> job);
+
+    // Writer thread.
+    bool begin(SlotWriter& writer); ///< Open the file and start the writer.
+    bool commit(SlotWriter& writer); ///< Finish the writer, write the raw sidecar and commit the file.
+    bool fail(SlotWriter& writer, const QString& error); ///< Log a failure and discard the file.
+
+    ExportOptions m_options; ///< Format and encoder settings.
+    std::vector<SlotFile> m_slots; ///< Output per slot of the current image.
+    QThreadPool m_pool; ///< Writer thread; one thread runs the jobs in the order they were posted.
+    QSemaphore m_queue; ///< Free places for row blocks waiting for the writer.
+    Logger& m_logger; ///< Logger instance for logging messages.
+};
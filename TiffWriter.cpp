@@ -0,0 +1,294 @@
+#include "TiffWriter.h"
+
+#include <qendian.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+
+namespace {
+
+/**
+ * @brief TIFF field types used by the writer.
+ */
+enum TiffType : quint16 {
+    TIFF_ASCII = 2,
+    TIFF_SHORT = 3,
+    TIFF_LONG = 4,
+    TIFF_RATIONAL = 5,
+    TIFF_LONG8 = 16,
+};
+
+/**
+ * @brief One IFD entry with its value in file byte order.
+ */
+struct TiffEntry {
+    quint16 tag;
+    quint16 type;
+    quint64 count;
+    QByteArray value;
+};
+
+TiffEntry shortEntry(quint16 tag, quint16 v)
+{
+    TiffEntry entry{ tag, TIFF_SHORT, 1, QByteArray() };
+    appendLE<quint16>(entry.value, v);
+    return entry;
+}
+
+TiffEntry longEntry(quint16 tag, quint32 v)
+{
+    TiffEntry entry{ tag, TIFF_LONG, 1, QByteArray() };
+    appendLE<quint32>(entry.value, v);
+    return entry;
+}
+
+TiffEntry asciiEntry(quint16 tag, const QByteArray& text)
+{
+    TiffEntry entry{ tag, TIFF_ASCII, static_cast<quint64>(text.size()) + 1, text };
+    entry.value.append('\0');
+    return entry;
+}
+
+/**
+ * @brief Resolution as a rational in pixels per centimetre.
+ */
+TiffEntry resolutionEntry(quint16 tag, double spacingMm)
+{
+    TiffEntry entry{ tag, TIFF_RATIONAL, 1, QByteArray() };
+    appendLE<quint32>(entry.value, static_cast<quint32>(std::lround(10.0 / spacingMm * 1000.0)));
+    appendLE<quint32>(entry.value, 1000);
+    return entry;
+}
+
+/**
+ * @brief Offsets or byte counts, LONG in classic TIFF and LONG8 in BigTIFF.
+ */
+TiffEntry offsetsEntry(quint16 tag, bool big, const std::vector<quint64>& values)
+{
+    TiffEntry entry{ tag, static_cast<quint16>(big ? TIFF_LONG8 : TIFF_LONG), values.size(), QByteArray() };
+    entry.value.reserve(static_cast<qsizetype>(values.size() * (big ? 8 : 4)));
+    for (quint64 v : values)
+    {
+        if (big)
+            appendLE<quint64>(entry.value, v);
+        else
+            appendLE<quint32>(entry.value, static_cast<quint32>(v));
+    }
+    return entry;
+}
+
+} // namespace
+
+
+bool TiffWriter::writeHeader()
+{
+    if (m_tiled)
+    {
+        m_tilesAcross = (m_info.width + TIFF_TILE_SIZE - 1) / TIFF_TILE_SIZE;
+        m_tileRow.assign(static_cast<size_t>(m_tilesAcross) * TIFF_TILE_SIZE * TIFF_TILE_SIZE, 0);
+        m_tileRowFill = 0;
+    }
+
+    if (m_heightDeferred)
+    {
+        // Room for either header; classic TIFF simply leaves the last 8 bytes unused.
+        m_big = false;
+        m_dataOffset = 16;
+        return put(QByteArray(16, '\0').constData(), 16);
+    }
+
+    m_dataOffset = 8;
+    layout();
+    const QByteArray bytes = header();
+    return put(bytes.constData(), bytes.size());
+}
+
+void TiffWriter::layout()
+{
+    const quint64 rowBytes = static_cast<quint64>(m_info.width) * UINT16_SIZE;
+    if (m_tiled)
+    {
+        const int tilesDown = (m_info.height + TIFF_TILE_SIZE - 1) / TIFF_TILE_SIZE;
+        m_chunkBytes = static_cast<quint64>(TIFF_TILE_SIZE) * TIFF_TILE_SIZE * UINT16_SIZE;
+        m_chunkCount = static_cast<quint64>(m_tilesAcross) * tilesDown;
+        m_dataBytes = m_chunkBytes * m_chunkCount;
+    }
+    else
+    {
+        m_rowsPerStrip = static_cast<int>(std::clamp<quint64>(static_cast<quint64>(TIFF_STRIP_BYTES) / rowBytes, 1, static_cast<quint64>(m_info.height)));
+        m_chunkBytes = rowBytes * m_rowsPerStrip;
+        m_chunkCount = (static_cast<quint64>(m_info.height) + m_rowsPerStrip - 1) / m_rowsPerStrip;
+        m_dataBytes = rowBytes * m_info.height;
+    }
+
+    // Classic TIFF while everything, IFD included, stays addressable with 32 bits.
+    m_big = false;
+    m_ifd = buildIfd(m_dataOffset + m_dataBytes);
+    if (m_dataOffset + m_dataBytes + static_cast<quint64>(m_ifd.size()) > 0xFFFFFFFFull)
+    {
+        m_big = true;
+        m_dataOffset = 16;
+        m_ifd = buildIfd(m_dataOffset + m_dataBytes);
+    }
+}
+
+QByteArray TiffWriter::header() const
+{
+    QByteArray bytes("II", 2);
+    if (m_big)
+    {
+        appendLE<quint16>(bytes, 43);
+        appendLE<quint16>(bytes, 8); // offset size
+        appendLE<quint16>(bytes, 0);
+        appendLE<quint64>(bytes, m_dataOffset + m_dataBytes);
+    }
+    else
+    {
+        appendLE<quint16>(bytes, 42);
+        appendLE<quint32>(bytes, static_cast<quint32>(m_dataOffset + m_dataBytes));
+    }
+    return bytes;
+}
+
+bool TiffWriter::consumeRows(const uint16_t* pixels, int count)
+{
+    if (!m_tiled)
+        return RasterWriter::consumeRows(pixels, count);
+
+    const size_t stride = static_cast<size_t>(m_tilesAcross) * TIFF_TILE_SIZE;
+    for (int i = 0; i < count; ++i)
+    {
+        memcpy(m_tileRow.data() + m_tileRowFill * stride, pixels + static_cast<size_t>(i) * m_info.width, static_cast<size_t>(m_info.width) * UINT16_SIZE);
+        if (++m_tileRowFill == TIFF_TILE_SIZE && !writeTileRow())
+            return false;
+    }
+    return true;
+}
+
+bool TiffWriter::writeTrailer()
+{
+    if (m_tiled && m_tileRowFill > 0)
+    {
+        // Pad the bottom tiles with zero rows.
+        const size_t stride = static_cast<size_t>(m_tilesAcross) * TIFF_TILE_SIZE;
+        std::fill(m_tileRow.begin() + m_tileRowFill * stride, m_tileRow.end(), 0);
+        if (!writeTileRow())
+            return false;
+    }
+
+    // With a deferred height the rows are known now; the data already starts behind a 16-byte header.
+    if (m_heightDeferred)
+        layout();
+
+    if (static_cast<quint64>(m_written) != m_dataOffset + m_dataBytes)
+        return fail("TIFF data size does not match the layout");
+    return put(m_ifd.constData(), m_ifd.size()) && (!m_heightDeferred || patch(0, header()));
+}
+
+bool TiffWriter::writeTileRow()
+{
+    const size_t stride = static_cast<size_t>(m_tilesAcross) * TIFF_TILE_SIZE;
+    for (int tx = 0; tx < m_tilesAcross; ++tx)
+    {
+        for (int y = 0; y < TIFF_TILE_SIZE; ++y)
+        {
+            if (!putSamples(m_tileRow.data() + y * stride + static_cast<size_t>(tx) * TIFF_TILE_SIZE, TIFF_TILE_SIZE))
+                return false;
+        }
+    }
+    m_tileRowFill = 0;
+    return true;
+}
+
+QByteArray TiffWriter::buildIfd(quint64 ifdOffset) const
+{
+    std::vector<quint64> offsets(static_cast<size_t>(m_chunkCount));
+    std::vector<quint64> byteCounts(static_cast<size_t>(m_chunkCount), m_chunkBytes);
+    for (size_t i = 0; i < offsets.size(); ++i)
+        offsets[i] = m_dataOffset + i * m_chunkBytes;
+    if (!m_tiled)
+    {
+        // The last strip holds the remaining rows only.
+        const quint64 rowBytes = static_cast<quint64>(m_info.width) * UINT16_SIZE;
+        byteCounts.back() = rowBytes * (m_info.height - static_cast<quint64>(m_rowsPerStrip) * (m_chunkCount - 1));
+    }
+
+    std::vector<TiffEntry> entries;
+    entries.push_back(longEntry(256, static_cast<quint32>(m_info.width))); // ImageWidth
+    entries.push_back(longEntry(257, static_cast<quint32>(m_info.height))); // ImageLength
+    entries.push_back(shortEntry(258, 16)); // BitsPerSample
+    entries.push_back(shortEntry(259, 1)); // Compression: none
+    entries.push_back(shortEntry(262, 1)); // PhotometricInterpretation: BlackIsZero
+    entries.push_back(shortEntry(277, 1)); // SamplesPerPixel
+    entries.push_back(shortEntry(284, 1)); // PlanarConfiguration: contiguous
+    entries.push_back(shortEntry(339, 1)); // SampleFormat: unsigned integer
+    entries.push_back(asciiEntry(305, "CR35-NDT-Plus")); // Software
+    if (m_info.metadata.valid && !m_info.metadata.json.isEmpty())
+        entries.push_back(asciiEntry(270, m_info.metadata.json)); // ImageDescription
+    if (sampleLimit() != 0xFFFF)
+        entries.push_back(shortEntry(281, sampleLimit())); // MaxSampleValue
+    if (m_info.metadata.pixelSpacingX > 0.0 && m_info.metadata.pixelSpacingY > 0.0)
+    {
+        entries.push_back(resolutionEntry(282, m_info.metadata.pixelSpacingX)); // XResolution
+        entries.push_back(resolutionEntry(283, m_info.metadata.pixelSpacingY)); // YResolution
+        entries.push_back(shortEntry(296, 3)); // ResolutionUnit: centimetre
+    }
+    if (m_tiled)
+    {
+        entries.push_back(longEntry(322, TIFF_TILE_SIZE)); // TileWidth
+        entries.push_back(longEntry(323, TIFF_TILE_SIZE)); // TileLength
+        entries.push_back(offsetsEntry(324, m_big, offsets)); // TileOffsets
+        entries.push_back(offsetsEntry(325, m_big, byteCounts)); // TileByteCounts
+    }
+    else
+    {
+        entries.push_back(offsetsEntry(273, m_big, offsets)); // StripOffsets
+        entries.push_back(longEntry(278, static_cast<quint32>(m_rowsPerStrip))); // RowsPerStrip
+        entries.push_back(offsetsEntry(279, m_big, byteCounts)); // StripByteCounts
+    }
+    std::sort(entries.begin(), entries.end(), [](const TiffEntry& a, const TiffEntry& b) { return a.tag < b.tag; });
+
+    // Values that do not fit the entry go behind the IFD, word aligned.
+    const int inlineBytes = m_big ? 8 : 4;
+    const quint64 ifdBytes = (m_big ? 8 + 20 * entries.size() + 8 : 2 + 12 * entries.size() + 4);
+    QByteArray ifd;
+    QByteArray values;
+    if (m_big)
+        appendLE<quint64>(ifd, entries.size());
+    else
+        appendLE<quint16>(ifd, static_cast<quint16>(entries.size()));
+    for (const TiffEntry& entry : entries)
+    {
+        appendLE<quint16>(ifd, entry.tag);
+        appendLE<quint16>(ifd, entry.type);
+        if (m_big)
+            appendLE<quint64>(ifd, entry.count);
+        else
+            appendLE<quint32>(ifd, static_cast<quint32>(entry.count));
+
+        if (entry.value.size() <= inlineBytes)
+        {
+            ifd.append(entry.value);
+            ifd.append(QByteArray(inlineBytes - entry.value.size(), '\0'));
+            continue;
+        }
+
+        const quint64 offset = ifdOffset + ifdBytes + static_cast<quint64>(values.size());
+        if (m_big)
+            appendLE<quint64>(ifd, offset);
+        else
+            appendLE<quint32>(ifd, static_cast<quint32>(offset));
+        values.append(entry.value);
+        if (values.size() % 2)
+            values.append('\0');
+    }
+    // No further IFD.
+    if (m_big)
+        appendLE<quint64>(ifd, 0);
+    else
+        appendLE<quint32>(ifd, 0);
+
+    return ifd + values;
+}
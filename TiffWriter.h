@@ -0,0 +1,74 @@
+#pragma once
+
+#include "RasterWriter.h"
+
+#include <vector>
+
+
+/**
+ * @brief Uncompressed 16-bit grayscale TIFF, in strips or tiles, switching to BigTIFF past 4 GB.
+ *
+ * The file is written in a single forward pass without seeking: header,
+ * pixel data, then the IFD. Without compression every strip or tile has a
+ * known size, so the IFD offset and all strip/tile offsets are computed
+ * up front. When the file would not fit 32-bit offsets, the BigTIFF layout
+ * (64-bit offsets) is used instead. With a deferred height the header slot
+ * is reserved at the BigTIFF size, the layout is computed by finish(), and
+ * the header is filled in afterwards.
+ *
+ * Strips are the frame rows unchanged (little-endian, TIFF_STRIP_BYTES per
+ * strip), so they are written straight from the frame buffer. Tiles of
+ * TIFF_TILE_SIZE pixels need one row of tiles buffered; edge tiles are
+ * padded with zeros. The stream JSON header is stored as ImageDescription,
+ * the pixel spacing as X/YResolution, and `BitsStored` as MaxSampleValue.
+ */
+class TiffWriter : public RasterWriter {
+public:
+    /**
+     * @brief Create a writer.
+     * @param tiled true for TIFF_TILE_SIZE tiles, false for strips.
+     */
+    explicit TiffWriter(bool tiled = false) : m_tiled(tiled) { }
+
+    bool isBigTiff() const { return m_big; } ///< Whether the last file uses the BigTIFF layout (known after finish() for a deferred height).
+    bool deferredHeight() const override { return true; }
+
+protected:
+    bool writeHeader() override;
+    bool consumeRows(const uint16_t* pixels, int count) override;
+    bool writeTrailer() override;
+
+private:
+    /**
+     * @brief Strip or tile layout and IFD for m_info.height rows, switching to BigTIFF when needed.
+     */
+    void layout();
+
+    /**
+     * @brief File header pointing at the IFD behind the pixel data.
+     */
+    QByteArray header() const;
+
+    /**
+     * @brief Build the IFD and the out-of-line tag values behind it.
+     * @param ifdOffset File offset the IFD is written at.
+     */
+    QByteArray buildIfd(quint64 ifdOffset) const;
+
+    /**
+     * @brief Write the buffered row of tiles, tile by tile.
+     */
+    bool writeTileRow();
+
+    bool m_tiled; ///< Tiles instead of strips.
+    bool m_big = false; ///< BigTIFF layout (64-bit offsets).
+    quint64 m_dataOffset = 0; ///< File offset of the first strip or tile.
+    quint64 m_dataBytes = 0; ///< Size of all strips or tiles.
+    quint64 m_chunkBytes = 0; ///< Bytes per full strip or per tile.
+    quint64 m_chunkCount = 0; ///< Number of strips or tiles.
+    int m_rowsPerStrip = 0; ///< Rows per strip (strip layout).
+    int m_tilesAcross = 0; ///< Tiles per tile row (tile layout).
+    QByteArray m_ifd; ///< IFD written by writeTrailer().
+    std::vector<uint16_t> m_tileRow; ///< TIFF_TILE_SIZE rows, padded to whole tiles.
+    int m_tileRowFill = 0; ///< Rows in m_tileRow.
+};
@@ -0,0 +1,118 @@
+#include "ToneMap.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__AVX2__) || (defined(_MSC_VER) && defined(_M_X64))
+#define TONE_MAP_AVX2 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__AVX2__)
+#include <intrin.h>
+#endif
+#endif
+
+
+namespace {
+
+constexpr size_t LUT_SIZE = 65536;
+constexpr size_t LUT_PADDING = 4; ///< A 32-bit gather at the last entry reads 3 bytes past it.
+
+#ifdef TONE_MAP_AVX2
+/**
+ * @brief Whether the AVX2 kernel may run on this CPU.
+ *
+ * GCC/Clang only compile the kernel when AVX2 is enabled for the whole
+ * build; MSVC always compiles it and checks CPUID and the OS state once.
+ */
+bool hasAvx2()
+{
+#if defined(__AVX2__)
+    return true;
+#else
+    static const bool supported = [] {
+        int info[4] = {};
+        __cpuid(info, 1);
+        const bool osSavesYmm = (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 0x6) == 0x6;
+        __cpuidex(info, 7, 0);
+        return osSavesYmm && (info[1] & (1 << 5)) != 0;
+    }();
+    return supported;
+#endif
+}
+
+/**
+ * @brief Map 16 pixels per iteration with two 8-lane table gathers.
+ * @return Number of pixels mapped.
+ */
+size_t mapAvx2(const uint8_t* lut, const uint16_t* src, uint8_t* dst, size_t count)
+{
+    const __m256i low = _mm256_set1_epi32(0xFF);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        const __m256i i0 = _mm256_cvtepu16_epi32(_mm256_castsi256_si128(v));
+        const __m256i i1 = _mm256_cvtepu16_epi32(_mm256_extracti128_si256(v, 1));
+        const __m256i g0 = _mm256_and_si256(_mm256_i32gather_epi32(reinterpret_cast<const int*>(lut), i0, 1), low);
+        const __m256i g1 = _mm256_and_si256(_mm256_i32gather_epi32(reinterpret_cast<const int*>(lut), i1, 1), low);
+        // packus works per 128-bit lane; restore the pixel order before narrowing to bytes.
+        const __m256i words = _mm256_permute4x64_epi64(_mm256_packus_epi32(g0, g1), 0xD8);
+        const __m128i bytes = _mm_packus_epi16(_mm256_castsi256_si128(words), _mm256_extracti128_si256(words, 1));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), bytes);
+    }
+    return i;
+}
+#endif
+
+} // namespace
+
+
+ToneMap::ToneMap()
+{
+    setWindow(0, 65535);
+}
+
+ToneMap ToneMap::forBitsStored(int bitsStored)
+{
+    ToneMap map;
+    if (bitsStored > 0 && bitsStored < 16)
+        map.setWindow(0, (1 << bitsStored) - 1);
+    return map;
+}
+
+void ToneMap::setWindow(int low, int high, double gamma)
+{
+    m_low = std::clamp(low, 0, 65534);
+    m_high = std::clamp(high, m_low + 1, 65535);
+    m_gamma = gamma > 0.0 ? gamma : 1.0;
+    m_lut.resize(LUT_SIZE + LUT_PADDING);
+
+    std::fill(m_lut.begin(), m_lut.begin() + m_low, uint8_t(0));
+    std::fill(m_lut.begin() + m_high, m_lut.end(), uint8_t(255));
+    const double range = m_high - m_low;
+    const bool linear = m_gamma == 1.0;
+    for (int v = m_low; v < m_high; ++v)
+    {
+        const double t = (v - m_low) / range;
+        m_lut[v] = static_cast<uint8_t>(std::lround(255.0 * (linear ? t : std::pow(t, m_gamma))));
+    }
+}
+
+void ToneMap::map(const uint16_t* src, uint8_t* dst, size_t count) const
+{
+    const uint8_t* lut = m_lut.data();
+    size_t i = 0;
+#ifdef TONE_MAP_AVX2
+    if (hasAvx2())
+        i = mapAvx2(lut, src, dst, count);
+#endif
+    for (; i + 4 <= count; i += 4)
+    {
+        dst[i] = lut[src[i]];
+        dst[i + 1] = lut[src[i + 1]];
+        dst[i + 2] = lut[src[i + 2]];
+        dst[i + 3] = lut[src[i + 3]];
+    }
+    for (; i < count; ++i)
+        dst[i] = lut[src[i]];
+}
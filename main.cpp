@@ -1,11 +1,21 @@
 #include "CR35NDTPlus.h"
 #include <QtWidgets/QApplication>
 
+#include "Benchmark.h"
 #include "Logger.h"
 
 int main(int argc, char *argv[])
 {
     QApplication app(argc, argv);
+
+    // Command line benchmarks run without the GUI.
+    const QStringList arguments = app.arguments();
+    if (arguments.size() > 1 && arguments.at(1) == "--benchmark")
+    {
+        Logger logger("CR35NDTPlus_Benchmark");
+        return Benchmark::run(arguments.mid(2), logger);
+    }
+
     Logger logger("CR35NDTPlus");
     CR35NDTPlus window(logger);
     window.show();